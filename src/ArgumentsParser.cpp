@@ -6,6 +6,8 @@
 #include <iostream>
 #include <unistd.h>
 #include <cstdlib>
+#include <algorithm>
+#include <sstream>
 
 
 ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
@@ -22,7 +24,7 @@ ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
     optind = 1;
 
     int opt;
-    while ((opt = getopt(argc, argv, "p:Tc:C:nha:b:o:")) != -1)
+    while ((opt = getopt(argc, argv, "p:Tc:C:nhH:a:b:o:w:B:R:j:J:P:Id:E:S:W:L:F:Z:D")) != -1)
     {
         switch (opt) 
         {
@@ -58,6 +60,23 @@ ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
             case 'h':
                 options.headersOnly = true;
                 break;
+            case 'H': {
+                // Fields may be separated by spaces or commas
+                std::string fields = optarg;
+                std::replace(fields.begin(), fields.end(), ',', ' ');
+                std::istringstream stream(fields);
+                std::string field;
+                options.headerFields.clear();
+                while (stream >> field) {
+                    options.headerFields += (options.headerFields.empty() ? "" : " ") + field;
+                }
+                if (options.headerFields.empty()) {
+                    printUsage();
+                    throw std::invalid_argument("Header field list must not be empty.");
+                }
+                options.headersOnly = true;
+                break;
+            }
             case 'a':
                 options.authFile = optarg;
                 break;
@@ -67,6 +86,106 @@ ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
             case 'o':
                 options.outputDir = optarg;
                 break;
+            case 'w':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Pipeline depth must be a positive number.");
+                }
+                options.pipelineDepth = std::atoi(optarg);
+                break;
+            case 'B':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Batch size must be a positive number.");
+                }
+                options.batchSize = std::atoi(optarg);
+                break;
+            case 'R':
+                if (std::atoi(optarg) < 4 || std::atoi(optarg) > 65536) {
+                    printUsage();
+                    throw std::invalid_argument("Read buffer size is out of range (4-65536 KiB).");
+                }
+                options.readBufferSize = static_cast<size_t>(std::atoi(optarg)) * 1024;
+                break;
+            case 'j':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Number of connections must be a positive number.");
+                }
+                options.connections = std::atoi(optarg);
+                break;
+            case 'I':
+                options.incremental = true;
+                break;
+            case 'd':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Poll interval must be a positive number.");
+                }
+                options.daemon = true;
+                options.pollInterval = std::atoi(optarg);
+                break;
+            case 'J':
+                options.jobFile = optarg;
+                break;
+            case 'P':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Number of accounts must be a positive number.");
+                }
+                options.accounts = std::atoi(optarg);
+                break;
+            case 'S':
+                if (std::atoi(optarg) < 0) {
+                    printUsage();
+                    throw std::invalid_argument("Group commit size must not be negative.");
+                }
+                options.groupCommit = std::atoi(optarg);
+                break;
+            case 'W':
+                if (std::atoi(optarg) < 0 || std::atoi(optarg) > 4096) {
+                    printUsage();
+                    throw std::invalid_argument("Write-behind limit is out of range (0-4096 MiB).");
+                }
+                options.writeBehind = static_cast<size_t>(std::atoi(optarg)) * 1024 * 1024;
+                break;
+            case 'L':
+                if (std::string(optarg) == "files") {
+                    options.layout = StorageLayout::Files;
+                } else if (std::string(optarg) == "packed") {
+                    options.layout = StorageLayout::Packed;
+                } else if (std::string(optarg) == "maildir") {
+                    options.layout = StorageLayout::Maildir;
+                } else {
+                    printUsage();
+                    throw std::invalid_argument("Unknown storage layout, use files, packed or maildir.");
+                }
+                break;
+            case 'F':
+                if (std::atoi(optarg) < 1 || std::atoi(optarg) > 256) {
+                    printUsage();
+                    throw std::invalid_argument("Maildir fan-out is out of range (1-256).");
+                }
+                options.fanOut = std::atoi(optarg);
+                break;
+            case 'Z':
+                if (std::atoi(optarg) < 0 || std::atoi(optarg) > 1000) {
+                    printUsage();
+                    throw std::invalid_argument("Number of dictionary samples is out of range (0-1000).");
+                }
+                options.compressStorage = true;
+                options.dictionarySamples = std::atoi(optarg);
+                break;
+            case 'D':
+                options.deduplicate = true;
+                break;
+            case 'E':
+                if (std::atoi(optarg) < 1) {
+                    printUsage();
+                    throw std::invalid_argument("Number of accounts per thread must be a positive number.");
+                }
+                options.accountsPerThread = std::atoi(optarg);
+                break;
             default:
                 printUsage();
                 throw std::invalid_argument("Unknown argument.");
@@ -79,7 +198,7 @@ ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
     }
 
     // Check for required options after option parsing
-    if (options.authFile.empty()) {
+    if (options.authFile.empty() && options.jobFile.empty()) {
         printUsage();
         throw std::invalid_argument("Missing required argument -a.");
     }
@@ -87,6 +206,14 @@ ProgramOptions ArgumentsParser::parse(int argc, char* argv[]) {
         printUsage();
         throw std::invalid_argument("Missing required argument -o.");
     }
+    if (options.deduplicate && options.layout == StorageLayout::Packed) {
+        printUsage();
+        throw std::invalid_argument("Packed messages cannot be deduplicated, they are not stored in files.");
+    }
+    if (options.compressStorage && options.layout == StorageLayout::Maildir) {
+        printUsage();
+        throw std::invalid_argument("Maildir messages cannot be compressed, mail readers would not read them.");
+    }
 
 
     // Set default port based on TLS usage
@@ -101,7 +228,7 @@ void ArgumentsParser::printUsage() {
     std::cout << std::endl << "Usage: imapcl <server_address> [options]" << std::endl;
     std::cout << "Required arguments:" << std::endl;
     std::cout << "  <server_address>         Address of the IMAP server" << std::endl;
-    std::cout << "  -a <auth_file>           Path to the authentication file" << std::endl;
+    std::cout << "  -a <auth_file>           Path to the authentication file (not needed with -J)" << std::endl;
     std::cout << "  -o <output_directory>    Path to the directory for saving emails" << std::endl;
     std::cout << std::endl;
     std::cout << "Optional arguments:" << std::endl;
@@ -111,5 +238,24 @@ void ArgumentsParser::printUsage() {
     std::cout << "    -C <cert_directory>    Path to the certificate directory (default is /etc/ssl/certs)" << std::endl;
     std::cout << "  -n                       Download only new messages" << std::endl;
     std::cout << "  -h                       Download only message headers" << std::endl;
+    std::cout << "  -H <fields>              Download only the listed header fields with size, date and flags" << std::endl;
     std::cout << "  -b <mailbox>             Name of the mailbox (default is INBOX)" << std::endl;
+    std::cout << "  -w <depth>               Number of pipelined FETCH commands (default is 1)" << std::endl;
+    std::cout << "  -B <count>               Maximum number of messages per FETCH command (default is 1)" << std::endl;
+    std::cout << "  -R <size>                Size of the receive buffer in KiB (default is 256)" << std::endl;
+    std::cout << "  -j <connections>         Maximum number of parallel connections (default is 1)" << std::endl;
+    std::cout << "  -I                       Synchronize only changes if the server supports CONDSTORE/QRESYNC" << std::endl;
+    std::cout << "  -d <seconds>             Stay connected and download new messages as they arrive," << std::endl;
+    std::cout << "                           poll every <seconds> if the server does not support IDLE" << std::endl;
+    std::cout << "  -J <job_file>            Synchronize the accounts and mailboxes listed in the file" << std::endl;
+    std::cout << "  -P <accounts>            Number of accounts synchronized at once with -J (default is 4)" << std::endl;
+    std::cout << "  -S <messages>            Number of messages flushed to disk together (default is 64, 0 disables flushing)" << std::endl;
+    std::cout << "  -E <accounts>            Number of those accounts served by one thread (default is 1)" << std::endl;
+    std::cout << "  -W <size>                Write messages in the background with at most <size> MiB queued (default is 0, off)" << std::endl;
+    std::cout << "  -L <layout>              Storage layout: files (one file per message, default), packed (segment files)" << std::endl;
+    std::cout << "                           or maildir" << std::endl;
+    std::cout << "  -F <buckets>             Number of Maildirs the messages of a mailbox are spread over (default is 1)" << std::endl;
+    std::cout << "  -Z <messages>            Store messages compressed with a dictionary trained on the first <messages>" << std::endl;
+    std::cout << "                           messages of every account (0 uses no dictionary)" << std::endl;
+    std::cout << "  -D                       Store identical messages of all mailboxes and accounts only once" << std::endl;
 }
\ No newline at end of file
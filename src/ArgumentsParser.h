@@ -9,6 +9,8 @@
 #include <vector>
 #include <map>
 
+#include "StorageLayout.h"
+
 /**
  * @struct ProgramOptions
  * @brief Holds the program options parsed from command line arguments.
@@ -21,9 +23,27 @@ struct ProgramOptions {
     std::string certDir = "/etc/ssl/certs"; ///< Certificate directory, default is /etc/ssl/certs
     bool onlyNewMessages = false; ///< Download only new messages, default is false
     bool headersOnly = false; ///< Download only message headers, default is false
+    std::string headerFields; ///< Header fields downloaded with the envelope, empty downloads the whole header
     std::string authFile; ///< Authentication file path
     std::string mailbox = "INBOX"; ///< Mailbox name, default is INBOX
     std::string outputDir; ///< Output directory path
+    int pipelineDepth = 1; ///< Number of FETCH commands kept in flight, default is 1 (no pipelining)
+    int batchSize = 1; ///< Maximum number of messages fetched by one FETCH command, default is 1
+    size_t readBufferSize = 256 * 1024; ///< Size of the receive buffer in bytes, default is 256 KiB
+    size_t groupCommit = 64; ///< Messages made durable together with one flush, 0 disables flushing, default is 64
+    StorageLayout layout = StorageLayout::Files; ///< Layout of the stored messages, default is one file per message
+    unsigned fanOut = 1; ///< Bucket Maildirs per mailbox with the Maildir layout, default is 1 (no fan-out)
+    bool compressStorage = false; ///< Store messages compressed, default is false
+    size_t dictionarySamples = 0; ///< Messages of every account the compression dictionary is trained on
+    bool deduplicate = false; ///< Store identical messages once, default is false
+    size_t writeBehind = 0; ///< Bytes of messages queued for the background writer, 0 writes on the receiving thread, default is 0
+    int connections = 1; ///< Maximum number of parallel connections to the server, default is 1
+    bool incremental = false; ///< Synchronize only changes using CONDSTORE/QRESYNC, default is false
+    bool daemon = false; ///< Stay connected and download new messages as they arrive, default is false
+    int pollInterval = 60; ///< Seconds between NOOP polls in daemon mode when the server lacks IDLE
+    std::string jobFile; ///< Job list with accounts and mailboxes, replaces -a and -b when set
+    int accounts = 4; ///< Maximum number of accounts synchronized at once from the job list, default is 4
+    int accountsPerThread = 1; ///< Accounts of the job list multiplexed by one thread with an event loop, default is 1
 };
 
 /**
@@ -0,0 +1,115 @@
+// ContentStore.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "ContentStore.h"
+#include "FileException.h"
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ContentHash::ContentHash() : context_(EVP_MD_CTX_new()) {
+    if (!context_ || EVP_DigestInit_ex(context_, EVP_sha256(), nullptr) != 1) {
+        EVP_MD_CTX_free(context_);
+        throw FileException("Failed to initialize message hashing");
+    }
+}
+
+ContentHash::~ContentHash() {
+    EVP_MD_CTX_free(context_);
+}
+
+void ContentHash::update(const char *data, size_t length) {
+    EVP_DigestUpdate(context_, data, length);
+}
+
+std::string ContentHash::hex() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(context_, digest, &length);
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (unsigned int i = 0; i < length; i++) {
+        hex += digits[digest[i] >> 4];
+        hex += digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+ContentStore::ContentStore(const std::string &rootPath) : storePath_(rootPath + "/" + DIRECTORY) {
+}
+
+std::string ContentStore::objectPath(const std::string &digest) const {
+    return storePath_ + "/" + digest.substr(0, 2) + "/" + digest.substr(2);
+}
+
+bool ContentStore::place(const std::string &digest, const std::string &linkPath, const std::string &path) {
+    if (::link(objectPath(digest).c_str(), linkPath.c_str()) != 0) {
+        return false;
+    }
+    if (std::rename(linkPath.c_str(), path.c_str()) != 0) {
+        ::unlink(linkPath.c_str());
+        throw FileException("Failed to move message file to: " + path);
+    }
+    // Renaming a link over another link of the same object does nothing
+    ::unlink(linkPath.c_str());
+    return true;
+}
+
+void ContentStore::adopt(const std::string &path, const std::string &digest) {
+    std::string object = objectPath(digest);
+    if (::link(path.c_str(), object.c_str()) == 0 || errno != ENOENT) {
+        return;
+    }
+    // First object of its fan-out directory
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(object).parent_path(), ec);
+    ::link(path.c_str(), object.c_str());
+}
+
+void ContentStore::remember(const std::string &key, const std::string &digest) {
+    std::filesystem::path keyPath = storePath_ + "/" + IDS_DIRECTORY + "/" + key;
+
+    // The link is relative, so the output directory can be moved
+    std::string target;
+    std::filesystem::path keyParts(key);
+    for (auto it = keyParts.begin(); it != keyParts.end(); ++it) {
+        target += "../";
+    }
+    target += digest.substr(0, 2) + "/" + digest.substr(2);
+
+    std::error_code ec;
+    std::filesystem::create_directories(keyPath.parent_path(), ec);
+    if (::symlink(target.c_str(), keyPath.c_str()) != 0 && errno == EEXIST) {
+        ::unlink(keyPath.c_str());
+        ::symlink(target.c_str(), keyPath.c_str());
+    }
+}
+
+std::string ContentStore::recall(const std::string &key) const {
+    char target[4096];
+    ssize_t length = ::readlink((storePath_ + "/" + IDS_DIRECTORY + "/" + key).c_str(), target, sizeof(target) - 1);
+    if (length < 0) {
+        return "";
+    }
+    std::filesystem::path object(std::string(target, length));
+    return object.parent_path().filename().string() + object.filename().string();
+}
+
+size_t ContentStore::collect(const std::set<std::string> &digests) {
+    size_t deleted = 0;
+    for (const std::string &digest : digests) {
+        std::string object = objectPath(digest);
+        struct stat info;
+        if (::lstat(object.c_str(), &info) == 0 && S_ISREG(info.st_mode) && info.st_nlink == 1 &&
+            ::unlink(object.c_str()) == 0) {
+            deleted++;
+        }
+    }
+    return deleted;
+}
@@ -0,0 +1,138 @@
+// ContentStore.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef CONTENTSTORE_H
+#define CONTENTSTORE_H
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <openssl/evp.h>
+
+/**
+ * @class ContentHash
+ * @brief SHA-256 of data arriving in parts.
+ */
+class ContentHash {
+public:
+    /**
+     * @brief Starts a new hash.
+     * @throws FileException if OpenSSL fails to initialize.
+     */
+    ContentHash();
+
+    ~ContentHash();
+
+    ContentHash(const ContentHash &) = delete;
+    ContentHash &operator=(const ContentHash &) = delete;
+
+    /**
+     * @brief Hashes the next part of the data.
+     *
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void update(const char *data, size_t length);
+
+    /**
+     * @brief Ends the hash.
+     * @return std::string The hash as lowercase hexadecimal digits.
+     */
+    std::string hex();
+
+private:
+    EVP_MD_CTX *context_;
+};
+
+/**
+ * @class ContentStore
+ * @brief Messages of all accounts and mailboxes stored once by their content.
+ *
+ * Every stored message is also hard-linked as an object named by the SHA-256
+ * of its stored bytes into the .objects directory of the output directory. A
+ * message with the same content saved later, in any mailbox of any account,
+ * becomes another hard link of the object instead of a new copy. Mailbox
+ * directories keep their usual files, so readers do not know about the store.
+ *
+ * Objects are named <2 digits>/<remaining 62 digits> to keep directories
+ * small. An object only linked from the store belongs to no mailbox anymore
+ * and is deleted by collect(), which only looks at the objects it is given, so
+ * the store is never scanned as a whole.
+ *
+ * Keys such as the object IDs assigned by the server can be remembered as
+ * symbolic links to objects in the ids directory, so a message known by its
+ * key is found without downloading it.
+ *
+ * The store is an optimization: a missing object only costs another copy, so
+ * object links are neither synced nor required to succeed.
+ */
+class ContentStore {
+public:
+    /**
+     * @brief Opens the store of the output directory.
+     *
+     * @param rootPath Path to the output directory.
+     */
+    ContentStore(const std::string &rootPath);
+
+    /**
+     * @brief Places a hard link of the object with the given hash at the path.
+     *
+     * An existing file at the path is replaced atomically.
+     *
+     * @param digest Hash of the content.
+     * @param linkPath Unused path in the directory of the target for the temporary link.
+     * @param path Path of the message.
+     * @return bool True if the object exists and was linked, false if it is not stored.
+     */
+    bool place(const std::string &digest, const std::string &linkPath, const std::string &path);
+
+    /**
+     * @brief Makes a stored message the object of its hash, unless the object exists already.
+     *
+     * @param path Path of the message.
+     * @param digest Hash of the content.
+     */
+    void adopt(const std::string &path, const std::string &digest);
+
+    /**
+     * @brief Remembers the object a key refers to.
+     *
+     * @param key Relative path of the key in the ids directory, e.g. account/id.
+     * @param digest Hash of the content.
+     */
+    void remember(const std::string &key, const std::string &digest);
+
+    /**
+     * @brief Returns the hash of the object a key refers to.
+     *
+     * @param key The key given to remember().
+     * @return std::string The hash, empty if the key is unknown.
+     */
+    std::string recall(const std::string &key) const;
+
+    /**
+     * @brief Deletes the given objects if no mailbox links to them anymore.
+     *
+     * Keys referring to deleted objects are left alone, a key is only created
+     * before its object is linked and recalling a deleted object costs a download.
+     *
+     * @param digests Hashes of the objects whose mailbox links were removed.
+     * @return size_t Number of deleted objects.
+     */
+    size_t collect(const std::set<std::string> &digests);
+
+    /**
+     * @brief Returns the path of the object with the given hash.
+     */
+    std::string objectPath(const std::string &digest) const;
+
+    static constexpr const char *DIRECTORY = ".objects"; ///< Subdirectory of the output directory holding the objects
+    static constexpr const char *IDS_DIRECTORY = "ids"; ///< Subdirectory of the store holding the keys
+
+private:
+    std::string storePath_;
+};
+
+#endif // CONTENTSTORE_H
@@ -0,0 +1,80 @@
+// DeflateStream.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "DeflateStream.h"
+#include "ImapException.h"
+#include <cstring>
+
+namespace {
+
+/// Negative window bits select raw DEFLATE without the zlib header, as RFC 4978 requires
+const int RAW_WINDOW_BITS = -15;
+
+}
+
+DeflateStream::DeflateStream() {
+    std::memset(&deflater_, 0, sizeof(deflater_));
+    std::memset(&inflater_, 0, sizeof(inflater_));
+
+    if (deflateInit2(&deflater_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, RAW_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw ImapException("Failed to initialize compression");
+    }
+    if (inflateInit2(&inflater_, RAW_WINDOW_BITS) != Z_OK) {
+        deflateEnd(&deflater_);
+        throw ImapException("Failed to initialize decompression");
+    }
+}
+
+DeflateStream::~DeflateStream() {
+    deflateEnd(&deflater_);
+    inflateEnd(&inflater_);
+}
+
+std::string DeflateStream::compress(const char *data, size_t length) {
+    std::string output;
+    char chunk[4096];
+
+    deflater_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    deflater_.avail_in = length;
+    // The sync flush is complete once zlib stops filling the whole chunk
+    do {
+        deflater_.next_out = reinterpret_cast<Bytef *>(chunk);
+        deflater_.avail_out = sizeof(chunk);
+        if (deflate(&deflater_, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+            throw ImapException("Failed to compress data");
+        }
+        output.append(chunk, sizeof(chunk) - deflater_.avail_out);
+    } while (deflater_.avail_out == 0);
+
+    return output;
+}
+
+void DeflateStream::feed(const char *data, size_t length) {
+    if (inputPos_ == input_.size()) {
+        input_.clear();
+        inputPos_ = 0;
+    }
+    input_.insert(input_.end(), data, data + length);
+}
+
+size_t DeflateStream::inflate(char *buffer, size_t size) {
+    inflater_.next_in = reinterpret_cast<Bytef *>(input_.data() + inputPos_);
+    inflater_.avail_in = input_.size() - inputPos_;
+    inflater_.next_out = reinterpret_cast<Bytef *>(buffer);
+    inflater_.avail_out = size;
+
+    int result = ::inflate(&inflater_, Z_SYNC_FLUSH);
+    if (result != Z_OK && result != Z_BUF_ERROR) {
+        // The server never ends the stream, so Z_STREAM_END is an error as well
+        throw ImapException("Failed to decompress data from server");
+    }
+
+    inputPos_ = input_.size() - inflater_.avail_in;
+    outputFull_ = inflater_.avail_out == 0;
+    return size - inflater_.avail_out;
+}
+
+bool DeflateStream::hasPending() const {
+    return outputFull_ || inputPos_ < input_.size();
+}
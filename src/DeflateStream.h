@@ -0,0 +1,72 @@
+// DeflateStream.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef DEFLATESTREAM_H
+#define DEFLATESTREAM_H
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @class DeflateStream
+ * @brief Streaming raw DEFLATE compression of both directions of a connection (RFC 4978).
+ *
+ * Outgoing data is compressed and flushed per call, so every command reaches
+ * the server immediately. Incoming data is decompressed into the caller's
+ * buffer as it arrives.
+ */
+class DeflateStream {
+public:
+    /**
+     * @brief Initializes the compressor and the decompressor.
+     * @throws ImapException If zlib fails to initialize
+     */
+    DeflateStream();
+
+    ~DeflateStream();
+
+    DeflateStream(const DeflateStream &) = delete;
+    DeflateStream &operator=(const DeflateStream &) = delete;
+
+    /**
+     * @brief Compresses data to be sent, followed by a sync flush.
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     * @return std::string The compressed bytes to be written to the connection.
+     * @throws ImapException If compression fails
+     */
+    std::string compress(const char *data, size_t length);
+
+    /**
+     * @brief Adds compressed data received from the connection.
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Decompresses received data into the buffer.
+     * @param buffer Destination buffer.
+     * @param size Size of the buffer.
+     * @return size_t Number of bytes written, 0 if more compressed data is needed.
+     * @throws ImapException If the received data is corrupted
+     */
+    size_t inflate(char *buffer, size_t size);
+
+    /**
+     * @brief Checks whether inflate() may return data without feeding more.
+     * @return bool True if decompressed data may be pending.
+     */
+    bool hasPending() const;
+
+private:
+    z_stream deflater_;
+    z_stream inflater_;
+    std::vector<char> input_; ///< Received compressed data not consumed yet
+    size_t inputPos_ = 0; ///< Offset of the first unconsumed byte of input_
+    bool outputFull_ = false; ///< True if the last inflate() filled the whole buffer
+};
+
+#endif // DEFLATESTREAM_H
@@ -0,0 +1,79 @@
+// DnsCache.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "DnsCache.h"
+#include "ImapException.h"
+#include <cstring>
+#include <netdb.h>
+
+std::mutex DnsCache::mutex_;
+std::map<std::string, DnsCache::Entry> DnsCache::entries_;
+
+std::vector<ResolvedAddress> DnsCache::resolve(const std::string &host, int port) {
+    std::string key = host + ":" + std::to_string(port);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = entries_.find(key);
+        if (found != entries_.end() && found->second.expires > std::chrono::steady_clock::now()) {
+            return found->second.addresses;
+        }
+    }
+
+    // The lookup runs without the lock, so other servers are not held up
+    struct addrinfo hints;
+    struct addrinfo *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+    if (status != 0) {
+        throw ImapException("Failed to resolve server address: " + std::string(gai_strerror(status)));
+    }
+
+    std::vector<ResolvedAddress> addresses;
+    for (struct addrinfo *info = result; info != nullptr; info = info->ai_next) {
+        ResolvedAddress address;
+        memcpy(&address.address, info->ai_addr, info->ai_addrlen);
+        address.length = info->ai_addrlen;
+        address.family = info->ai_family;
+        addresses.push_back(address);
+    }
+    freeaddrinfo(result);
+    if (addresses.empty()) {
+        throw ImapException("Failed to resolve server address: no addresses");
+    }
+    addresses = interleave(addresses);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[key] = Entry{addresses, std::chrono::steady_clock::now() + std::chrono::seconds(TTL_SECONDS)};
+    return addresses;
+}
+
+std::vector<ResolvedAddress> DnsCache::interleave(const std::vector<ResolvedAddress> &addresses) {
+    if (addresses.empty()) {
+        return addresses;
+    }
+
+    std::vector<ResolvedAddress> preferred;
+    std::vector<ResolvedAddress> other;
+    for (const ResolvedAddress &address : addresses) {
+        if (address.family == addresses.front().family) {
+            preferred.push_back(address);
+        } else {
+            other.push_back(address);
+        }
+    }
+
+    std::vector<ResolvedAddress> result;
+    for (size_t i = 0; i < preferred.size() || i < other.size(); i++) {
+        if (i < preferred.size()) {
+            result.push_back(preferred[i]);
+        }
+        if (i < other.size()) {
+            result.push_back(other[i]);
+        }
+    }
+    return result;
+}
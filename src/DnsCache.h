@@ -0,0 +1,66 @@
+// DnsCache.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+/**
+ * @struct ResolvedAddress
+ * @brief One address of a resolved server.
+ */
+struct ResolvedAddress {
+    sockaddr_storage address; ///< Address including the port
+    socklen_t length = 0; ///< Length of the address
+    int family = 0; ///< AF_INET or AF_INET6
+};
+
+/**
+ * @class DnsCache
+ * @brief Process-wide cache of resolved server addresses.
+ *
+ * Accounts on the same server share one lookup. getaddrinfo() does not report
+ * the record TTL, so entries expire after TTL_SECONDS. Failed lookups are not cached.
+ */
+class DnsCache {
+public:
+    /**
+     * @brief Returns the addresses of the server in the order connections should be attempted.
+     *
+     * The address families alternate, starting with the family preferred by
+     * getaddrinfo() (RFC 8305 section 4).
+     *
+     * @param host Host name or address of the server.
+     * @param port Port of the server.
+     * @return std::vector<ResolvedAddress> The addresses, never empty.
+     * @throws ImapException If the server cannot be resolved
+     */
+    static std::vector<ResolvedAddress> resolve(const std::string &host, int port);
+
+    /**
+     * @brief Reorders addresses so that the address families alternate.
+     * @param addresses Addresses in the order of preference.
+     * @return std::vector<ResolvedAddress> The interleaved addresses.
+     */
+    static std::vector<ResolvedAddress> interleave(const std::vector<ResolvedAddress> &addresses);
+
+    static constexpr int TTL_SECONDS = 60; ///< Lifetime of a cached lookup
+
+private:
+    struct Entry {
+        std::vector<ResolvedAddress> addresses;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    static std::mutex mutex_;
+    static std::map<std::string, Entry> entries_;
+};
+
+#endif // DNSCACHE_H
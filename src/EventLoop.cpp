@@ -0,0 +1,232 @@
+// EventLoop.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "EventLoop.h"
+#include <algorithm>
+#include <cstddef>
+#include <cxxabi.h>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ExceptionState mirrors __cxa_eh_globals of libstdc++ (libsupc++/unwind-cxx.h): the caught exception
+// stack followed by the number of uncaught exceptions. The ARM EH ABI adds a third member, other
+// runtimes are not known to match, so any other C++ runtime fails the build instead of corrupting it.
+#if !defined(__GLIBCXX__) || defined(__ARM_EABI_UNWINDER__)
+#error "EventLoop saves the exception state of libstdc++ only, see ExceptionState"
+#endif
+
+namespace {
+
+thread_local EventLoop *currentLoop = nullptr;
+
+const size_t GUARD_SIZE = 4096;
+const int MAX_EVENTS = 64;
+
+}
+
+EventLoop::EventLoop(size_t stackSize) : stackSize_(stackSize) {
+    static_assert(offsetof(ExceptionState, caughtExceptions) == 0 &&
+                      offsetof(ExceptionState, uncaughtExceptions) == sizeof(void *),
+                  "ExceptionState must match the layout of __cxa_eh_globals");
+    static_assert(std::is_standard_layout<ExceptionState>::value, "ExceptionState must have a fixed layout");
+
+    // The first member is the caught exception stack, it is set exactly inside of a catch block
+    auto *globals = reinterpret_cast<ExceptionState *>(abi::__cxa_get_globals());
+    void *outside = globals->caughtExceptions;
+    void *inside = nullptr;
+    try {
+        throw 0;
+    } catch (int) {
+        inside = globals->caughtExceptions;
+    }
+    if (inside == nullptr || inside == outside || globals->caughtExceptions != outside) {
+        throw std::runtime_error("Unsupported layout of the C++ exception state");
+    }
+
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+}
+
+EventLoop::~EventLoop() {
+    for (std::unique_ptr<Fiber> &fiber : fibers_) {
+        if (fiber->stack) {
+            munmap(fiber->stack, stackSize_ + GUARD_SIZE);
+        }
+    }
+    close(epoll_);
+}
+
+EventLoop *EventLoop::current() {
+    return currentLoop;
+}
+
+size_t EventLoop::spawn(std::function<void()> task) {
+    std::unique_ptr<Fiber> fiber(new Fiber());
+    fiber->task = std::move(task);
+
+    // The lowest page stays inaccessible, so a stack overflow faults instead of corrupting memory
+    fiber->stack = mmap(nullptr, stackSize_ + GUARD_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (fiber->stack == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate task stack");
+    }
+    mprotect(fiber->stack, GUARD_SIZE, PROT_NONE);
+
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = static_cast<char *>(fiber->stack) + GUARD_SIZE;
+    fiber->context.uc_stack.ss_size = stackSize_;
+    fiber->context.uc_link = &scheduler_;
+    uintptr_t self = reinterpret_cast<uintptr_t>(this);
+    makecontext(&fiber->context, reinterpret_cast<void (*)()>(trampoline), 2,
+                static_cast<unsigned int>(static_cast<uint64_t>(self) >> 32), static_cast<unsigned int>(self));
+
+    size_t id = fibers_.size();
+    fibers_.push_back(std::move(fiber));
+    runnable_.push_back(id);
+    alive_++;
+    return id;
+}
+
+void EventLoop::trampoline(unsigned int high, unsigned int low) {
+    EventLoop *loop = reinterpret_cast<EventLoop *>((static_cast<uint64_t>(high) << 32) | low);
+    Fiber &fiber = *loop->fibers_[loop->running_];
+
+    try {
+        fiber.task();
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Error: unknown exception in task" << std::endl;
+    }
+    fiber.finished = true;
+    // Returning switches to uc_link, the loop
+}
+
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+
+    while (alive_ > 0) {
+        while (!runnable_.empty()) {
+            size_t id = runnable_.front();
+            runnable_.pop_front();
+            resume(id);
+        }
+        if (alive_ == 0) {
+            break;
+        }
+
+        int timeout = -1;
+        if (!timers_.empty()) {
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(timers_.begin()->first - Clock::now());
+            // Round up, so the timer has expired once epoll returns
+            timeout = std::max<long long>(delay.count() + 1, 0);
+        }
+        if (timers_.empty() && watched_ == 0) {
+            throw std::runtime_error("All tasks wait for each other");
+        }
+
+        int count = epoll_wait(epoll_, events, MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR) {
+            throw std::runtime_error("Failed to wait for events");
+        }
+        for (int i = 0; i < count; i++) {
+            wake(events[i].data.u64, true);
+        }
+
+        Clock::time_point now = Clock::now();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            wake(timers_.begin()->second, false);
+        }
+    }
+}
+
+void EventLoop::resume(size_t id) {
+    Fiber &fiber = *fibers_[id];
+    auto *globals = reinterpret_cast<ExceptionState *>(abi::__cxa_get_globals());
+
+    EventLoop *previous = currentLoop;
+    currentLoop = this;
+    running_ = id;
+    schedulerExceptions_ = *globals;
+    *globals = fiber.exceptions;
+
+    swapcontext(&scheduler_, &fiber.context);
+
+    fiber.exceptions = *globals;
+    *globals = schedulerExceptions_;
+    currentLoop = previous;
+
+    if (fiber.finished) {
+        munmap(fiber.stack, stackSize_ + GUARD_SIZE);
+        fiber.stack = nullptr;
+        fiber.task = nullptr;
+        alive_--;
+        for (size_t joiner : fiber.joiners) {
+            runnable_.push_back(joiner);
+        }
+        fiber.joiners.clear();
+    }
+}
+
+void EventLoop::suspend() {
+    swapcontext(&fibers_[running_]->context, &scheduler_);
+}
+
+void EventLoop::wake(size_t id, bool ready) {
+    Fiber &fiber = *fibers_[id];
+
+    if (fiber.fd >= 0) {
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, fiber.fd, nullptr);
+        fiber.fd = -1;
+        watched_--;
+    }
+    if (fiber.hasTimer) {
+        timers_.erase(fiber.timer);
+        fiber.hasTimer = false;
+    }
+    fiber.ready = ready;
+    runnable_.push_back(id);
+}
+
+bool EventLoop::wait(int fd, uint32_t events, int timeoutMs) {
+    Fiber &fiber = *fibers_[running_];
+
+    if (fd >= 0) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.u64 = running_;
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            throw std::runtime_error("Failed to watch descriptor");
+        }
+        fiber.fd = fd;
+        watched_++;
+    }
+    if (timeoutMs >= 0) {
+        fiber.timer = timers_.emplace(Clock::now() + std::chrono::milliseconds(timeoutMs), running_);
+        fiber.hasTimer = true;
+    }
+
+    suspend();
+    return fiber.ready;
+}
+
+void EventLoop::sleep(int timeoutMs) {
+    wait(-1, 0, timeoutMs);
+}
+
+void EventLoop::join(size_t id) {
+    if (fibers_[id]->finished) {
+        return;
+    }
+    fibers_[id]->joiners.push_back(running_);
+    suspend();
+}
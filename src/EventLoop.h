@@ -0,0 +1,149 @@
+// EventLoop.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include <ucontext.h>
+
+/**
+ * @class EventLoop
+ * @brief Single-threaded epoll loop running tasks as cooperative fibers.
+ *
+ * Every task runs on its own stack. When a task waits for a socket, it is
+ * suspended and the loop runs other tasks until epoll reports the socket or
+ * the wait times out. Code written in blocking style, such as the ImapClient
+ * state machine, thus services many connections from one thread.
+ */
+class EventLoop {
+public:
+    /**
+     * @brief Creates the loop.
+     * @param stackSize Stack size of every task in bytes.
+     * @throws std::runtime_error If epoll cannot be created or the C++ runtime is not supported
+     */
+    EventLoop(size_t stackSize = DEFAULT_STACK_SIZE);
+
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    /**
+     * @brief Adds a task, it starts once the loop runs.
+     *
+     * Exceptions escaping the task are reported to stderr.
+     *
+     * @param task The task.
+     * @return size_t Identifier of the task for join().
+     */
+    size_t spawn(std::function<void()> task);
+
+    /**
+     * @brief Runs the loop until all tasks have finished.
+     *
+     * Must not be called from a task.
+     */
+    void run();
+
+    /**
+     * @brief Suspends the calling task until the other task finishes.
+     * @param id Identifier returned by spawn().
+     */
+    void join(size_t id);
+
+    /**
+     * @brief Suspends the calling task until the descriptor is ready.
+     *
+     * @param fd The descriptor.
+     * @param events EPOLLIN, EPOLLOUT or both.
+     * @param timeoutMs Maximum time to wait in milliseconds, negative waits forever.
+     * @return bool True if the descriptor is ready, false on timeout.
+     * @throws std::runtime_error If the descriptor cannot be watched
+     */
+    bool wait(int fd, uint32_t events, int timeoutMs);
+
+    /**
+     * @brief Suspends the calling task for the given time.
+     * @param timeoutMs Time in milliseconds.
+     */
+    void sleep(int timeoutMs);
+
+    /**
+     * @brief Returns the loop of the running task.
+     * @return EventLoop* The loop, nullptr when called outside of a task.
+     */
+    static EventLoop *current();
+
+    static constexpr size_t DEFAULT_STACK_SIZE = 512 * 1024;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Timers = std::multimap<Clock::time_point, size_t>;
+
+    /**
+     * @brief Saved state of the C++ runtime exception handling of a task.
+     *
+     * Mirrors __cxa_eh_globals, which is per thread, so a task suspended
+     * inside a catch block does not see exceptions of other tasks. The layout
+     * is that of libstdc++, it is checked when building and by the constructor.
+     */
+    struct ExceptionState {
+        void *caughtExceptions = nullptr;
+        unsigned int uncaughtExceptions = 0;
+    };
+
+    struct Fiber {
+        ucontext_t context;
+        void *stack = nullptr;
+        std::function<void()> task;
+        bool finished = false;
+        std::vector<size_t> joiners; ///< Tasks waiting in join()
+        ExceptionState exceptions;
+        int fd = -1; ///< Descriptor being waited for
+        bool hasTimer = false;
+        Timers::iterator timer;
+        bool ready = false; ///< Result of the last wait()
+    };
+
+    size_t stackSize_;
+    int epoll_ = -1;
+    std::vector<std::unique_ptr<Fiber>> fibers_;
+    std::deque<size_t> runnable_;
+    Timers timers_;
+    size_t alive_ = 0; ///< Number of tasks not finished yet
+    size_t watched_ = 0; ///< Number of descriptors registered with epoll
+    size_t running_ = 0; ///< Identifier of the running task
+    ucontext_t scheduler_;
+    ExceptionState schedulerExceptions_;
+
+    /**
+     * @brief Entry point of every task stack.
+     */
+    static void trampoline(unsigned int high, unsigned int low);
+
+    /**
+     * @brief Switches to the task until it suspends or finishes.
+     */
+    void resume(size_t id);
+
+    /**
+     * @brief Switches from the running task back to the loop.
+     */
+    void suspend();
+
+    /**
+     * @brief Makes a waiting task runnable with the given wait result.
+     */
+    void wake(size_t id, bool ready);
+};
+
+#endif // EVENTLOOP_H
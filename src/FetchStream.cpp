@@ -0,0 +1,110 @@
+// FetchStream.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "FetchStream.h"
+#include "ImapException.h"
+
+FetchStream::FetchStream(FileHandler &fileHandler, std::string &account, std::string &mailbox)
+    : fileHandler_(fileHandler), account_(account), mailbox_(mailbox), tokenizer_(*this) {}
+
+void FetchStream::consume(const char *data, size_t length) {
+    tokenizer_.feed(data, length);
+}
+
+void FetchStream::onToken(const ImapToken &token) {
+    if (token.type == ImapTokenType::LineEnd) {
+        finishLine();
+        return;
+    }
+
+    std::vector<ImapToken> &tokens = line_.tokens;
+    tokens.push_back(token);
+
+    if (tokens.size() == 4) {
+        inFetch_ = tokens[0].is("*") && tokens[1].isNumber() && tokens[2].is("FETCH") &&
+                   tokens[3].type == ImapTokenType::ListOpen;
+    }
+    if (!inFetch_) {
+        return;
+    }
+
+    const ImapToken *previous = tokens.size() >= 2 ? &tokens[tokens.size() - 2] : nullptr;
+    if (token.type == ImapTokenType::ListOpen) {
+        depth_++;
+        inFlags_ = depth_ == 2 && previous->is("FLAGS");
+    } else if (token.type == ImapTokenType::ListClose) {
+        depth_--;
+        inFlags_ = false;
+    } else if (inFlags_) {
+        envelope_.flags += (envelope_.flags.empty() ? "" : " ") + token.value;
+    } else if (depth_ == 1 && token.isNumber() && previous->is("UID")) {
+        uid_ = std::stoi(token.value);
+    } else if (depth_ == 1 && token.isNumber() && previous->is("RFC822.SIZE")) {
+        envelope_.size = std::stoull(token.value);
+        hasEnvelope_ = true;
+    } else if (depth_ == 1 && token.type == ImapTokenType::Quoted && previous->is("INTERNALDATE")) {
+        envelope_.internalDate = token.value;
+        hasEnvelope_ = true;
+    } else if (depth_ == 1 && token.type == ImapTokenType::Quoted && previous->type == ImapTokenType::SectionClose && !message_) {
+        // Small header sections may come as a quoted string instead of a literal
+        message_ = fileHandler_.openMessage(account_, mailbox_);
+        message_->write(token.value.data(), token.value.size());
+    } else if (token.type == ImapTokenType::Literal) {
+        // Only the first literal of the response contains the message
+        literalToFile_ = !message_;
+        if (literalToFile_) {
+            message_ = fileHandler_.openMessage(account_, mailbox_);
+        }
+    }
+}
+
+void FetchStream::onLiteralData(const char *data, size_t length) {
+    if (literalToFile_) {
+        message_->write(data, length);
+    }
+}
+
+void FetchStream::onLiteralEnd() {
+    literalToFile_ = false;
+}
+
+void FetchStream::finishLine() {
+    if (inFetch_) {
+        if (message_ && uid_ >= 0) {
+            // Written first, a crash leaves the message to be downloaded again with a new line
+            if (hasEnvelope_) {
+                fileHandler_.appendEnvelope(envelope_, uid_, account_, mailbox_);
+            }
+            fileHandler_.commitMessage(*message_, uid_, account_, mailbox_);
+            saved_.insert(uid_);
+        }
+    } else if (line_.tokens.size() >= 2 && line_.tokens[0].type == ImapTokenType::Atom &&
+               !line_.tokens[0].is("*") && !line_.tokens[0].is("+")) {
+        // Tagged completion of a command
+        completions_[line_.tokens[0].value] = line_.text(0);
+    }
+
+    message_.reset();
+    line_ = ImapLine{};
+    depth_ = 0;
+    inFetch_ = false;
+    uid_ = -1;
+    envelope_ = Envelope{};
+    hasEnvelope_ = false;
+    inFlags_ = false;
+}
+
+bool FetchStream::isCompleted(const std::string &tag) const {
+    return completions_.count(tag) != 0;
+}
+
+std::string FetchStream::takeCompletion(const std::string &tag) {
+    std::string line = completions_[tag];
+    completions_.erase(tag);
+    return line;
+}
+
+const std::unordered_set<int> &FetchStream::savedMessages() const {
+    return saved_;
+}
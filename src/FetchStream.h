@@ -0,0 +1,98 @@
+// FetchStream.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef FETCHSTREAM_H
+#define FETCHSTREAM_H
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "FileHandler.h"
+#include "ImapTokenizer.h"
+
+/**
+ * @class FetchStream
+ * @brief Incremental reader of FETCH responses that writes message literals straight to files.
+ *
+ * Received data is consumed as it arrives by an ImapTokenizer. Once the
+ * {N} literal of a message is found, the following N bytes are written
+ * directly to the message file without being kept in memory, so the
+ * memory use does not depend on the size of the messages.
+ *
+ * RFC822.SIZE, INTERNALDATE and FLAGS of the response are recorded as the
+ * envelope of the message, wherever they appear relative to the literal.
+ */
+class FetchStream : private ImapTokenHandler {
+public:
+    /**
+     * @brief Constructs a FetchStream saving messages of the given mailbox.
+     *
+     * @param fileHandler FileHandler used to store the messages.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     */
+    FetchStream(FileHandler &fileHandler, std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Consumes the next part of the data received from the server.
+     *
+     * @param data Pointer to the received data.
+     * @param length Number of received bytes.
+     * @throws ImapException If the response is malformed
+     * @throws FileException If a message cannot be saved
+     */
+    void consume(const char *data, size_t length);
+
+    /**
+     * @brief Checks whether the tagged completion of a command was received.
+     *
+     * @param tag The tag of the command.
+     * @return bool True if the completion line was received.
+     */
+    bool isCompleted(const std::string &tag) const;
+
+    /**
+     * @brief Returns the tagged completion line of a command and forgets it.
+     *
+     * @param tag The tag of the command.
+     * @return std::string The completion line, e.g. "A5 OK Fetch completed".
+     */
+    std::string takeCompletion(const std::string &tag);
+
+    /**
+     * @brief Returns the UIDs of all messages saved so far.
+     */
+    const std::unordered_set<int> &savedMessages() const;
+
+private:
+    FileHandler &fileHandler_;
+    std::string &account_;
+    std::string &mailbox_;
+
+    ImapTokenizer tokenizer_;
+    ImapLine line_; ///< Tokens of the current line, without literal data
+    int depth_ = 0; ///< Nesting of parenthesized lists in the current line
+    bool inFetch_ = false; ///< True if the current line is a FETCH response
+    bool literalToFile_ = false; ///< True if the current literal is the message content
+    int uid_ = -1; ///< UID of the message in the current FETCH response
+    std::unique_ptr<MessageFile> message_; ///< File of the message being received
+    Envelope envelope_; ///< Attributes of the message in the current FETCH response
+    bool hasEnvelope_ = false; ///< True if the response contains RFC822.SIZE or INTERNALDATE
+    bool inFlags_ = false; ///< True inside of the FLAGS list
+
+    std::unordered_map<std::string, std::string> completions_;
+    std::unordered_set<int> saved_;
+
+    void onToken(const ImapToken &token) override;
+    void onLiteralData(const char *data, size_t length) override;
+    void onLiteralEnd() override;
+
+    /**
+     * @brief Finishes the current line and saves the message of a FETCH response.
+     */
+    void finishLine();
+};
+
+#endif // FETCHSTREAM_H
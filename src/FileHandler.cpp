@@ -4,13 +4,287 @@
 
 #include "FileHandler.h"
 #include "FileException.h"
+#include "ImapParser.h"
+#include "FileIo.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 #include <system_error>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-FileHandler::FileHandler(std::string mailFolder) : path(mailFolder) {}
+MessageFile::MessageFile(const std::string &tempPath, bool buffered) : tempPath_(tempPath), buffered_(buffered) {
+    if (buffered_) {
+        return;
+    }
+    fd_ = ::open(tempPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw FileException("Failed to open message file: " + tempPath_ + " - " + std::strerror(errno));
+    }
+}
+
+MessageFile::~MessageFile() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(tempPath_.c_str());
+    }
+}
+
+void MessageFile::write(const char *data, size_t length) {
+    detector_.feed(data, length);
+    size_ += length;
+    if (sample_.size() < sampleSize_) {
+        sample_.append(data, std::min(length, sampleSize_ - sample_.size()));
+    }
+    if (deflater_) {
+        deflated_.clear();
+        deflater_->compress(data, length, deflated_);
+        store(deflated_.data(), deflated_.size());
+        return;
+    }
+    store(data, length);
+}
+
+void MessageFile::store(const char *data, size_t length) {
+    if (hash_) {
+        hash_->update(data, length);
+    }
+    if (buffered_) {
+        data_.append(data, length);
+        return;
+    }
+    while (length > 0) {
+        ssize_t written = ::write(fd_, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw FileException("Failed to write message file: " + tempPath_ + " - " + std::strerror(errno));
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+void MessageFile::compress(const std::string *dictionary) {
+    deflater_ = std::make_unique<MessageDeflater>(dictionary);
+    compressed_ = true;
+}
+
+void MessageFile::sample(size_t bytes) {
+    sampleSize_ = bytes;
+}
+
+bool MessageFile::compressed() const {
+    return compressed_;
+}
+
+const std::string &MessageFile::sampled() const {
+    return sample_;
+}
+
+void MessageFile::hash() {
+    hash_ = std::make_unique<ContentHash>();
+}
+
+std::string MessageFile::digest() {
+    finish();
+    if (hash_) {
+        digest_ = hash_->hex();
+        hash_.reset();
+    }
+    return digest_;
+}
+
+void MessageFile::finish() {
+    if (!deflater_) {
+        return;
+    }
+    deflated_.clear();
+    deflater_->finish(deflated_);
+    deflater_.reset();
+    store(deflated_.data(), deflated_.size());
+    deflated_ = std::string();
+}
+
+bool MessageFile::buffered() const {
+    return buffered_;
+}
+
+const std::string &MessageFile::tempPath() const {
+    return tempPath_;
+}
+
+std::string MessageFile::release() {
+    finish();
+    return std::move(data_);
+}
+
+uint64_t MessageFile::size() const {
+    return size_;
+}
+
+int MessageFile::kind() const {
+    return detector_.kind();
+}
+
+void MessageFile::commit(const std::string &path) {
+    finish();
+    int fd = fd_;
+    fd_ = -1;
+    if (::close(fd) != 0) {
+        ::unlink(tempPath_.c_str());
+        throw FileException("Failed to close message file: " + tempPath_);
+    }
+    if (std::rename(tempPath_.c_str(), path.c_str()) != 0) {
+        ::unlink(tempPath_.c_str());
+        throw FileException("Failed to move message file to: " + path);
+    }
+}
+
+FileHandler::FileHandler(std::string mailFolder, size_t groupCommit, size_t writeBehind, StorageLayout layout, unsigned fanOut)
+    : path(mailFolder), layout(layout), fanOut(fanOut), groupCommit(groupCommit) {
+    if (writeBehind > 0) {
+        writer = std::make_unique<StorageWriter>(writeBehind);
+    }
+}
+
+FileHandler::~FileHandler() {
+    try {
+        flush();
+    } catch (const FileException &e) {
+        std::cerr << "File error: " << e.what() << std::endl;
+    }
+
+    // Retired messages still link objects until they are deleted
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        stopCleaner = true;
+    }
+    cleanerWake.notify_all();
+    if (cleaner.joinable()) {
+        cleaner.join();
+    }
+    if (contentStore) {
+        std::set<std::string> digests;
+        {
+            std::lock_guard<std::mutex> lock(releasedMutex);
+            digests.swap(releasedObjects);
+        }
+        contentStore->collect(digests);
+    }
+}
+
+void FileHandler::compressMessages(size_t dictionarySamples) {
+    compress = true;
+    this->dictionarySamples = dictionarySamples;
+}
+
+void FileHandler::deduplicateMessages() {
+    if (layout != StorageLayout::Packed) {
+        contentStore = std::make_unique<ContentStore>(path);
+    }
+}
+
+void FileHandler::flush() {
+    releaseRetired();
+    if (writer) {
+        writer->drain();
+    }
+    flushGroup();
+    {
+        std::lock_guard<std::mutex> lock(objectIdsMutex);
+        objectIds.clear();
+    }
+
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        error.swap(writeError);
+    }
+    if (!error.empty()) {
+        throw FileException(error);
+    }
+}
+
+void FileHandler::flushGroup() {
+    std::lock_guard<std::mutex> flushLock(flushMutex);
+
+    std::vector<PendingMessage> group;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        group.swap(pending);
+    }
+    if (group.empty()) {
+        return;
+    }
+
+    // Only the files of the group are written back, the directory fsyncs make the renames durable
+    std::set<std::string> files;
+    std::set<std::pair<std::string, std::string>> packedMailboxes;
+    std::set<std::string> directories;
+    for (const PendingMessage &message : group) {
+        if (!message.file.empty()) {
+            files.insert(message.file);
+        } else {
+            packedMailboxes.emplace(message.account, message.mailbox);
+        }
+        directories.insert(message.directory);
+    }
+    for (const std::string &file : files) {
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            continue; // Removed before its group was flushed
+        }
+        if (fd < 0 || ::fdatasync(fd) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw FileException("Failed to flush message to disk: " + file);
+        }
+        ::close(fd);
+    }
+    for (const auto &mailbox : packedMailboxes) {
+        segments(mailbox.first, mailbox.second).sync();
+    }
+
+    for (const std::string &directory : directories) {
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw FileException("Failed to flush directory: " + directory);
+        }
+        ::close(fd);
+    }
+
+    for (const PendingMessage &message : group) {
+        index(message.account, message.mailbox).record(message.id, message.kind, message.size);
+    }
+}
+
+void FileHandler::ensureDirectory(const std::string &fullPath) {
+    {
+        std::lock_guard<std::mutex> lock(indexesMutex);
+        if (createdDirectories.count(fullPath) != 0) {
+            return;
+        }
+    }
+    createDirectories(fullPath);
+
+    std::lock_guard<std::mutex> lock(indexesMutex);
+    createdDirectories.insert(fullPath);
+}
 
 void FileHandler::createDirectories(const std::string& fullPath) {
     std::error_code ec;
@@ -21,58 +295,392 @@ void FileHandler::createDirectories(const std::string& fullPath) {
     }
 }
 
+MailboxIndex &FileHandler::index(const std::string &account, const std::string &mailbox) {
+    std::string dirPath = path + "/" + account + "/" + mailbox;
+
+    std::lock_guard<std::mutex> lock(indexesMutex);
+    std::unique_ptr<MailboxIndex> &index = indexes[dirPath];
+    if (!index) {
+        index = std::make_unique<MailboxIndex>(dirPath);
+
+        // A rebuilt index finds no .eml files, the segment journal knows the packed messages
+        if (layout == StorageLayout::Packed && index->rebuilt()) {
+            segmentStore(dirPath).forEach([&](uint32_t uid, int kind, uint64_t length) {
+                index->record(uid, kind, length);
+            });
+        } else if (layout == StorageLayout::Files && index->rebuilt() && std::filesystem::is_directory(dirPath)) {
+            // Compressed messages have to be inflated to be classified
+            for (const auto &entry : std::filesystem::directory_iterator(dirPath)) {
+                const std::filesystem::path &file = entry.path();
+                if (file.extension() != ".z" || !isMessageFile(file)) {
+                    continue;
+                }
+                std::ifstream message(file, std::ios::binary);
+                std::string stored((std::istreambuf_iterator<char>(message)), std::istreambuf_iterator<char>());
+                try {
+                    std::string content = inflateMessage(stored.data(), stored.size(), dictionaryOf(account).data());
+                    index->record(std::stoul(file.stem().stem().string()), MailboxIndex::classify(content), content.size());
+                } catch (const FileException &) {
+                    // An unreadable message is downloaded again
+                }
+            }
+        } else if (layout == StorageLayout::Maildir && index->rebuilt()) {
+            maildirOf(dirPath).forEach([&](uint32_t uid, const std::string &messagePath) {
+                std::ifstream message(messagePath, std::ios::binary);
+                std::string content((std::istreambuf_iterator<char>(message)), std::istreambuf_iterator<char>());
+                if (!content.empty()) {
+                    index->record(uid, MailboxIndex::classify(content), content.size());
+                }
+            });
+        }
+    }
+    return *index;
+}
+
+SegmentStore &FileHandler::segments(const std::string &account, const std::string &mailbox) {
+    std::lock_guard<std::mutex> lock(indexesMutex);
+    return segmentStore(path + "/" + account + "/" + mailbox);
+}
+
+SegmentStore &FileHandler::segmentStore(const std::string &dirPath) {
+    std::unique_ptr<SegmentStore> &store = segmentStores[dirPath];
+    if (!store) {
+        store = std::make_unique<SegmentStore>(dirPath);
+    }
+    return *store;
+}
+
+CompressionDictionary &FileHandler::dictionary(const std::string &account) {
+    std::lock_guard<std::mutex> lock(indexesMutex);
+    return dictionaryOf(account);
+}
+
+CompressionDictionary &FileHandler::dictionaryOf(const std::string &account) {
+    std::unique_ptr<CompressionDictionary> &dictionary = dictionaries[account];
+    if (!dictionary) {
+        dictionary = std::make_unique<CompressionDictionary>(path + "/" + account + "/" + CompressionDictionary::FILE_NAME,
+                                                             dictionarySamples);
+    }
+    return *dictionary;
+}
+
+bool FileHandler::isMessageFile(const std::filesystem::path &file) {
+    std::filesystem::path name = file.extension() == ".z" ? file.stem() : file.filename();
+    std::string stem = name.stem().string();
+    return name.extension() == ".eml" && !stem.empty() && stem.find_first_not_of("0123456789") == std::string::npos;
+}
+
+Maildir &FileHandler::maildir(const std::string &account, const std::string &mailbox) {
+    std::lock_guard<std::mutex> lock(indexesMutex);
+    return maildirOf(path + "/" + account + "/" + mailbox);
+}
+
+Maildir &FileHandler::maildirOf(const std::string &dirPath) {
+    std::unique_ptr<Maildir> &maildir = maildirs[dirPath];
+    if (!maildir) {
+        maildir = std::make_unique<Maildir>(dirPath, fanOut);
+    }
+    return *maildir;
+}
+
+std::unique_ptr<MappedMessage> FileHandler::mapMessage(int id, std::string &account, std::string &mailbox, bool *compressed) {
+    if (compressed) {
+        *compressed = false;
+    }
+    if (layout == StorageLayout::Packed) {
+        uint32_t flags = 0;
+        std::unique_ptr<MappedMessage> message = segments(account, mailbox).read(id, &flags);
+        if (compressed) {
+            *compressed = (flags & SegmentStore::COMPRESSED) != 0;
+        }
+        return message;
+    }
+
+    std::string fileName = path + "/" + account + "/" + mailbox + "/" + std::to_string(id) + ".eml";
+    if (layout == StorageLayout::Maildir) {
+        fileName = maildir(account, mailbox).find(id);
+    }
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(fileName, ec);
+    if (ec && layout == StorageLayout::Files) {
+        fileName += ".z";
+        size = std::filesystem::file_size(fileName, ec);
+        if (!ec && compressed) {
+            *compressed = true;
+        }
+    }
+    if (ec) {
+        return nullptr;
+    }
+    return MappedMessage::map(fileName, 0, size);
+}
+
+std::string FileHandler::readMessage(int id, std::string &account, std::string &mailbox) {
+    bool compressed;
+    std::unique_ptr<MappedMessage> message = mapMessage(id, account, mailbox, &compressed);
+    if (!message) {
+        throw FileException("Message is not stored: " + account + "/" + mailbox + "/" + std::to_string(id));
+    }
+    if (compressed) {
+        return inflateMessage(message->data(), message->size(), dictionary(account).data());
+    }
+    return std::string(message->data(), message->size());
+}
+
 int FileHandler::isMessageAlreadyDownloaded(int id, std::string &account, std::string &mailbox) {
     try {
-        std::string dirPath = path + "/" + account + "/" + mailbox;
-        std::string filename = dirPath + "/" + std::to_string(id) + ".eml";
+        return index(account, mailbox).lookup(id);
+    }
+    catch (const std::filesystem::filesystem_error&) {
+        return -1;
+    }
+    catch (const FileException&) {
+        return -1;
+    }
+}
 
-        // Check if file exists
-        if (!std::filesystem::exists(filename)) {
-            return 0; // Not downloaded
+void FileHandler::saveMessage(const std::string &message_content, int id, std::string &account, std::string &mailbox) {
+    std::unique_ptr<MessageFile> file = openMessage(account, mailbox);
+    file->write(message_content.data(), message_content.size());
+    commitMessage(*file, id, account, mailbox);
+}
+
+std::unique_ptr<MessageFile> FileHandler::openMessage(std::string &account, std::string &mailbox) {
+    std::string dirPath = path + "/" + account + "/" + mailbox;
+    std::string tempName = dirPath + "/.incoming-" + std::to_string(getpid()) + "-" + std::to_string(tempCounter++) + ".part";
+
+    // Create directory structure if it doesn't exist, checked once per mailbox
+    ensureDirectory(dirPath);
+
+    if (layout == StorageLayout::Maildir) {
+        // Unique name as recommended by the Maildir specification: time.PpidQcounter.host
+        char host[256] = "localhost";
+        gethostname(host, sizeof(host) - 1);
+        tempName = maildir(account, mailbox).tempDirectory() + "/" + std::to_string(std::time(nullptr)) + ".P" +
+                   std::to_string(getpid()) + "Q" + std::to_string(tempCounter++) + "." + host;
+    }
+
+    std::unique_ptr<MessageFile> file;
+    if (writer || layout == StorageLayout::Packed) {
+        // Created by the writer or appended to a segment, the directory is checked again if the write fails
+        file = std::make_unique<MessageFile>(tempName, true);
+    } else {
+        try {
+            file = std::make_unique<MessageFile>(tempName);
+        } catch (const FileException &) {
+            // The directory may have been removed since it was created
+            {
+                std::lock_guard<std::mutex> lock(indexesMutex);
+                createdDirectories.erase(dirPath);
+            }
+            ensureDirectory(dirPath);
+            file = std::make_unique<MessageFile>(tempName);
         }
+    }
 
-        // Check if file is empty
-        if (std::filesystem::file_size(filename) == 0) {
-            return 0;
+    if (contentStore) {
+        file->hash();
+    }
+    if (compress && layout != StorageLayout::Maildir) {
+        CompressionDictionary &accountDictionary = dictionary(account);
+        file->compress(accountDictionary.data());
+        if (accountDictionary.training()) {
+            file->sample(CompressionDictionary::SAMPLE_SIZE);
         }
+    }
+    return file;
+}
 
-        // Read file content
-        std::ifstream file(filename);
-        std::string line;
-        bool foundBlankLine = false;
-        bool hasContent = false;
-        
-        while (std::getline(file, line)) {
-            if (line.empty() || line == "\r") {
-                foundBlankLine = true;
-                continue;
+std::string FileHandler::destination(int id, const std::string &account, const std::string &mailbox, bool compressed) {
+    std::string fileName = path + "/" + account + "/" + mailbox + "/" + std::to_string(id) + ".eml";
+    if (layout == StorageLayout::Maildir) {
+        Maildir &box = maildir(account, mailbox);
+        // A reader may have moved the previous copy to cur, where the delivery would not replace it
+        if (index(account, mailbox).lookup(id) != MailboxIndex::MISSING) {
+            box.remove(id);
+        }
+        fileName = box.deliveryPath(id);
+    } else if (layout == StorageLayout::Files) {
+        // A message stored before compression was switched on or off is replaced by the other variant
+        std::string otherName = compressed ? fileName : fileName + ".z";
+        if (compressed) {
+            fileName += ".z";
+        }
+        if (index(account, mailbox).lookup(id) != MailboxIndex::MISSING) {
+            ::unlink(otherName.c_str());
+        }
+    }
+    return fileName;
+}
+
+void FileHandler::commitMessage(MessageFile &file, int id, std::string &account, std::string &mailbox) {
+    std::string dirPath = path + "/" + account + "/" + mailbox;
+    std::string fileName = destination(id, account, mailbox, file.compressed());
+    if (!file.sampled().empty()) {
+        dictionary(account).addSample(file.sampled());
+    }
+    PendingMessage message{account, mailbox, id, file.kind(), file.size(),
+                           std::filesystem::path(fileName).parent_path().string(), fileName};
+
+    if (layout == StorageLayout::Packed) {
+        // The segment store syncs its own files, a new segment is created in its directory
+        message.file.clear();
+        message.directory = dirPath + "/" + SegmentStore::DIRECTORY;
+        // Appending to the open segment is a single write, it is not worth a hand-over to the writer
+        segments(account, mailbox).append(id, file.release(), message.kind, file.compressed() ? SegmentStore::COMPRESSED : 0);
+        committed(message);
+        return;
+    }
+
+    // A message stored already becomes another link of its object, the received copy is dropped
+    std::string digest = file.digest();
+    if (contentStore) {
+        rememberObjectId(id, account, mailbox, digest, file.compressed());
+        if (contentStore->place(digest, file.tempPath() + ".link", fileName)) {
+            committed(message);
+            return;
+        }
+    }
+
+    if (!file.buffered()) {
+        file.commit(fileName);
+        if (contentStore) {
+            contentStore->adopt(fileName, digest);
+        }
+        committed(message);
+        return;
+    }
+
+    // The message is recorded by the writer thread once its file is in place
+    writer->submit(StorageWriter::Job{file.tempPath(), fileName, file.release(), [this, message, dirPath, fileName, digest](int error) {
+        try {
+            if (error != 0) {
+                {
+                    std::lock_guard<std::mutex> lock(indexesMutex);
+                    createdDirectories.erase(dirPath);
+                }
+                throw FileException("Failed to write message file: " + fileName + " - " + std::strerror(error));
             }
-            if (foundBlankLine && !line.empty()) {
-                hasContent = true;
-                break;
+            if (contentStore) {
+                contentStore->adopt(fileName, digest);
+            }
+            committed(message);
+        } catch (const FileException &e) {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (writeError.empty()) {
+                writeError = e.what();
             }
         }
+    }});
+}
 
-        return hasContent ? 1 : 2; // 1 = full message, 2 = headers only
+void FileHandler::releaseObject(const std::string &fileName) {
+    struct stat info;
+    if (!contentStore || fileName.empty() || ::lstat(fileName.c_str(), &info) != 0 || !S_ISREG(info.st_mode) ||
+        info.st_nlink != 2) {
+        return;
     }
-    catch (const std::filesystem::filesystem_error&) {
-        return -1;
+
+    // Objects are named by the hash of the stored bytes, compressed or not
+    std::ifstream input(fileName, std::ios::binary);
+    ContentHash hash;
+    char buffer[64 * 1024];
+    while (input.read(buffer, sizeof(buffer)) || input.gcount() > 0) {
+        hash.update(buffer, static_cast<size_t>(input.gcount()));
     }
+    std::lock_guard<std::mutex> lock(releasedMutex);
+    releasedObjects.insert(hash.hex());
 }
 
-void FileHandler::saveMessage(const std::string &message_content, int id, std::string &account, std::string &mailbox) {
+void FileHandler::rememberObjectId(int id, const std::string &account, const std::string &mailbox, const std::string &digest,
+                                   bool compressed) {
+    std::string objectId;
+    {
+        std::lock_guard<std::mutex> lock(objectIdsMutex);
+        auto mailboxIds = objectIds.find(path + "/" + account + "/" + mailbox);
+        if (mailboxIds == objectIds.end()) {
+            return;
+        }
+        auto it = mailboxIds->second.find(id);
+        if (it == mailboxIds->second.end()) {
+            return;
+        }
+        objectId = it->second;
+        mailboxIds->second.erase(it);
+    }
+    // Compressed objects can only be read with the dictionary of the account
+    contentStore->remember(account + "/" + objectId + (compressed ? ".z" : ""), digest);
+}
+
+std::vector<int> FileHandler::placeKnownMessages(const std::map<int, std::string> &ids, std::string &account,
+                                                 std::string &mailbox) {
+    std::vector<int> placed;
+    if (!contentStore) {
+        return placed;
+    }
     std::string dirPath = path + "/" + account + "/" + mailbox;
-    std::string filename = dirPath + "/" + std::to_string(id) + ".eml";
+    ensureDirectory(dirPath);
 
-    // Create directory structure if it doesn't exist
-    createDirectories(dirPath);
-    
-    std::ofstream file(filename);
-    if (!file.is_open()) {
-        throw FileException("Failed to open message file: " + filename);
+    std::map<int, std::string> unknown;
+    for (const auto &entry : ids) {
+        const std::string &objectId = entry.second;
+        // The ID becomes a file name
+        if (objectId.empty() || objectId.size() > 255 ||
+            objectId.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_") != std::string::npos) {
+            continue;
+        }
+        bool compressed = false;
+        std::string digest = contentStore->recall(account + "/" + objectId);
+        if (digest.empty() && layout != StorageLayout::Maildir) {
+            digest = contentStore->recall(account + "/" + objectId + ".z");
+            compressed = !digest.empty();
+        }
+
+        std::string fileName;
+        if (!digest.empty()) {
+            fileName = destination(entry.first, account, mailbox, compressed);
+            std::string linkPath = (layout == StorageLayout::Maildir ? maildir(account, mailbox).tempDirectory() : dirPath) +
+                                   "/.link-" + std::to_string(getpid()) + "-" + std::to_string(tempCounter++);
+            if (!contentStore->place(digest, linkPath, fileName)) {
+                fileName.clear();
+            }
+        }
+        if (fileName.empty()) {
+            unknown.insert(entry);
+            continue;
+        }
+
+        // The index needs the kind and size of the original message
+        std::unique_ptr<MappedMessage> stored = MappedMessage::map(fileName, 0, std::filesystem::file_size(fileName));
+        std::string content = compressed ? inflateMessage(stored->data(), stored->size(), dictionary(account).data())
+                                         : std::string(stored->data(), stored->size());
+        committed(PendingMessage{account, mailbox, entry.first, MailboxIndex::classify(content), content.size(),
+                                 std::filesystem::path(fileName).parent_path().string(), fileName});
+        placed.push_back(entry.first);
+    }
+
+    std::lock_guard<std::mutex> lock(objectIdsMutex);
+    for (const auto &entry : unknown) {
+        objectIds[dirPath][entry.first] = entry.second;
+    }
+    return placed;
+}
+
+void FileHandler::committed(const PendingMessage &message) {
+    if (groupCommit == 0) {
+        index(message.account, message.mailbox).record(message.id, message.kind, message.size);
+        return;
+    }
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back(message);
+        full = pending.size() >= groupCommit;
+    }
+    if (full) {
+        flushGroup();
     }
-    file << message_content;
-    file.close();
 }
 
 int FileHandler::checkMailboxUIDValidity(std::string &account, std::string &mailbox, int uidValidity) {
@@ -85,13 +693,8 @@ int FileHandler::checkMailboxUIDValidity(std::string &account, std::string &mail
         if (!std::filesystem::exists(dirPath)) {
             createDirectories(dirPath);
         } else {
-            // UIDVALIDITY was missing but files were here.
-            // Delete all .eml files from the directory
-            for (const auto& entry : std::filesystem::directory_iterator(dirPath)) {
-                if (entry.path().extension() == ".eml") {
-                    std::filesystem::remove(entry.path());
-                }
-            }
+            // UIDVALIDITY was missing but files were here, they belong to an unknown UIDVALIDITY
+            retireMailbox(account, mailbox);
         }
 
         // Write the new UIDVALIDITY value to the file
@@ -101,6 +704,7 @@ int FileHandler::checkMailboxUIDValidity(std::string &account, std::string &mail
         }
         file << uidValidity;
         file.close();
+        resetMailbox(account, mailbox, uidValidity);
         return 2; // Mailbox did not exist, new UIDVALIDITY file created
     }
 
@@ -115,6 +719,9 @@ int FileHandler::checkMailboxUIDValidity(std::string &account, std::string &mail
     file.close();
 
     if (storedUIDValidity != uidValidity) {
+        // The old messages leave with the directory, the new UIDVALIDITY goes to the empty one
+        retireMailbox(account, mailbox);
+
         // Update the UIDVALIDITY value in the file
         std::ofstream outFile(uidValidityFile);
         if (!outFile.is_open()) {
@@ -122,16 +729,385 @@ int FileHandler::checkMailboxUIDValidity(std::string &account, std::string &mail
         }
         outFile << uidValidity;
         outFile.close();
+        resetMailbox(account, mailbox, uidValidity);
+
+        return 1; // UIDVALIDITY updated
+    }
+
+    // The index was written for another UIDVALIDITY, its entries cannot be trusted
+    if (index(account, mailbox).uidValidity() != static_cast<uint32_t>(uidValidity)) {
+        index(account, mailbox).reset(uidValidity);
+    }
+
+    return 0; // UIDVALIDITY matches
+}
+
+void FileHandler::retireMailbox(const std::string &account, const std::string &mailbox) {
+    std::string dirPath = path + "/" + account + "/" + mailbox;
+    std::string retiredRoot = path + "/" + account + "/" + RETIRED_DIRECTORY;
+
+    // Messages committed so far are recorded before their index leaves with the directory
+    if (writer) {
+        writer->drain();
+    }
+    flushGroup();
+    {
+        std::lock_guard<std::mutex> lock(indexesMutex);
+        indexes.erase(dirPath);
+        segmentStores.erase(dirPath);
+        maildirs.erase(dirPath);
+        createdDirectories.erase(dirPath);
+    }
+
+    // The lock moves with the directory, no other process deletes it while it is in use
+    std::string retiredPath = retiredRoot + "/" + std::to_string(std::time(nullptr)) + "-" + std::to_string(getpid()) +
+                              "-" + std::to_string(tempCounter++);
+    createDirectories(retiredRoot);
+    int lockFd = ::open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (lockFd < 0 || ::flock(lockFd, LOCK_EX) != 0) {
+        int error = errno;
+        if (lockFd >= 0) {
+            ::close(lockFd);
+        }
+        throw FileException("Failed to lock mailbox: " + dirPath + " - " + std::strerror(error));
+    }
+    if (std::rename(dirPath.c_str(), retiredPath.c_str()) != 0) {
+        int error = errno;
+        ::close(lockFd);
+        throw FileException("Failed to retire mailbox: " + dirPath + " - " + std::strerror(error));
+    }
+    RetiredDirectory current{retiredPath, lockFd};
+    createDirectories(dirPath);
 
-        // Delete all .eml files from the directory
-        for (const auto& entry : std::filesystem::directory_iterator(dirPath)) {
-            if (entry.path().extension() == ".eml") {
-                std::filesystem::remove(entry.path());
+    // Child mailboxes are moved back, a directory without subdirectories has a link count of 2
+    struct stat info;
+    if (::stat(retiredPath.c_str(), &info) != 0 || info.st_nlink != 2) {
+        auto layoutDirectory = [this](const std::string &name) {
+            if (layout == StorageLayout::Packed) {
+                return name == SegmentStore::DIRECTORY;
+            }
+            if (layout == StorageLayout::Maildir) {
+                return name == "tmp" || name == "new" || name == "cur" ||
+                       (fanOut > 1 && name.size() == 2 && std::isxdigit(name[0]) && std::isxdigit(name[1]));
+            }
+            return false;
+        };
+        std::vector<std::string> children;
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(retiredPath, ec)) {
+            std::string name = entry.path().filename().string();
+            if (entry.is_directory(ec) && name[0] != '.' && !layoutDirectory(name)) {
+                children.push_back(name);
+            }
+        }
+        for (const std::string &name : children) {
+            if (std::rename((retiredPath + "/" + name).c_str(), (dirPath + "/" + name).c_str()) != 0) {
+                int error = errno;
+                ::close(lockFd);
+                throw FileException("Failed to keep child mailbox: " + dirPath + "/" + name + " - " + std::strerror(error));
             }
         }
+    }
 
-        return 1; // UIDVALIDITY updated
+    RetiredDirectory previous;
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        previous = retired[dirPath];
+        retired[dirPath] = current;
     }
+    cleanUp(previous);
 
-    return 0; // UIDVALIDITY matches
+    // Only directories of interrupted runs can be locked, directories in use by any process are skipped
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(retiredRoot, ec)) {
+        int fd = ::open(entry.path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        if (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            ::close(fd);
+            continue;
+        }
+        cleanUp(RetiredDirectory{entry.path().string(), fd});
+    }
+}
+
+void FileHandler::cleanUp(RetiredDirectory directory) {
+    if (directory.path.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        cleanQueue.push_back(std::move(directory));
+        if (!cleaner.joinable()) {
+            cleaner = std::thread(&FileHandler::runCleaner, this);
+        }
+    }
+    cleanerWake.notify_one();
+}
+
+void FileHandler::runCleaner() {
+    std::unique_lock<std::mutex> lock(retiredMutex);
+    while (true) {
+        cleanerWake.wait(lock, [this]() { return stopCleaner || !cleanQueue.empty(); });
+        if (cleanQueue.empty()) {
+            return;
+        }
+        RetiredDirectory directory = std::move(cleanQueue.front());
+        cleanQueue.pop_front();
+        lock.unlock();
+
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(directory.path, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            releaseObject(it->path().string());
+        }
+        std::filesystem::remove_all(directory.path, ec);
+        if (directory.lockFd >= 0) {
+            ::close(directory.lockFd);
+        }
+        lock.lock();
+    }
+}
+
+void FileHandler::releaseRetired() {
+    std::map<std::string, RetiredDirectory> released;
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        released.swap(retired);
+    }
+    for (const auto &entry : released) {
+        cleanUp(entry.second);
+    }
+}
+
+bool FileHandler::hasRetiredMessages(std::string &account, std::string &mailbox) {
+    std::lock_guard<std::mutex> lock(retiredMutex);
+    return layout != StorageLayout::Packed && retired.count(path + "/" + account + "/" + mailbox) != 0;
+}
+
+std::vector<int> FileHandler::reuseRetiredMessages(const std::map<int, std::pair<std::string, uint64_t>> &messages,
+                                                   std::string &account, std::string &mailbox) {
+    std::string dirPath = path + "/" + account + "/" + mailbox;
+    RetiredDirectory retiredDirectory;
+    {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        auto it = retired.find(dirPath);
+        if (it == retired.end()) {
+            return {};
+        }
+        retiredDirectory = it->second;
+        retired.erase(it);
+    }
+    const std::string &retiredPath = retiredDirectory.path;
+
+    // The size alone rules out most files before they are read
+    std::map<std::pair<std::string, uint64_t>, int> wanted;
+    std::set<uint64_t> sizes;
+    for (const auto &entry : messages) {
+        if (!entry.second.first.empty()) {
+            wanted.emplace(entry.second, entry.first);
+            sizes.insert(entry.second.second);
+        }
+    }
+
+    // The retired index knows the original size of every message, only messages of a wanted size are read
+    std::vector<std::pair<std::string, bool>> files;
+    if (layout != StorageLayout::Packed && !wanted.empty()) {
+        MailboxIndex retiredIndex(retiredPath);
+        std::unique_ptr<Maildir> retiredMaildir;
+        if (layout == StorageLayout::Maildir) {
+            retiredMaildir = std::make_unique<Maildir>(retiredPath, fanOut);
+        }
+        if (!retiredIndex.rebuilt()) {
+            for (int uid : retiredIndex.uids().toVector()) {
+                if (retiredIndex.lookup(uid) != MailboxIndex::FULL || sizes.count(retiredIndex.size(uid)) == 0) {
+                    continue;
+                }
+                std::string fileName = retiredPath + "/" + std::to_string(uid) + ".eml";
+                if (retiredMaildir) {
+                    fileName = retiredMaildir->find(uid);
+                } else if (!std::filesystem::exists(fileName)) {
+                    fileName += ".z";
+                }
+                if (!fileName.empty() && std::filesystem::exists(fileName)) {
+                    files.emplace_back(fileName, fileName.size() > 2 && fileName.compare(fileName.size() - 2, 2, ".z") == 0);
+                }
+            }
+        } else if (retiredMaildir) {
+            retiredMaildir->forEach([&](uint32_t, const std::string &messagePath) {
+                files.emplace_back(messagePath, false);
+            });
+        } else {
+            // Without an index the size of compressed messages is unknown, they are downloaded again
+            std::error_code ec;
+            for (const auto &entry : std::filesystem::directory_iterator(retiredPath, ec)) {
+                if (isMessageFile(entry.path()) && entry.path().extension() != ".z") {
+                    files.emplace_back(entry.path().string(), false);
+                }
+            }
+        }
+    }
+
+    std::vector<int> reused;
+    try {
+        for (const auto &file : files) {
+            if (wanted.empty()) {
+                break;
+            }
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(file.first, ec);
+            if (ec || (!file.second && sizes.count(size) == 0)) {
+                continue;
+            }
+
+            std::ifstream input(file.first, std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+            if (file.second) {
+                try {
+                    content = inflateMessage(content.data(), content.size(), dictionary(account).data());
+                } catch (const FileException &) {
+                    continue;
+                }
+            }
+            auto it = wanted.find({ImapParser::parseHeaderField(content, "Message-ID"), content.size()});
+            if (it == wanted.end()) {
+                continue;
+            }
+            int id = it->second;
+            wanted.erase(it);
+
+            std::string fileName = destination(id, account, mailbox, file.second);
+            if (std::rename(file.first.c_str(), fileName.c_str()) != 0) {
+                continue;
+            }
+            committed(PendingMessage{account, mailbox, id, MailboxIndex::classify(content), content.size(),
+                                     std::filesystem::path(fileName).parent_path().string(), fileName});
+            reused.push_back(id);
+        }
+    } catch (const FileException &) {
+        cleanUp(retiredDirectory);
+        throw;
+    }
+
+    cleanUp(retiredDirectory);
+    return reused;
+}
+
+uint32_t FileHandler::readUIDValidity(std::string &account, std::string &mailbox) {
+    std::ifstream file(path + "/" + account + "/" + mailbox + "/uidvalidity.txt");
+    uint32_t uidValidity = 0;
+    if (!(file >> uidValidity)) {
+        return 0;
+    }
+    return uidValidity;
+}
+
+uint64_t FileHandler::readHighestModSeq(std::string &account, std::string &mailbox, const std::string &syncMode) {
+    return readSyncValue(path + "/" + account + "/" + mailbox + "/highestmodseq.txt", syncMode);
+}
+
+void FileHandler::writeHighestModSeq(std::string &account, std::string &mailbox, uint64_t highestModSeq, const std::string &syncMode) {
+    writeSyncValue(path + "/" + account + "/" + mailbox + "/highestmodseq.txt", highestModSeq, syncMode);
+}
+
+uint32_t FileHandler::readLastSyncedUid(std::string &account, std::string &mailbox, const std::string &syncMode) {
+    return readSyncValue(path + "/" + account + "/" + mailbox + "/lastuid.txt", syncMode);
+}
+
+void FileHandler::writeLastSyncedUid(std::string &account, std::string &mailbox, uint32_t uid, const std::string &syncMode) {
+    writeSyncValue(path + "/" + account + "/" + mailbox + "/lastuid.txt", uid, syncMode);
+}
+
+uint64_t FileHandler::readSyncValue(const std::string &fileName, const std::string &syncMode) {
+    std::ifstream file(fileName);
+    uint64_t value = 0;
+    std::string mode;
+    // The mode may contain spaces, it takes the rest of the line
+    if (!(file >> value) || !std::getline(file >> std::ws, mode) || mode != syncMode) {
+        return 0;
+    }
+    return value;
+}
+
+void FileHandler::writeSyncValue(const std::string &fileName, uint64_t value, const std::string &syncMode) {
+    std::string tempName = fileName + ".tmp";
+    std::string content = std::to_string(value) + " " + syncMode + "\n";
+
+    // Flushed before the rename and the rename flushed with its directory, so a crash never leaves a half-written value
+    int fd = ::open(tempName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw FileException("Failed to open file: " + tempName + " - " + std::strerror(errno));
+    }
+    bool written = writeAll(fd, content.data(), content.size()) && ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !written || std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+        ::unlink(tempName.c_str());
+        throw FileException("Failed to write file: " + fileName);
+    }
+
+    std::string directory = std::filesystem::path(fileName).parent_path().string();
+    int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0 || ::fsync(dirFd) != 0) {
+        if (dirFd >= 0) {
+            ::close(dirFd);
+        }
+        throw FileException("Failed to flush directory: " + directory);
+    }
+    ::close(dirFd);
+}
+
+void FileHandler::resetMailbox(const std::string &account, const std::string &mailbox, int uidValidity) {
+    clearSyncState(path + "/" + account + "/" + mailbox);
+    index(account, mailbox).reset(uidValidity);
+    if (layout == StorageLayout::Packed) {
+        segments(account, mailbox).clear();
+    } else if (layout == StorageLayout::Maildir) {
+        maildir(account, mailbox).clear();
+    }
+}
+
+void FileHandler::clearSyncState(const std::string &dirPath) {
+    std::filesystem::remove(dirPath + "/highestmodseq.txt");
+    std::filesystem::remove(dirPath + "/lastuid.txt");
+    std::filesystem::remove(dirPath + "/" + ENVELOPE_FILE);
+}
+
+void FileHandler::appendEnvelope(const Envelope &envelope, int id, std::string &account, std::string &mailbox) {
+    std::string fileName = path + "/" + account + "/" + mailbox + "/" + ENVELOPE_FILE;
+    std::string line = std::to_string(id) + " " + std::to_string(envelope.size) + " \"" +
+                       envelope.internalDate + "\" (" + envelope.flags + ")\n";
+
+    // A single append keeps lines of concurrent connections whole
+    int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw FileException("Failed to open file: " + fileName);
+    }
+    ssize_t written = ::write(fd, line.data(), line.size());
+    close(fd);
+    if (written != static_cast<ssize_t>(line.size())) {
+        throw FileException("Failed to write file: " + fileName);
+    }
+}
+
+UidSet FileHandler::storedMessages(std::string &account, std::string &mailbox) {
+    return index(account, mailbox).uids();
+}
+
+void FileHandler::removeMessage(int id, std::string &account, std::string &mailbox) {
+    if (layout == StorageLayout::Packed) {
+        segments(account, mailbox).remove(id);
+    } else if (layout == StorageLayout::Maildir) {
+        releaseObject(maildir(account, mailbox).find(id));
+        maildir(account, mailbox).remove(id);
+    } else {
+        std::string filename = path + "/" + account + "/" + mailbox + "/" + std::to_string(id) + ".eml";
+
+        for (const std::string &name : {filename, filename + ".z"}) {
+            releaseObject(name);
+            if (std::remove(name.c_str()) != 0 && errno != ENOENT) {
+                throw FileException("Failed to remove message file: " + name + " - " + std::strerror(errno));
+            }
+        }
+    }
+    index(account, mailbox).record(id, MailboxIndex::MISSING, 0);
 }
@@ -8,15 +8,264 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <filesystem>
+#include <thread>
 
+#include "ContentStore.h"
+#include "MailboxIndex.h"
+#include "Maildir.h"
+#include "MessageCompression.h"
+#include "SegmentStore.h"
+#include "StorageLayout.h"
+#include "StorageWriter.h"
+
+/**
+ * @class MessageFile
+ * @brief A message being written to a temporary file piece by piece.
+ *
+ * The file is moved to its final name by commit(). An uncommitted file is
+ * removed when the object is destroyed, so partial messages never appear
+ * in the mailbox directory.
+ *
+ * A buffered message keeps its data in memory and creates no file, the data
+ * is taken by release() and written by a StorageWriter.
+ *
+ * A compressed message is deflated as it is written, size() and kind() still
+ * describe the original message.
+ */
+class MessageFile {
+public:
+    /**
+     * @brief Creates the temporary file.
+     *
+     * @param tempPath Path of the temporary file.
+     * @param buffered Keep the data in memory instead of writing the file.
+     * @throws FileException if the file cannot be created.
+     */
+    MessageFile(const std::string &tempPath, bool buffered = false);
+
+    /**
+     * @brief Removes the temporary file if it was not committed.
+     */
+    ~MessageFile();
+
+    MessageFile(const MessageFile &) = delete;
+    MessageFile &operator=(const MessageFile &) = delete;
+
+    /**
+     * @brief Appends data to the message.
+     *
+     * @param data Pointer to the data.
+     * @param length Number of bytes to write.
+     * @throws FileException if the data cannot be written.
+     */
+    void write(const char *data, size_t length);
+
+    /**
+     * @brief Compresses the data written from now on, must be called before the first write().
+     *
+     * @param dictionary Preset dictionary, nullptr compresses without one.
+     * @throws FileException if zlib fails to initialize.
+     */
+    void compress(const std::string *dictionary);
+
+    /**
+     * @brief Keeps the first bytes of the original message, see sampled().
+     * @param bytes Number of bytes to keep.
+     */
+    void sample(size_t bytes);
+
+    /**
+     * @brief Returns true if the message is compressed.
+     */
+    bool compressed() const;
+
+    /**
+     * @brief Returns the bytes kept by sample(), empty if none were requested.
+     */
+    const std::string &sampled() const;
+
+    /**
+     * @brief Hashes the data as it is stored from now on, must be called before the first write().
+     * @throws FileException if OpenSSL fails to initialize.
+     */
+    void hash();
+
+    /**
+     * @brief Ends the message and returns the SHA-256 of the stored bytes.
+     * @return std::string The hash as hexadecimal digits, empty if hash() was not called.
+     */
+    std::string digest();
+
+    /**
+     * @brief Closes the file and moves it to its final name.
+     *
+     * @param path The final path of the message.
+     * @throws FileException if the file cannot be closed or renamed.
+     */
+    void commit(const std::string &path);
+
+    /**
+     * @brief Returns true if the data is kept in memory.
+     */
+    bool buffered() const;
+
+    /**
+     * @brief Returns the path of the temporary file.
+     */
+    const std::string &tempPath() const;
+
+    /**
+     * @brief Takes the data of a buffered message.
+     * @return std::string The data written so far.
+     */
+    std::string release();
+
+    /**
+     * @brief Returns the number of bytes written so far.
+     */
+    uint64_t size() const;
+
+    /**
+     * @brief Returns MailboxIndex::FULL if the message written so far has a body, otherwise MailboxIndex::HEADERS_ONLY.
+     */
+    int kind() const;
+
+private:
+    std::string tempPath_; ///< Path of the temporary file.
+    int fd_ = -1; ///< Descriptor of the temporary file, -1 once closed or when buffered.
+    bool buffered_;
+    std::string data_; ///< Data of a buffered message.
+    uint64_t size_ = 0; ///< Number of bytes written.
+    BodyDetector detector_; ///< Classifies the message as it is written.
+    std::unique_ptr<MessageDeflater> deflater_; ///< Compresses the data, nullptr once finished or when not compressed.
+    bool compressed_ = false;
+    std::string deflated_; ///< Compressed bytes waiting to be stored.
+    size_t sampleSize_ = 0;
+    std::string sample_; ///< First bytes of the original message.
+    std::unique_ptr<ContentHash> hash_; ///< Hashes the stored bytes, nullptr once finished or when not hashed.
+    std::string digest_;
+
+    /**
+     * @brief Stores data as it goes to the file or buffer.
+     */
+    void store(const char *data, size_t length);
+
+    /**
+     * @brief Stores the end of the compressed data.
+     */
+    void finish();
+};
+
+/**
+ * @struct Envelope
+ * @brief Message attributes fetched together with selected header fields.
+ */
+struct Envelope {
+    uint64_t size = 0; ///< RFC822.SIZE of the whole message on the server
+    std::string internalDate; ///< INTERNALDATE, e.g. 17-Jul-1996 02:44:25 -0700
+    std::string flags; ///< FLAGS separated by spaces
+};
+
+/**
+ * @class FileHandler
+ * @brief Stores downloaded messages in the output directory.
+ *
+ * Saving messages is thread-safe, so a single FileHandler can be shared
+ * by multiple download connections.
+ *
+ * Messages are made durable in groups: a committed message is recorded in
+ * the mailbox index only after the group of groupCommit messages it belongs
+ * to was flushed to disk with one fdatasync() per message file and one fsync()
+ * per directory, other writers on the same filesystem are not waited for.
+ * A message lost or truncated by a crash is therefore never considered
+ * downloaded and is downloaded again.
+ *
+ * With a write-behind limit, messages are received into memory and written
+ * by a StorageWriter, so the receiving thread never waits for the disk
+ * unless the limit of unwritten bytes is reached.
+ *
+ * With the Packed layout, messages are appended to the SegmentStore of the
+ * mailbox instead of being stored in one file each. With the Maildir layout,
+ * messages are delivered to the Maildir of the mailbox, optionally fanned out
+ * over several bucket Maildirs.
+ *
+ * With compression enabled, messages are stored deflated with the
+ * CompressionDictionary of their account, as <uid>.eml.z files or flagged
+ * segment store entries. Maildir messages stay uncompressed for mail readers.
+ *
+ * With deduplication enabled, every message file is a hard link of an object
+ * in the ContentStore of the output directory, identical messages of all
+ * mailboxes and accounts share one object. Messages of the Packed layout are
+ * not deduplicated.
+ *
+ * After a UIDVALIDITY change the mailbox directory is retired by a single
+ * rename into the .retired directory of the account and deleted by a
+ * background thread. Until then its messages can be reused for the new UIDs,
+ * see reuseRetiredMessages(). A retired directory stays flock()ed while it is
+ * in use, directories left unlocked by interrupted runs are deleted as well.
+ */
 class FileHandler {
 public:
     /**
      *  @brief Construct a new FileHandler object.
      * 
      * @param mailFolder Path to the folder containing email file structure.
+     * @param groupCommit Messages made durable together, 0 records messages at once without syncing.
+     * @param writeBehind Maximum bytes of messages waiting for the background writer, 0 writes synchronously.
+     * @param layout Layout of the message files in the mailbox directories.
+     * @param fanOut Number of bucket Maildirs per mailbox with the Maildir layout.
      */
-    FileHandler(std::string mailFolder);
+    FileHandler(std::string mailFolder, size_t groupCommit = DEFAULT_GROUP_COMMIT, size_t writeBehind = 0,
+                StorageLayout layout = StorageLayout::Files, unsigned fanOut = 1);
+
+    /**
+     * @brief Flushes the messages committed so far, waits for retired mailboxes to be deleted and deletes objects of removed messages.
+     */
+    ~FileHandler();
+
+    /**
+     * @brief Makes all committed messages durable and records them in their mailbox indexes.
+     *
+     * Waits for the background writer first. Object IDs of messages not saved
+     * by now are forgotten and retired mailboxes are no longer reused.
+     *
+     * @throws FileException if the data cannot be flushed to disk or a background write failed.
+     */
+    void flush();
+
+    static constexpr size_t DEFAULT_GROUP_COMMIT = 64; ///< Messages flushed to disk together
+
+    /**
+     * @brief Stores the messages saved from now on compressed.
+     *
+     * @param dictionarySamples Messages of every account the dictionary is trained on, 0 uses no dictionary.
+     */
+    void compressMessages(size_t dictionarySamples);
+
+    /**
+     * @brief Stores the messages saved from now on once per content.
+     */
+    void deduplicateMessages();
+
+    /**
+     * @brief Links the messages whose object IDs are known instead of downloading them.
+     *
+     * The object IDs of the other messages are remembered once they are saved.
+     *
+     * @param ids Object IDs assigned by the server by UID, e.g. EMAILID or X-GM-MSGID.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return std::vector<int> The UIDs of the linked messages.
+     * @throws FileException if a linked message cannot be read.
+     */
+    std::vector<int> placeKnownMessages(const std::map<int, std::string> &ids, std::string &account, std::string &mailbox);
 
     /**
      * @brief Saves the given message content to a file with a specified ID.
@@ -31,10 +280,35 @@ public:
      */
     void saveMessage(const std::string &message_content, int id, std::string &account, std::string &mailbox);
 
+    /**
+     * @brief Opens a temporary file for a message whose content arrives in parts.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return std::unique_ptr<MessageFile> The opened message file.
+     * @throws FileException if the file cannot be created.
+     */
+    std::unique_ptr<MessageFile> openMessage(std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Moves a completely written message to its place in the mailbox.
+     *
+     * The message is recorded in the mailbox index once its group is flushed,
+     * see flush().
+     *
+     * @param file The message file returned by openMessage().
+     * @param id The identifier used to generate the filename.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @throws FileException if the file cannot be moved.
+     */
+    void commitMessage(MessageFile &file, int id, std::string &account, std::string &mailbox);
+
     /**
      * @brief Checks if the message with the given ID has already been downloaded.
      * 
      * If only the header of the message has been downloaded, the message is not considered downloaded.
+     * The answer comes from the mailbox index, the message file itself is not read.
      * 
      * @param id The ID of the message to check.
      * @param account The account name.
@@ -50,18 +324,375 @@ public:
      * 
      * Checks if the mailbox's UIDVALIDITY value matches the given value or if it even exists yet.
      * Saves new UIDVALIDITY value to the mailbox uidvalidity.txt file.
-     * Deletes all messages in the mailbox if the UIDVALIDITY value does not match.
+     * Retires all messages in the mailbox and clears its index if the UIDVALIDITY value does not match.
      * 
      * @param account The account name.
      * @param mailbox The mailbox name.
      * @param uidValidity The UIDVALIDITY value to check.
      * @return int 
      * Returns: 0 if the mailbox UIDVALIDITY does match, 1 if it does not match, 2 if the mailbox does not exist, and -1 on error.
+     * @throws FileException if the messages cannot be retired.
      */
     int checkMailboxUIDValidity(std::string &account, std::string &mailbox, int uidValidity);
 
+    /**
+     * @brief Checks whether messages of the mailbox were retired and can still be reused.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     */
+    bool hasRetiredMessages(std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Moves retired messages back into the mailbox under their new UIDs instead of downloading them.
+     *
+     * A retired message is reused if its Message-ID and size match a message
+     * on the server. The retired mailbox is deleted afterwards, so it is
+     * searched only once. Messages of the Packed layout are not reused.
+     *
+     * @param messages Message-ID and RFC822.SIZE of the messages to be downloaded by UID.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return std::vector<int> The UIDs of the reused messages.
+     * @throws FileException if a full group cannot be flushed.
+     */
+    std::vector<int> reuseRetiredMessages(const std::map<int, std::pair<std::string, uint64_t>> &messages,
+                                          std::string &account, std::string &mailbox);
+
+    static constexpr const char *RETIRED_DIRECTORY = ".retired"; ///< Subdirectory of the account holding retired mailboxes
+
+    /**
+     * @brief Reads the UIDVALIDITY stored for the mailbox.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return uint32_t The stored UIDVALIDITY, 0 if the mailbox was never synchronized.
+     */
+    uint32_t readUIDValidity(std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Reads the HIGHESTMODSEQ of the last complete synchronization of the mailbox.
+     *
+     * The value is stored in highestmodseq.txt next to uidvalidity.txt together
+     * with the synchronization mode, a value stored for another mode is not returned.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param syncMode The mode of the current synchronization, e.g. BODY[].
+     * @return uint64_t The stored mod-sequence, 0 if there is none.
+     */
+    uint64_t readHighestModSeq(std::string &account, std::string &mailbox, const std::string &syncMode);
+
+    /**
+     * @brief Stores the HIGHESTMODSEQ after a complete synchronization of the mailbox.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param highestModSeq The mod-sequence reported by the server.
+     * @param syncMode The mode of the synchronization.
+     * @throws FileException if the file cannot be written.
+     */
+    void writeHighestModSeq(std::string &account, std::string &mailbox, uint64_t highestModSeq, const std::string &syncMode);
+
+    /**
+     * @brief Reads the highest UID covered by the last complete synchronization of the mailbox.
+     *
+     * Stored in lastuid.txt the same way as the HIGHESTMODSEQ. All messages up to
+     * this UID are stored locally, so later searches can start above it.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param syncMode The mode of the current synchronization.
+     * @return uint32_t The stored UID, 0 if there is none.
+     */
+    uint32_t readLastSyncedUid(std::string &account, std::string &mailbox, const std::string &syncMode);
+
+    /**
+     * @brief Stores the highest UID covered by a complete synchronization of the mailbox.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param uid The highest UID.
+     * @param syncMode The mode of the synchronization.
+     * @throws FileException if the file cannot be written.
+     */
+    void writeLastSyncedUid(std::string &account, std::string &mailbox, uint32_t uid, const std::string &syncMode);
+
+    /**
+     * @brief Returns the UIDs of all messages stored for the mailbox.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return UidSet The stored UIDs.
+     * @throws FileException if the mailbox index cannot be loaded.
+     */
+    UidSet storedMessages(std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Records the envelope attributes of a message.
+     *
+     * Lines of the form `uid size "internaldate" (flags)` are appended to the
+     * envelopes.txt file of the mailbox. A message downloaded again adds a new
+     * line, the last line of a UID is valid.
+     *
+     * @param envelope The attributes.
+     * @param id The UID of the message.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @throws FileException if the file cannot be written.
+     */
+    void appendEnvelope(const Envelope &envelope, int id, std::string &account, std::string &mailbox);
+
+    static constexpr const char *ENVELOPE_FILE = "envelopes.txt"; ///< Envelope attributes of the mailbox messages
+
+    /**
+     * @brief Maps a stored message into memory for reading.
+     *
+     * A compressed message is mapped as stored, see readMessage().
+     *
+     * @param id The UID of the message.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param compressed Receives true if the message is compressed, may be nullptr.
+     * @return std::unique_ptr<MappedMessage> The message, nullptr if it is not stored.
+     * @throws FileException if the message cannot be mapped.
+     */
+    std::unique_ptr<MappedMessage> mapMessage(int id, std::string &account, std::string &mailbox, bool *compressed = nullptr);
+
+    /**
+     * @brief Reads a stored message, decompressing it if needed.
+     *
+     * @param id The UID of the message.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return std::string The content of the message.
+     * @throws FileException if the message is not stored or cannot be read.
+     */
+    std::string readMessage(int id, std::string &account, std::string &mailbox);
+
+    /**
+     * @brief Removes a message expunged on the server.
+     *
+     * @param id The identifier of the message.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @throws FileException if the message cannot be removed.
+     */
+    void removeMessage(int id, std::string &account, std::string &mailbox);
+
 private:
     std::string path; ///< Path to the folder containing email file structure.
+    std::atomic<unsigned long> tempCounter{0}; ///< Counter used to name temporary message files.
+    std::mutex indexesMutex; ///< Guards indexes.
+    std::map<std::string, std::unique_ptr<MailboxIndex>> indexes; ///< Loaded indexes by mailbox directory.
+    std::set<std::string> createdDirectories; ///< Directories known to exist, guarded by indexesMutex.
+    StorageLayout layout; ///< Layout of the message files.
+    std::map<std::string, std::unique_ptr<SegmentStore>> segmentStores; ///< Opened segment stores by mailbox directory, guarded by indexesMutex.
+    unsigned fanOut; ///< Buckets of every Maildir.
+    std::map<std::string, std::unique_ptr<Maildir>> maildirs; ///< Created Maildirs by mailbox directory, guarded by indexesMutex.
+    bool compress = false; ///< Store new messages compressed.
+    size_t dictionarySamples = 0; ///< Messages every dictionary is trained on.
+    std::map<std::string, std::unique_ptr<CompressionDictionary>> dictionaries; ///< Loaded dictionaries by account, guarded by indexesMutex.
+    std::unique_ptr<ContentStore> contentStore; ///< Objects of deduplicated messages, nullptr without deduplication.
+    std::mutex releasedMutex; ///< Guards releasedObjects.
+    std::set<std::string> releasedObjects; ///< Hashes of objects whose last mailbox link was removed, checked by collect().
+    std::mutex objectIdsMutex; ///< Guards objectIds.
+    std::map<std::string, std::map<int, std::string>> objectIds; ///< Object IDs of messages to be saved by mailbox directory.
+
+    /**
+     * @brief A retired directory locked by this FileHandler.
+     */
+    struct RetiredDirectory {
+        std::string path; ///< Path of the directory, empty for none.
+        int lockFd = -1; ///< Descriptor of the directory holding its flock().
+    };
+
+    std::mutex retiredMutex; ///< Guards retired, cleanQueue and stopCleaner.
+    std::map<std::string, RetiredDirectory> retired; ///< Retired directories whose messages can be reused by mailbox directory.
+    std::deque<RetiredDirectory> cleanQueue; ///< Retired directories waiting to be deleted.
+    std::condition_variable cleanerWake; ///< Signals a queued directory or stopCleaner.
+    bool stopCleaner = false; ///< The cleaner exits once the queue is empty.
+    std::thread cleaner; ///< Deletes queued retired directories, started by the first one.
+
+    /**
+     * @brief A committed message waiting for its group to be flushed.
+     */
+    struct PendingMessage {
+        std::string account;
+        std::string mailbox;
+        int id;
+        int kind;
+        uint64_t size;
+        std::string directory; ///< Directory the message was moved to, synced by the flush
+        std::string file; ///< File of the message synced by the flush, empty if the segment store holds it
+    };
+
+    size_t groupCommit; ///< Messages per flush, 0 records messages at once without syncing.
+    std::mutex pendingMutex; ///< Guards pending.
+    std::vector<PendingMessage> pending; ///< Committed messages not flushed yet.
+    std::mutex flushMutex; ///< Serializes flushes, so flush() returns only after earlier groups are recorded.
+    std::string writeError; ///< First failure of the background writer, guarded by pendingMutex.
+    std::unique_ptr<StorageWriter> writer; ///< Background writer, declared last so it stops before the other members are destroyed.
+
+    /**
+     * @brief Records a message written to its final name, or queues it for the next flush.
+     *
+     * @param message The message.
+     * @throws FileException if a full group cannot be flushed.
+     */
+    void committed(const PendingMessage &message);
+
+    /**
+     * @brief Flushes the queued messages without waiting for the background writer.
+     *
+     * @throws FileException if the data cannot be flushed to disk.
+     */
+    void flushGroup();
+
+    /**
+     * @brief Returns the index of the mailbox, loading it on first use.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return MailboxIndex& The index, valid until the mailbox is retired.
+     * @throws FileException if the index cannot be loaded.
+     */
+    MailboxIndex &index(const std::string &account, const std::string &mailbox);
+
+    /**
+     * @brief Returns the segment store of the mailbox, opening it on first use.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return SegmentStore& The store, valid until the mailbox is retired.
+     * @throws FileException if the store cannot be opened.
+     */
+    SegmentStore &segments(const std::string &account, const std::string &mailbox);
+
+    /**
+     * @brief Returns the segment store of the mailbox directory, indexesMutex must be held.
+     */
+    SegmentStore &segmentStore(const std::string &dirPath);
+
+    /**
+     * @brief Returns the Maildir of the mailbox, creating it on first use.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @return Maildir& The Maildir, valid until the mailbox is retired.
+     * @throws FileException if the Maildir cannot be created.
+     */
+    Maildir &maildir(const std::string &account, const std::string &mailbox);
+
+    /**
+     * @brief Returns the Maildir of the mailbox directory, indexesMutex must be held.
+     */
+    Maildir &maildirOf(const std::string &dirPath);
+
+    /**
+     * @brief Returns the compression dictionary of the account, loading it on first use.
+     *
+     * @param account The account name.
+     * @return CompressionDictionary& The dictionary, valid for the lifetime of the FileHandler.
+     */
+    CompressionDictionary &dictionary(const std::string &account);
+
+    /**
+     * @brief Returns the compression dictionary of the account, indexesMutex must be held.
+     */
+    CompressionDictionary &dictionaryOf(const std::string &account);
+
+    /**
+     * @brief Returns the path a message is stored at, replacing its previous copy.
+     *
+     * @param id The UID of the message.
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param compressed The message is compressed.
+     * @return std::string The final path of the message file.
+     */
+    std::string destination(int id, const std::string &account, const std::string &mailbox, bool compressed);
+
+    /**
+     * @brief Remembers the object of a message file about to be removed, so it is collected with the FileHandler.
+     *
+     * Only a file linked by the object alone is hashed, objects shared with
+     * other mailboxes stay until their last mailbox link is removed.
+     *
+     * @param fileName Path of the message file, nothing is done without deduplication.
+     */
+    void releaseObject(const std::string &fileName);
+
+    /**
+     * @brief Remembers the object of a saved message under its object ID, if it has one.
+     */
+    void rememberObjectId(int id, const std::string &account, const std::string &mailbox, const std::string &digest,
+                          bool compressed);
+
+    /**
+     * @brief Checks whether the file is a message of the Files layout, compressed or not.
+     */
+    static bool isMessageFile(const std::filesystem::path &file);
+
+    /**
+     * @brief Moves the mailbox directory aside with one rename, keeping only its child mailboxes.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @throws FileException if the directory cannot be moved.
+     */
+    void retireMailbox(const std::string &account, const std::string &mailbox);
+
+    /**
+     * @brief Queues a retired directory to be deleted by the cleaner thread.
+     * @param directory The retired directory, its lock is released once it is deleted. Nothing is done if its path is empty.
+     */
+    void cleanUp(RetiredDirectory directory);
+
+    /**
+     * @brief Deletes queued retired directories until stopCleaner is set and the queue is empty.
+     */
+    void runCleaner();
+
+    /**
+     * @brief Deletes the retired directories of all mailboxes in the background.
+     */
+    void releaseRetired();
+
+    /**
+     * @brief Discards the stored messages and synchronization state after a UIDVALIDITY change.
+     *
+     * @param account The account name.
+     * @param mailbox The mailbox name.
+     * @param uidValidity The new UIDVALIDITY.
+     */
+    void resetMailbox(const std::string &account, const std::string &mailbox, int uidValidity);
+
+    /**
+     * @brief Reads a value of the synchronization state written for the synchronization mode.
+     *
+     * @param fileName Path to the state file.
+     * @param syncMode The mode of the current synchronization.
+     * @return uint64_t The value, 0 if the file is missing or belongs to another mode.
+     */
+    uint64_t readSyncValue(const std::string &fileName, const std::string &syncMode);
+
+    /**
+     * @brief Atomically replaces a value of the synchronization state.
+     *
+     * @param fileName Path to the state file.
+     * @param value The value.
+     * @param syncMode The mode of the synchronization.
+     * @throws FileException if the file cannot be written.
+     */
+    void writeSyncValue(const std::string &fileName, uint64_t value, const std::string &syncMode);
+
+    /**
+     * @brief Removes the synchronization state and envelopes of the mailbox after its messages were discarded.
+     *
+     * @param dirPath Path to the mailbox directory.
+     */
+    void clearSyncState(const std::string &dirPath);
 
     /**
      * @brief Creates directories in the given path.
@@ -72,6 +703,14 @@ private:
      * @throws FileException if the directories cannot be created.
      */
     void createDirectories(const std::string& fullPath);
+
+    /**
+     * @brief Creates the directory unless it is known to exist already.
+     *
+     * @param fullPath The full path of the directory.
+     * @throws FileException if the directories cannot be created.
+     */
+    void ensureDirectory(const std::string &fullPath);
 };
 
 #endif // FILEHANDLER_H
\ No newline at end of file
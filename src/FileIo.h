@@ -0,0 +1,35 @@
+// FileIo.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cerrno>
+#include <cstddef>
+#include <unistd.h>
+
+/**
+ * @brief Writes the whole buffer, retrying interrupted and partial writes.
+ *
+ * @param fd The descriptor.
+ * @param data Pointer to the data.
+ * @param length Number of bytes.
+ * @return bool True if everything was written, false with errno set otherwise.
+ */
+inline bool writeAll(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+#endif // FILEIO_H
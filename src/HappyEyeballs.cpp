@@ -0,0 +1,139 @@
+// HappyEyeballs.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "HappyEyeballs.h"
+#include "EventLoop.h"
+#include "ImapException.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Attempt {
+    int fd;
+    Clock::time_point deadline;
+};
+
+int remainingMs(Clock::time_point until, Clock::time_point now) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count();
+    return static_cast<int>(std::max<long long>(remaining + 1, 0));
+}
+
+}
+
+int HappyEyeballs::connect(const std::vector<ResolvedAddress> &addresses, int attemptDelayMs, int attemptTimeoutMs) {
+    // All running attempts are watched through one epoll descriptor, which an EventLoop can wait for
+    int watcher = epoll_create1(EPOLL_CLOEXEC);
+    if (watcher < 0) {
+        throw ImapException("Failed to create epoll instance");
+    }
+
+    std::vector<Attempt> attempts;
+    size_t next = 0;
+    Clock::time_point nextStart = Clock::now();
+    int connected = -1;
+
+    auto abandon = [&](size_t index) {
+        epoll_ctl(watcher, EPOLL_CTL_DEL, attempts[index].fd, nullptr);
+        close(attempts[index].fd);
+        attempts.erase(attempts.begin() + index);
+    };
+
+    while (connected < 0) {
+        Clock::time_point now = Clock::now();
+
+        if (next < addresses.size() && (now >= nextStart || attempts.empty())) {
+            const ResolvedAddress &address = addresses[next++];
+            int fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                continue;
+            }
+            if (::connect(fd, reinterpret_cast<const sockaddr *>(&address.address), address.length) == 0) {
+                connected = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                close(fd);
+                continue;
+            }
+            epoll_event event{};
+            event.events = EPOLLOUT;
+            event.data.fd = fd;
+            epoll_ctl(watcher, EPOLL_CTL_ADD, fd, &event);
+            attempts.push_back(Attempt{fd, now + std::chrono::milliseconds(attemptTimeoutMs)});
+            nextStart = now + std::chrono::milliseconds(attemptDelayMs);
+            continue;
+        }
+        if (attempts.empty()) {
+            break;
+        }
+
+        bool expired = false;
+        for (size_t i = attempts.size(); i-- > 0;) {
+            if (attempts[i].deadline <= now) {
+                abandon(i);
+                expired = true;
+            }
+        }
+        if (expired) {
+            continue;
+        }
+
+        Clock::time_point wakeUp = attempts.front().deadline;
+        for (const Attempt &attempt : attempts) {
+            wakeUp = std::min(wakeUp, attempt.deadline);
+        }
+        if (next < addresses.size()) {
+            wakeUp = std::min(wakeUp, nextStart);
+        }
+
+        epoll_event events[8];
+        int count;
+        if (EventLoop *loop = EventLoop::current()) {
+            count = loop->wait(watcher, EPOLLIN, remainingMs(wakeUp, now)) ? epoll_wait(watcher, events, 8, 0) : 0;
+        } else {
+            count = epoll_wait(watcher, events, 8, remainingMs(wakeUp, now));
+        }
+
+        for (int i = 0; i < count && connected < 0; i++) {
+            int fd = events[i].data.fd;
+            auto found = std::find_if(attempts.begin(), attempts.end(), [fd](const Attempt &a) { return a.fd == fd; });
+            if (found == attempts.end()) {
+                continue;
+            }
+            size_t index = found - attempts.begin();
+
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+                epoll_ctl(watcher, EPOLL_CTL_DEL, fd, nullptr);
+                attempts.erase(attempts.begin() + index);
+                connected = fd;
+            } else {
+                // A failed attempt lets the next one start right away
+                abandon(index);
+                nextStart = Clock::now();
+            }
+        }
+    }
+
+    for (size_t i = attempts.size(); i-- > 0;) {
+        abandon(i);
+    }
+    close(watcher);
+
+    if (connected < 0) {
+        throw ImapException("Failed to connect to server on any resolved address");
+    }
+    if (!EventLoop::current()) {
+        fcntl(connected, F_SETFL, fcntl(connected, F_GETFL) & ~O_NONBLOCK);
+    }
+    return connected;
+}
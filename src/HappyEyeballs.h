@@ -0,0 +1,40 @@
+// HappyEyeballs.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef HAPPYEYEBALLS_H
+#define HAPPYEYEBALLS_H
+
+#include "DnsCache.h"
+#include <vector>
+
+/**
+ * @class HappyEyeballs
+ * @brief Connects to the first reachable address with staggered parallel attempts (RFC 8305).
+ *
+ * Attempts start ATTEMPT_DELAY_MS apart, or right away once the previous one
+ * fails, and each of them is abandoned after its own timeout. An unreachable
+ * IPv6 address therefore delays the connection only by the attempt delay.
+ */
+class HappyEyeballs {
+public:
+    /**
+     * @brief Connects to one of the addresses.
+     *
+     * Inside of an EventLoop the task is suspended while waiting and the
+     * returned socket stays non-blocking. Otherwise the socket is blocking.
+     *
+     * @param addresses Addresses in the order they should be attempted.
+     * @param attemptDelayMs Delay between the starts of two attempts.
+     * @param attemptTimeoutMs Time after which a single attempt is abandoned.
+     * @return int The connected socket.
+     * @throws ImapException If no address could be connected
+     */
+    static int connect(const std::vector<ResolvedAddress> &addresses,
+                       int attemptDelayMs = ATTEMPT_DELAY_MS, int attemptTimeoutMs = ATTEMPT_TIMEOUT_MS);
+
+    static constexpr int ATTEMPT_DELAY_MS = 250; ///< Connection Attempt Delay recommended by RFC 8305
+    static constexpr int ATTEMPT_TIMEOUT_MS = 10000; ///< Timeout of a single connection attempt
+};
+
+#endif // HAPPYEYEBALLS_H
@@ -6,13 +6,13 @@
 #include "ImapException.h"
 #include "FileHandler.h"
 #include "FileException.h"
-#include "ImapResponseRegex.h"
+#include "FetchStream.h"
+#include "ImapTokenizer.h"
 #include <stdlib.h>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -21,44 +21,71 @@
 #include <cstring> 
 #include <unistd.h>
 #include <fstream>
-#include <regex>
 #include <dirent.h>
-#include <sys/select.h>
 #include <errno.h>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unordered_set>
+
+TransferStats &TransferStats::operator+=(const TransferStats &other) {
+    wireIn += other.wireIn;
+    wireOut += other.wireOut;
+    logicalIn += other.logicalIn;
+    logicalOut += other.logicalOut;
+    return *this;
+}
 
 ImapClient::ImapClient(ProgramOptions &options)
-    : options_(options), ssl_ctx_(nullptr), ssl_(nullptr) {
-    // Initialize OpenSSL
-    SSL_load_error_strings();
-    OpenSSL_add_ssl_algorithms();
+    : options_(options), mailboxDirectory_(options.mailbox), ssl_(nullptr), recvBuffer_(options.readBufferSize) {
 
     // Set the initial state
     state = ImapClientState::Disconnected;
 
     // Initialize FileHandler
-    fileHandler = new FileHandler(options_.outputDir);
+    fileHandler = new FileHandler(options_.outputDir, options_.groupCommit, options_.writeBehind, options_.layout, options_.fanOut);
+    if (options_.compressStorage) {
+        fileHandler->compressMessages(options_.dictionarySamples);
+    }
+    if (options_.deduplicate) {
+        fileHandler->deduplicateMessages();
+    }
+}
+
+ImapClient::ImapClient(ProgramOptions &options, FileHandler &sharedFileHandler)
+    : options_(options), mailboxDirectory_(options.mailbox), fileHandler(&sharedFileHandler), ownsFileHandler_(false),
+      ssl_(nullptr), recvBuffer_(options.readBufferSize) {
+    state = ImapClientState::Disconnected;
 }
 
 ImapClient::~ImapClient() {
-    if (socket_ != -1) {
-        close(socket_);
+    closeConnection();
+
+    if (ownsFileHandler_) {
+        delete fileHandler;
     }
-    if (ssl_) { 
+}
+
+void ImapClient::closeConnection() {
+    // The TLS session has to be shut down while its socket is still open
+    if (ssl_) {
         SSL_shutdown(ssl_);
         SSL_free(ssl_);
         ssl_ = nullptr;
     }
-    if (ssl_ctx_) {
-        SSL_CTX_free(ssl_ctx_);
-        ssl_ctx_ = nullptr;
+    if (socket_ != -1) {
+        close(socket_);
+        socket_ = -1;
     }
-
-    delete fileHandler;
-    EVP_cleanup();
+    compression_.reset();
 }
 
 int ImapClient::run(AuthData authData) {
     username = authData.username;
+    auth_ = authData;
     while (state != ImapClientState::Logout){
         try {
             switch (state)
@@ -73,10 +100,22 @@ int ImapClient::run(AuthData authData) {
                 login(authData);
                 break;
             case ImapClientState::Authenticated:
+                mailboxDirectory_ = ImapParser::mailboxDirectory(options_.mailbox, "/");
                 selectMailbox();
                 break;
             case ImapClientState::SelectedMailbox:
                 fetchMessages();
+                synced_ = true;
+                if (options_.daemon) {
+                    // Later fetches only look above everything stored so far
+                    lastSyncedUid_ = std::max(syncedUid_, fileHandler->storedMessages(username, mailboxDirectory_).max());
+                    storedModSeq_ = 0;
+                    qresyncResponse_.clear();
+                    state = ImapClientState::Idle;
+                }
+                break;
+            case ImapClientState::Idle:
+                waitForChanges();
                 break;
             
             default:
@@ -84,6 +123,13 @@ int ImapClient::run(AuthData authData) {
             }
         } catch (const ImapException& e) {
             std::cerr << "IMAP error: " << e.what() << std::endl;
+            if (options_.daemon && synced_) {
+                // A long-lived connection can drop, start over after a pause
+                closeConnection();
+                state = ImapClientState::Disconnected;
+                pause(RECONNECT_DELAY_SECONDS);
+                continue;
+            }
             state = ImapClientState::Logout;
             disconnect();
             return 1;
@@ -100,11 +146,102 @@ int ImapClient::run(AuthData authData) {
         }
     }
     disconnect();
+    if (compressionUsed_) {
+        std::cout << "Received " << stats_.wireIn << " compressed bytes for " << stats_.logicalIn
+                  << " bytes of data, sent " << stats_.wireOut << " for " << stats_.logicalOut << "." << std::endl;
+    }
     return 0;
 }
 
+std::vector<MailboxResult> ImapClient::syncMailboxes(AuthData authData, const std::vector<std::string> &mailboxes) {
+    username = authData.username;
+    auth_ = authData;
+    std::vector<MailboxResult> results;
+
+    // Expand * to the mailboxes listed by the server, named mailboxes use / as the hierarchy delimiter
+    std::vector<ListedMailbox> names;
+    for (const std::string &mailbox : mailboxes) {
+        if (mailbox != "*") {
+            names.push_back({mailbox, "/"});
+            continue;
+        }
+        try {
+            ensureAuthenticated(authData);
+            std::vector<ListedMailbox> listed = listMailboxes();
+            names.insert(names.end(), listed.begin(), listed.end());
+        } catch (const std::exception &e) {
+            MailboxResult result;
+            result.mailbox = mailbox;
+            result.error = e.what();
+            results.push_back(result);
+            closeConnection();
+            state = ImapClientState::Disconnected;
+        }
+    }
+
+    for (const ListedMailbox &mailbox : names) {
+        MailboxResult result;
+        result.mailbox = mailbox.name;
+        try {
+            mailboxDirectory_ = ImapParser::mailboxDirectory(mailbox.name, mailbox.delimiter);
+            ensureAuthenticated(authData);
+
+            // SELECT of the next mailbox closes the previous one
+            options_.mailbox = mailbox.name;
+            selectMailbox();
+            fetchMessages();
+            state = ImapClientState::Authenticated;
+
+            result.success = true;
+            result.downloaded = downloadedCount_;
+            result.reused = reusedCount_;
+        } catch (const std::exception &e) {
+            // The connection state is unknown, the next mailbox starts over
+            result.error = e.what();
+            closeConnection();
+            state = ImapClientState::Disconnected;
+        }
+        results.push_back(result);
+    }
+
+    try {
+        disconnect();
+    } catch (const std::exception &e) {
+        closeConnection();
+    }
+    return results;
+}
+
+void ImapClient::ensureAuthenticated(const AuthData &authData) {
+    if (state == ImapClientState::Disconnected) {
+        connectImap();
+    }
+    if (state == ImapClientState::ConnectionEstabilished) {
+        receiveGreeting();
+    }
+    if (state == ImapClientState::NotAuthenticated) {
+        login(authData);
+    }
+}
+
+std::vector<ListedMailbox> ImapClient::listMailboxes() {
+    std::ostringstream command;
+    command << generateTag() << " LIST \"\" \"*\"";
+
+    if (sendCommand(command.str()) != 0) {
+        throw ImapException("Failed to send LIST command");
+    }
+
+    return ImapParser::parseListResponse(receiveResponse());
+}
 
 void ImapClient::connectImap() {
+    // Capabilities and enabled extensions belong to the connection
+    capabilitiesKnown_ = false;
+    qresyncEnabled_ = false;
+    compression_.reset();
+    untagged_ = std::make_unique<ImapLineReader>();
+
     int conn = establishConnection();
     if (conn != 0){
         throw ImapException("Failed to establish connection");
@@ -121,67 +258,37 @@ void ImapClient::connectImap() {
 }
 
 int ImapClient::establishConnection() {
-    struct addrinfo hints{}, *res = nullptr, *p = nullptr;
+    // Accounts on the same server share the lookup, the attempts race per RFC 8305
+    socket_ = HappyEyeballs::connect(DnsCache::resolve(options_.server, options_.port));
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    // Resolve server address
-    int status = getaddrinfo(options_.server.c_str(), std::to_string(options_.port).c_str(), &hints, &res);
-    if (status != 0) {
-        throw ImapException("Failed to resolve server address: " + std::string(gai_strerror(status)));
-    }
-
-    // Attempt to connect using each address info result
-    for (p = res; p != nullptr; p = p->ai_next) {
-
-        socket_ = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (socket_ < 0) {
-            continue;
-        }
-
-        if (::connect(socket_, p->ai_addr, p->ai_addrlen) == 0) {
-            break;
-        }
-
-        close(socket_);
-        socket_ = -1;
-    }
-
-    freeaddrinfo(res);
-
-    if (socket_ < 0) {
-        throw ImapException("Failed to connect to server on any resolved address");
-    }
+    // Reads time out in the kernel, so no select() is needed per read
+    struct timeval timeout;
+    timeout.tv_sec = RECV_TIMEOUT_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
     return 0;
 }
 
 int ImapClient::TLSHandshake() {
-    // Initialize SSL object for the connection
-    ssl_ctx_ = SSL_CTX_new(SSLv23_client_method());
-    if (!ssl_ctx_) {
-        throw ImapException("Failed to create SSL context");
-    }
-    
-    // TODO check viz discord jestli je to spravne
-    // Load the certificate file or dir if specified
-    if (!options_.certFile.empty() || !options_.certDir.empty()) {
-        if (SSL_CTX_load_verify_locations(ssl_ctx_, 
-                                          options_.certFile.empty() ? nullptr : options_.certFile.c_str(), 
-                                          options_.certDir.empty() ? nullptr : options_.certDir.c_str()) != 1) {
-            throw ImapException("Failed to load SSL certificates");
+    // The context and its certificates are shared by all connections of the process
+    TlsContext &context = TlsContext::get(options_.certFile, options_.certDir, options_.outputDir + "/" + TLS_CACHE_DIR);
+    ssl_ = context.newConnection(socket_, options_.server, options_.port);
+
+    // Read whole socket buffers at once and split them into records in memory
+    SSL_set_read_ahead(ssl_, 1);
+    SSL_set_default_read_buffer_len(ssl_, recvBuffer_.size());
+
+    // Perform SSL handshake, resuming a cached session when the server accepts it
+    int result;
+    while ((result = SSL_connect(ssl_)) <= 0) {
+        int ssl_error = SSL_get_error(ssl_, result);
+        if (EventLoop::current() && (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)) {
+            awaitSocket(ssl_error == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT);
+            continue;
         }
-    }
-
-    ssl_ = SSL_new(ssl_ctx_);
-    SSL_set_fd(ssl_, socket_);
-
-    // Perform SSL handshake
-    if (SSL_connect(ssl_) <= 0) {
-        throw ImapException("Failed to establish TLS connection");
         ERR_print_errors_fp(stderr);
+        throw ImapException("Failed to establish TLS connection");
     }
 
     return 0;
@@ -195,7 +302,7 @@ void ImapClient::disconnect() {
         // Send LOGOUT command and close the socket
         sendCommand(command.str());
         receiveResponse();
-        close(socket_);
+        closeConnection();
     }
     state = ImapClientState::Disconnected;
 }
@@ -224,12 +331,62 @@ void ImapClient::login(AuthData auth) {
 
     ImapParser::parseLoginResponse(response);
 
+    // Servers usually announce the capabilities of the authenticated state here
+    capabilities_ = ImapParser::parseCapabilities(response);
+    capabilitiesKnown_ = !capabilities_.empty();
+
+    if (hasCapability("COMPRESS=DEFLATE")) {
+        enableCompression();
+    }
+
     state = ImapClientState::Authenticated;
 }
 
 void ImapClient::selectMailbox() {
+    std::string parameters;
+    bool qresync = false;
+    storedModSeq_ = 0;
+    lastSyncedUid_ = 0;
+
+    if (options_.incremental) {
+        storedModSeq_ = fileHandler->readHighestModSeq(username, mailboxDirectory_, syncMode());
+        lastSyncedUid_ = fileHandler->readLastSyncedUid(username, mailboxDirectory_, syncMode());
+        uint32_t storedUidValidity = fileHandler->readUIDValidity(username, mailboxDirectory_);
+
+        if (hasCapability("QRESYNC")) {
+            enableQresync();
+            qresync = storedModSeq_ > 0 && storedUidValidity > 0;
+        }
+        if (qresync) {
+            // The server reports changed and expunged messages in the SELECT response
+            parameters = " (QRESYNC (" + std::to_string(storedUidValidity) + " " + std::to_string(storedModSeq_) + "))";
+        } else if (qresyncEnabled_ || hasCapability("CONDSTORE")) {
+            parameters = " (CONDSTORE)";
+        }
+    }
+
+    std::string response = openMailbox(parameters);
+    uidValidity_ = ImapParser::parseUIDValidity(response);
+    exists_ = std::max(ImapParser::parseExists(response), 0);
+    highestModSeq_ = options_.incremental ? ImapParser::parseHighestModSeq(response) : 0;
+    qresyncResponse_ = qresync ? response : "";
+
+    int uidCheck = fileHandler->checkMailboxUIDValidity(username, mailboxDirectory_, uidValidity_);
+    if (uidCheck == -1){
+        throw FileException("Failed to check UIDVALIDITY");
+    } else if (uidCheck != 0) {
+        // Stored messages were discarded, nothing is known since any mod-sequence
+        storedModSeq_ = 0;
+        lastSyncedUid_ = 0;
+        qresyncResponse_.clear();
+    }
+
+    state = ImapClientState::SelectedMailbox;
+}
+
+std::string ImapClient::openMailbox(const std::string &parameters) {
     std::ostringstream command;
-    command << generateTag() << " SELECT " << options_.mailbox;
+    command << generateTag() << " SELECT " << ImapParser::formatMailboxName(options_.mailbox) << parameters;
 
     if (sendCommand(command.str()) != 0) {
         throw ImapException("Failed to send SELECT command");
@@ -238,61 +395,305 @@ void ImapClient::selectMailbox() {
     std::string response = receiveResponse();
     ImapParser::parseSelectResponse(response);
 
-    int uidValidity = ImapParser::parseUIDValidity(response);
-    int uidCheck = fileHandler->checkMailboxUIDValidity(username, options_.mailbox, uidValidity);
-    if (uidCheck == -1){
-        throw FileHandler("Failed to check UIDVALIDITY");
+    return response;
+}
+
+bool ImapClient::hasCapability(const std::string &capability) {
+    if (!capabilitiesKnown_) {
+        std::string tag = generateTag();
+        if (sendCommand(tag + " CAPABILITY") != 0) {
+            throw ImapException("Failed to send CAPABILITY command");
+        }
+        std::string response = receiveResponse();
+        ImapParser::parseTaggedStatus(response, tag);
+        capabilities_ = ImapParser::parseCapabilities(response);
+        capabilitiesKnown_ = true;
     }
 
-    state = ImapClientState::SelectedMailbox;
+    return std::find(capabilities_.begin(), capabilities_.end(), capability) != capabilities_.end();
 }
 
-void ImapClient::fetchMessages() {
-    std::ostringstream command;
-    if (options_.onlyNewMessages) {
-        command << generateTag() << " UID SEARCH NEW";
+void ImapClient::enableQresync() {
+    if (qresyncEnabled_) {
+        return;
+    }
+
+    std::string tag = generateTag();
+    if (sendCommand(tag + " ENABLE QRESYNC") != 0) {
+        throw ImapException("Failed to send ENABLE command");
+    }
+    ImapParser::parseTaggedStatus(receiveResponse(), tag);
+    qresyncEnabled_ = true;
+}
+
+void ImapClient::waitForChanges() {
+    bool newMessages = false;
+
+    if (hasCapability("IDLE")) {
+        newMessages = idle();
     } else {
-        command << generateTag() << " UID SEARCH ALL";
+        pause(options_.pollInterval);
+
+        std::string tag = generateTag();
+        commandCounter++;
+        if (sendCommand(tag + " NOOP") != 0) {
+            throw ImapException("Failed to send NOOP command");
+        }
+        while (!processUntagged(tag, newMessages)) {
+            size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+            untagged_->feed(recvBuffer_.data(), received);
+        }
+    }
+
+    if (newMessages) {
+        state = ImapClientState::SelectedMailbox;
+    }
+}
+
+bool ImapClient::idle() {
+    bool newMessages = false;
+    std::string tag = generateTag();
+    commandCounter++;
+
+    if (sendCommand(tag + " IDLE") != 0) {
+        throw ImapException("Failed to send IDLE command");
+    }
+    // Wait for the continuation request, a failed IDLE throws here
+    while (!processUntagged(tag, newMessages)) {
+        size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+        untagged_->feed(recvBuffer_.data(), received);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(IDLE_REFRESH_SECONDS);
+    while (!newMessages) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0 || !waitReadable(remaining.count())) {
+            break;
+        }
+        size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+        untagged_->feed(recvBuffer_.data(), received);
+        if (processUntagged(tag, newMessages)) {
+            // The server ended IDLE on its own
+            return newMessages;
+        }
+    }
+
+    if (sendCommand("DONE") != 0) {
+        throw ImapException("Failed to end IDLE command");
+    }
+    while (!processUntagged(tag, newMessages)) {
+        size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+        untagged_->feed(recvBuffer_.data(), received);
     }
 
+    return newMessages;
+}
+
+bool ImapClient::processUntagged(const std::string &tag, bool &newMessages) {
+    // Lines after the completion stay in the reader for the next command
+    ImapLine line;
+    bool finished = false;
+    while (!finished && untagged_->next(line)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.empty()) {
+            continue;
+        }
+
+        if (tokens[0].is("+")) {
+            finished = true;
+        } else if (tokens[0].type == ImapTokenType::Atom && tokens[0].value == tag) {
+            ImapParser::parseTaggedStatus(line.text(0) + "\r\n", tag);
+            finished = true;
+        } else if (tokens.size() >= 2 && tokens[0].is("*") && tokens[1].is("BYE")) {
+            throw ImapException("Server closed connection: " + line.text(2));
+        } else if (tokens.size() >= 3 && tokens[0].is("*") && tokens[1].is("VANISHED") &&
+                   tokens[2].type == ImapTokenType::Atom) {
+            // With QRESYNC enabled expunges are reported as VANISHED instead of EXPUNGE, EARLIER ones are not counted in EXISTS
+            int vanished = static_cast<int>(ImapParser::parseSequenceSet(tokens[2].value).size());
+            exists_ = std::max(exists_ - vanished, 0);
+        } else if (tokens.size() >= 3 && tokens[0].is("*") && tokens[1].isNumber()) {
+            int number = std::stoi(tokens[1].value);
+            if (tokens[2].is("EXISTS")) {
+                newMessages = newMessages || number > exists_;
+                exists_ = number;
+            } else if (tokens[2].is("EXPUNGE")) {
+                exists_ = std::max(exists_ - 1, 0);
+            }
+        }
+    }
+
+    return finished;
+}
+
+bool ImapClient::waitReadable(int timeoutMs) {
+    // Data already read by OpenSSL or received by zlib is not visible on the socket,
+    // with read-ahead OpenSSL may hold whole records it has not decrypted yet
+    if ((ssl_ && SSL_has_pending(ssl_)) || (compression_ && compression_->hasPending())) {
+        return true;
+    }
+    if (EventLoop *loop = EventLoop::current()) {
+        return loop->wait(socket_, EPOLLIN, timeoutMs);
+    }
+
+    struct pollfd descriptor;
+    descriptor.fd = socket_;
+    descriptor.events = POLLIN;
+    int result;
+    do {
+        result = poll(&descriptor, 1, timeoutMs);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+        throw ImapException("Failed to wait for data from server");
+    }
+    return result > 0;
+}
+
+UidSet ImapClient::searchMessages(const std::string &criteria) {
+    // With ESEARCH the result comes back as ranges instead of every single UID
+    bool esearch = hasCapability("ESEARCH");
+
+    std::ostringstream command;
+    command << generateTag() << " UID SEARCH " << (esearch ? "RETURN (MIN MAX COUNT ALL) " : "") << criteria;
+
     if (sendCommand(command.str()) != 0) {
         throw ImapException("Failed to send SEARCH command");
     }
 
     std::string response = receiveResponse();
-    std::vector<int> messageIds = ImapParser::parseSearchResponse(response);
+    if (esearch) {
+        return ImapParser::parseEsearchResponse(response);
+    }
+    return UidSet(ImapParser::parseSearchResponse(response));
+}
+
+std::vector<int> ImapClient::skipKnownMessages(const std::vector<int> &ids) {
+    std::string item;
+    if (hasCapability("OBJECTID")) {
+        item = "EMAILID";
+    } else if (hasCapability("X-GM-EXT-1")) {
+        item = "X-GM-MSGID";
+    } else {
+        return ids;
+    }
+
+    std::string tag = generateTag();
+    if (sendCommand(tag + " UID FETCH " + ImapParser::formatSequenceSet(ids) + " (UID " + item + ")") != 0) {
+        throw ImapException("Failed to send FETCH command");
+    }
+    std::string response = receiveResponse();
+    ImapParser::parseTaggedStatus(response, tag);
+
+    std::vector<int> placed = fileHandler->placeKnownMessages(ImapParser::parseFetchValues(response, item), username, mailboxDirectory_);
+    if (placed.empty()) {
+        return ids;
+    }
+    std::sort(placed.begin(), placed.end());
+    std::vector<int> remaining;
+    std::set_difference(ids.begin(), ids.end(), placed.begin(), placed.end(), std::back_inserter(remaining));
+    return remaining;
+}
+
+std::vector<int> ImapClient::reuseRetiredMessages(const std::vector<int> &ids) {
+    std::string tag = generateTag();
+    if (sendCommand(tag + " UID FETCH " + ImapParser::formatSequenceSet(ids) +
+                    " (UID RFC822.SIZE BODY.PEEK[HEADER.FIELDS (MESSAGE-ID)])") != 0) {
+        throw ImapException("Failed to send FETCH command");
+    }
+    std::string response = receiveResponse();
+    ImapParser::parseTaggedStatus(response, tag);
+
+    std::map<int, std::string> sizes = ImapParser::parseFetchValues(response, "RFC822.SIZE");
+    std::map<int, std::pair<std::string, uint64_t>> messages;
+    for (const auto &header : ImapParser::parseFetchResponses(response)) {
+        auto size = sizes.find(header.first);
+        if (size != sizes.end() && size->second.find_first_not_of("0123456789") == std::string::npos) {
+            messages[header.first] = {ImapParser::parseHeaderField(header.second, "Message-ID"), std::stoull(size->second)};
+        }
+    }
 
-    int count = 0;
-    std::vector<int> downloadedMessages;
+    std::vector<int> reused = fileHandler->reuseRetiredMessages(messages, username, mailboxDirectory_);
+    if (reused.empty()) {
+        return ids;
+    }
+    std::sort(reused.begin(), reused.end());
+    std::vector<int> remaining;
+    std::set_difference(ids.begin(), ids.end(), reused.begin(), reused.end(), std::back_inserter(remaining));
+    return remaining;
+}
+
+void ImapClient::fetchMessages() {
+    UidSet candidates;
+    std::string criteria = options_.onlyNewMessages ? "NEW" : "ALL";
+
+    if (storedModSeq_ > 0 && highestModSeq_ > 0) {
+        // Messages expunged since the last synchronization are removed locally
+        UidSet vanished = ImapParser::parseVanished(qresyncResponse_);
+        UidSet expunged = fileHandler->storedMessages(username, mailboxDirectory_).intersection(vanished);
+        for (int id : expunged.toVector()) {
+            fileHandler->removeMessage(id, username, mailboxDirectory_);
+        }
+
+        // Only messages changed since the stored mod-sequence can be missing
+        if (highestModSeq_ == storedModSeq_) {
+            candidates = UidSet();
+        } else if (!qresyncResponse_.empty() && !options_.onlyNewMessages) {
+            candidates = UidSet(ImapParser::parseFetchUids(qresyncResponse_));
+        } else {
+            candidates = searchMessages(criteria + " MODSEQ " + std::to_string(storedModSeq_ + 1));
+        }
+    } else if (lastSyncedUid_ > 0) {
+        // Everything up to the high-water mark is stored, only newer UIDs can be missing
+        candidates = searchMessages(criteria + " UID " + std::to_string(lastSyncedUid_ + 1) + ":*");
+    } else {
+        candidates = searchMessages(criteria);
+    }
 
-    for (int id : messageIds){
-        int messageInfo = fileHandler->isMessageAlreadyDownloaded(id, username, options_.mailbox);
+    // UIDs already stored are collected in ascending order, so every add is constant time
+    UidSet downloadedMessages;
+    for (int id : candidates.toVector()){
+        int messageInfo = fileHandler->isMessageAlreadyDownloaded(id, username, mailboxDirectory_);
         if (messageInfo == 1 || (messageInfo == 2 && options_.headersOnly)){
-            downloadedMessages.push_back(id);
+            downloadedMessages.add(id);
         } else if (messageInfo == -1){
             throw ImapException("Failed to determine message status");
         }
     }
 
-    if (messageIds.size() != 0){
+    UidSet missing = candidates.difference(downloadedMessages);
+    std::vector<int> toDownload = missing.toVector();
+    size_t missingCount = toDownload.size();
+    if (fullBody() && !toDownload.empty() && fileHandler->hasRetiredMessages(username, mailboxDirectory_)) {
+        toDownload = reuseRetiredMessages(toDownload);
+    }
+    if (options_.deduplicate && fullBody() && !toDownload.empty()) {
+        toDownload = skipKnownMessages(toDownload);
+    }
 
-        for (int id : messageIds) {
-            if (std::find(downloadedMessages.begin(), downloadedMessages.end(), id) != downloadedMessages.end()){
-                continue;
-            }
-            // Download the message
-            std::string message = downloadMessage(id);
-            if (message.empty()) {
-                throw ImapException("Failed to download message");
-            }
-            fileHandler->saveMessage(message, id, username, options_.mailbox);
-            
-            count++;
+    if (options_.connections > 1) {
+        fetchMessagesParallel(toDownload);
+    } else {
+        streamMessages(toDownload);
+    }
+    // The synchronization state must never get ahead of durable messages
+    fileHandler->flush();
+
+    // Everything up to the mod-sequence of the SELECT and the highest UID found is stored now
+    if (options_.incremental && !options_.onlyNewMessages) {
+        if (highestModSeq_ > 0) {
+            fileHandler->writeHighestModSeq(username, mailboxDirectory_, highestModSeq_, syncMode());
+        }
+        if (candidates.max() > lastSyncedUid_) {
+            fileHandler->writeLastSyncedUid(username, mailboxDirectory_, candidates.max(), syncMode());
         }
     }
 
     state = ImapClientState::Logout;
-    userInfo(messageIds.size() - downloadedMessages.size());
+    syncedUid_ = std::max(candidates.max(), lastSyncedUid_);
+    // Reused and linked messages are not downloaded
+    downloadedCount_ = static_cast<int>(toDownload.size());
+    reusedCount_ = static_cast<int>(missingCount - toDownload.size());
+    userInfo(downloadedCount_);
     return;
 }
 
@@ -331,6 +732,10 @@ void ImapClient::userInfo(const int messageCount) {
 
         std::cout << dledText << messageCount << newText << messText << headText << "from mailbox " << options_.mailbox << "." <<  std::endl;
     }
+    if (reusedCount_ > 0) {
+        std::cout << "Reused " << reusedCount_ << (reusedCount_ == 1 ? " stored message" : " stored messages")
+                  << " in mailbox " << options_.mailbox << "." << std::endl;
+    }
 }
 
 std::string ImapClient::generateTag() {
@@ -344,38 +749,97 @@ int ImapClient::sendCommand(const std::string& command) {
     // Append CRLF to the command as per IMAP protocol
     std::string full_command = command + "\r\n";
 
-    ssize_t bytes_sent;
-    if (ssl_){
-        bytes_sent = SSL_write(ssl_, full_command.c_str(), full_command.length());    
+    sendRaw(full_command.data(), full_command.size());
+    return 0;
+}
+
+void ImapClient::sendRaw(const char *data, size_t length) {
+    stats_.logicalOut += length;
+
+    std::string compressed;
+    if (compression_) {
+        compressed = compression_->compress(data, length);
+        data = compressed.data();
+        length = compressed.size();
+    }
+
+    size_t sent = 0;
+    while (sent < length) {
+        if (ssl_) {
+            size_t written = 0;
+            if (SSL_write_ex(ssl_, data + sent, length - sent, &written) == 1) {
+                sent += written;
+                continue;
+            }
+            int ssl_error = SSL_get_error(ssl_, 0);
+            if (EventLoop::current() && (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)) {
+                awaitSocket(ssl_error == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT);
+                continue;
+            }
+            throw ImapException("Failed to send command to server");
+        }
+
+        ssize_t bytes_sent = send(socket_, data + sent, length - sent, MSG_NOSIGNAL);
+        if (bytes_sent >= 0) {
+            sent += bytes_sent;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (EventLoop::current() && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+            awaitSocket(EPOLLOUT);
+        } else {
+            throw ImapException("Failed to send command to server");
+        }
+    }
+    stats_.wireOut += length;
+}
+
+void ImapClient::awaitSocket(uint32_t events) {
+    if (!EventLoop::current()->wait(socket_, events, RECV_TIMEOUT_SECONDS * 1000)) {
+        throw ImapException("Timeout while waiting for data from server");
+    }
+}
+
+void ImapClient::pause(int seconds) {
+    if (EventLoop *loop = EventLoop::current()) {
+        loop->sleep(seconds * 1000);
     } else {
-        bytes_sent = send(socket_, full_command.c_str(), full_command.size(), 0);
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
     }
-    if (bytes_sent < 0) {
-        throw ImapException("Failed to send command to server");
+}
+
+void ImapClient::enableCompression() {
+    std::string tag = generateTag();
+    if (sendCommand(tag + " COMPRESS DEFLATE") != 0) {
+        throw ImapException("Failed to send COMPRESS command");
     }
 
-    return 0;
+    try {
+        ImapParser::parseTaggedStatus(receiveResponse(), tag);
+    } catch (const ImapException &e) {
+        std::cerr << "Compression not enabled: " << e.what() << std::endl;
+        return;
+    }
+
+    // Everything after the tagged OK is compressed in both directions
+    compression_.reset(new DeflateStream());
+    wireBuffer_.resize(recvBuffer_.size());
+    compressionUsed_ = true;
+}
+
+TransferStats ImapClient::transferStats() const {
+    return stats_;
 }
 
 std::string ImapClient::receiveResponse() {
     std::string currentTag = generateTag();
     std::string response;
-    bool received = false;
-    int maxTries = 1000;
+    TaggedCompletionScanner scanner(currentTag);
 
-    while (!received && maxTries > 0) {
+    // Every byte is scanned once, however the response is split into reads
+    while (!scanner.isComplete()) {
         std::string recved = recvData();
+        scanner.feed(recved.data(), recved.size());
         response += recved;
-
-        // Check for completion of response
-        if (ImapParser::checkResponseReceived(recved, currentTag)) {
-            received = true;
-        }
-        maxTries--;
-
-        if (maxTries == 0) {
-            throw ImapException("Failed to receive complete response from server");
-        }
     }
 
     commandCounter++;
@@ -383,95 +847,101 @@ std::string ImapClient::receiveResponse() {
 }
 
 std::string ImapClient::recvData() {
-    char buffer[4096];
-    int bytes_received = 0;
-    const int timeout_seconds = 30;
+    size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+    return std::string(recvBuffer_.data(), received);
+}
+
+size_t ImapClient::recvRaw(char *buffer, size_t size) {
+    if (!compression_) {
+        size_t received = recvWire(buffer, size);
+        stats_.logicalIn += received;
+        return received;
+    }
 
     while (true) {
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(socket_, &read_fds);
-        int max_fd = socket_ + 1;
+        size_t inflated = compression_->inflate(buffer, size);
+        if (inflated > 0) {
+            stats_.logicalIn += inflated;
+            return inflated;
+        }
+        size_t received = recvWire(wireBuffer_.data(), wireBuffer_.size());
+        compression_->feed(wireBuffer_.data(), received);
+    }
+}
 
-        struct timeval timeout;
-        timeout.tv_sec = timeout_seconds;
-        timeout.tv_usec = 0;
+size_t ImapClient::recvWire(char *buffer, size_t size) {
+    while (true) {
+        size_t bytes_received = 0;
 
-        int select_result;
         if (ssl_) {
-            // For SSL, use SSL_pending to check if there's data to read
-            if (SSL_pending(ssl_) > 0) {
-                select_result = 1; // Data is already pending
+            // Records buffered by read-ahead are returned without another syscall
+            if (SSL_read_ex(ssl_, buffer, size, &bytes_received) == 1) {
+                stats_.wireIn += bytes_received;
+                return bytes_received;
+            }
+            int ssl_error = SSL_get_error(ssl_, 0);
+            if (ssl_error == SSL_ERROR_ZERO_RETURN) {
+                throw ImapException("Server closed connection");
+            } else if (EventLoop::current() && (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)) {
+                awaitSocket(ssl_error == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT);
+                continue;
+            } else if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
+                // The socket is blocking, so this only happens when SO_RCVTIMEO expires
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw ImapException("Timeout while waiting for data from server");
+            } else if (ssl_error == SSL_ERROR_SYSCALL && errno == 0) {
+                throw ImapException("Server closed connection");
             } else {
-                select_result = select(max_fd, &read_fds, NULL, NULL, &timeout);
+                // Print SSL error details for debugging
+                ERR_print_errors_fp(stderr);
+                throw ImapException("SSL connection problem occurred");
             }
-        } else {
-            // For non-SSL, use select directly
-            select_result = select(max_fd, &read_fds, NULL, NULL, &timeout);
         }
 
-        if (select_result > 0) {
-            if (FD_ISSET(socket_, &read_fds)) {
-                if (ssl_) {
-                    bytes_received = SSL_read(ssl_, buffer, sizeof(buffer) - 1);
-                } else {
-                    bytes_received = recv(socket_, buffer, sizeof(buffer) - 1, 0);
-                }
-
-                if (bytes_received > 0) {
-                    buffer[bytes_received] = '\0';
-
-                    // Return the received data
-                    return std::string(buffer);
-
-                } else if (bytes_received == 0) {
-                    // Connection closed by the server
-                    throw ImapException("Server closed connection");
-                } else {
-                    if (ssl_) {
-                        int ssl_error = SSL_get_error(ssl_, bytes_received);
-                        if (ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE) {
-                            // The operation did not complete; retry
-                            continue;
-                        } else if (ssl_error == SSL_ERROR_ZERO_RETURN) {
-                            throw ImapException("Server closed connection");
-                        } else {
-                            // Print SSL error details for debugging
-                            ERR_print_errors_fp(stderr);
-                            throw ImapException("SSL connection problem occurred");
-                        }
-                    } else {
-                        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                            // No data available; retry
-                            continue;
-                        } else {
-                            throw ImapException("Failed to receive data from server");
-                        }
-                    }
-                }
-            }
-        } else if (select_result == 0) {
-            // Timeout occurred
+        ssize_t result = recv(socket_, buffer, size, 0);
+        if (result > 0) {
+            stats_.wireIn += result;
+            return result;
+        } else if (result == 0) {
+            // Connection closed by the server
+            throw ImapException("Server closed connection");
+        } else if (errno == EINTR) {
+            // Interrupted by signal, retry
+            continue;
+        } else if (EventLoop::current() && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+            awaitSocket(EPOLLIN);
+        } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
             throw ImapException("Timeout while waiting for data from server");
         } else {
-            // select() error
-            if (errno == EINTR) {
-                // Interrupted by signal, retry
-                continue;
-            }
             throw ImapException("Failed to receive data from server");
         }
     }
 }
 
+std::string ImapClient::fetchItem() const {
+    if (!options_.headerFields.empty()) {
+        // Envelope scan, PEEK leaves \Seen untouched
+        return "(UID RFC822.SIZE INTERNALDATE FLAGS BODY.PEEK[HEADER.FIELDS (" + options_.headerFields + ")])";
+    }
+    return options_.headersOnly ? "BODY.PEEK[HEADER]" : "BODY[]";
+}
+
+bool ImapClient::fullBody() const {
+    return !options_.headersOnly && options_.headerFields.empty();
+}
+
+std::string ImapClient::syncMode() const {
+    if (!options_.headerFields.empty()) {
+        return "HEADER.FIELDS (" + options_.headerFields + ")";
+    }
+    return options_.headersOnly ? "HEADER" : "BODY[]";
+}
 
 std::string ImapClient::downloadMessage(int id) {
     std::ostringstream command;
-    if (options_.headersOnly) {
-        command << generateTag() << " UID FETCH " << id << " BODY[HEADER]";
-    } else {
-        command << generateTag() << " UID FETCH " << id << " BODY[]";
-    }
+    command << generateTag() << " UID FETCH " << id << " " << fetchItem();
 
     // Send the FETCH command
     if (sendCommand(command.str()) != 0){
@@ -493,4 +963,166 @@ std::string ImapClient::downloadMessage(int id) {
     std::string message = ImapParser::parseFetchResponse(response);
 
     return message;
-}
\ No newline at end of file
+}
+
+void ImapClient::streamMessages(const std::vector<int> &ids) {
+    std::vector<int> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+
+    WorkQueue queue(1);
+    queue.distribute(sorted, options_.batchSize);
+
+    std::vector<int> saved;
+    streamFromQueue(queue, 0, saved);
+}
+
+void ImapClient::streamFromQueue(WorkQueue &queue, size_t worker, std::vector<int> &saved) {
+    FetchStream stream(*fileHandler, username, mailboxDirectory_);
+    std::deque<std::string> inFlight;
+    std::vector<int> requested;
+    std::vector<int> batch;
+    bool moreWork = true;
+
+    while (moreWork || !inFlight.empty()) {
+        // Fill the window with new FETCH commands
+        while (moreWork && inFlight.size() < static_cast<size_t>(options_.pipelineDepth)) {
+            if (!queue.pop(worker, batch)) {
+                moreWork = false;
+                break;
+            }
+            requested.insert(requested.end(), batch.begin(), batch.end());
+
+            std::string tag = generateTag();
+            commandCounter++;
+
+            std::ostringstream command;
+            command << tag << " UID FETCH " << ImapParser::formatSequenceSet(batch) << " " << fetchItem();
+            if (sendCommand(command.str()) != 0) {
+                throw ImapException("Failed to send FETCH command");
+            }
+            inFlight.push_back(tag);
+        }
+        if (inFlight.empty()) {
+            break;
+        }
+
+        // Wait for the oldest command, data of the others is paired by UID
+        while (!stream.isCompleted(inFlight.front())) {
+            size_t received = recvRaw(recvBuffer_.data(), recvBuffer_.size());
+            stream.consume(recvBuffer_.data(), received);
+        }
+        ImapParser::parseTaggedStatus(stream.takeCompletion(inFlight.front()) + "\r\n", inFlight.front());
+        inFlight.pop_front();
+    }
+
+    // Messages the server did not send are downloaded one by one with a retry
+    for (int id : requested) {
+        if (stream.savedMessages().count(id) != 0) {
+            saved.push_back(id);
+            continue;
+        }
+        std::string message = downloadMessage(id);
+        if (message.empty()) {
+            throw ImapException("Failed to download message");
+        }
+        fileHandler->saveMessage(message, id, username, mailboxDirectory_);
+        saved.push_back(id);
+    }
+}
+
+void ImapClient::fetchMessagesParallel(const std::vector<int> &ids) {
+    std::vector<int> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t batchCount = (sorted.size() + options_.batchSize - 1) / options_.batchSize;
+    size_t connections = std::min(static_cast<size_t>(options_.connections), batchCount);
+    if (connections <= 1) {
+        streamMessages(sorted);
+        return;
+    }
+
+    WorkQueue queue(connections);
+    queue.distribute(sorted, options_.batchSize);
+
+    std::vector<std::vector<int>> saved(connections);
+    std::vector<std::string> errors(connections);
+    std::vector<TransferStats> workerStats(connections);
+    std::vector<std::thread> workers;
+
+    auto work = [this, &queue, &saved, &errors, &workerStats](size_t i) {
+        ImapClient worker(options_, *fileHandler);
+        worker.mailboxDirectory_ = mailboxDirectory_;
+        try {
+            worker.runWorker(auth_, queue, i, uidValidity_, saved[i]);
+        } catch (const std::exception &e) {
+            errors[i] = e.what();
+        }
+        workerStats[i] = worker.transferStats();
+    };
+
+    // Inside of an event loop the connections run as tasks of the same thread
+    EventLoop *loop = EventLoop::current();
+    std::vector<size_t> tasks;
+    for (size_t i = 1; i < connections; i++) {
+        if (loop) {
+            tasks.push_back(loop->spawn([&work, i]() { work(i); }));
+        } else {
+            workers.emplace_back(work, i);
+        }
+    }
+    auto joinWorkers = [&]() {
+        for (size_t task : tasks) {
+            loop->join(task);
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    };
+
+    // This connection takes part in the download as the first worker
+    try {
+        streamFromQueue(queue, 0, saved[0]);
+    } catch (...) {
+        joinWorkers();
+        throw;
+    }
+    joinWorkers();
+
+    // Batches lost with a failed connection are downloaded again over this one
+    std::unordered_set<int> done;
+    for (const std::vector<int> &workerSaved : saved) {
+        done.insert(workerSaved.begin(), workerSaved.end());
+    }
+    std::vector<int> missing;
+    for (int id : sorted) {
+        if (done.count(id) == 0) {
+            missing.push_back(id);
+        }
+    }
+    for (size_t i = 1; i < connections; i++) {
+        stats_ += workerStats[i];
+        if (!errors[i].empty()) {
+            std::cerr << "Download connection " << i << " failed: " << errors[i] << std::endl;
+        }
+    }
+    if (!missing.empty()) {
+        streamMessages(missing);
+    }
+}
+
+void ImapClient::runWorker(AuthData authData, WorkQueue &queue, size_t worker, int uidValidity, std::vector<int> &saved) {
+    username = authData.username;
+    auth_ = authData;
+    ensureAuthenticated(authData);
+
+    // The mailbox must not have been recreated since the main connection selected it
+    if (ImapParser::parseUIDValidity(openMailbox()) != uidValidity) {
+        throw ImapException("UIDVALIDITY changed during download");
+    }
+    state = ImapClientState::SelectedMailbox;
+
+    streamFromQueue(queue, worker, saved);
+
+    state = ImapClientState::Logout;
+    disconnect();
+}
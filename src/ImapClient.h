@@ -10,12 +10,21 @@
 #include "FileHandler.h"
 
 #include "ImapParser.h"
-#include "ImapResponseRegex.h"
+#include "ImapTokenizer.h"
+#include "WorkQueue.h"
+#include "UidSet.h"
+#include "DeflateStream.h"
+#include "TlsContext.h"
+#include "EventLoop.h"
+#include "HappyEyeballs.h"
 
 #include "openssl/ssl.h"
 #include "openssl/err.h"
 #include "openssl/bio.h"
 
+#include <memory>
+#include <vector>
+
 
 enum class ImapClientState {
     Disconnected,
@@ -23,9 +32,37 @@ enum class ImapClientState {
     NotAuthenticated,
     Authenticated,
     SelectedMailbox,
+    Idle,
     Logout
 };
 
+/**
+ * @struct MailboxResult
+ * @brief Outcome of synchronizing one mailbox.
+ */
+struct MailboxResult {
+    std::string mailbox; ///< Name of the mailbox
+    bool success = false; ///< True if all messages were downloaded
+    int downloaded = 0; ///< Number of downloaded messages
+    int reused = 0; ///< Number of messages taken from retired or already stored copies instead of downloaded
+    std::string error; ///< Error message if the synchronization failed
+};
+
+/**
+ * @struct TransferStats
+ * @brief Bytes transferred over the connection and the data they carried.
+ *
+ * Wire and logical counts differ only while COMPRESS DEFLATE is active.
+ */
+struct TransferStats {
+    uint64_t wireIn = 0; ///< Bytes received from the socket
+    uint64_t wireOut = 0; ///< Bytes written to the socket
+    uint64_t logicalIn = 0; ///< Bytes of received protocol data
+    uint64_t logicalOut = 0; ///< Bytes of sent protocol data
+
+    TransferStats &operator+=(const TransferStats &other);
+};
+
 class ImapClient {
 public:
     /**
@@ -39,6 +76,18 @@ public:
      */
     ImapClient(ProgramOptions &options);
 
+    /**
+     * @brief Constructs an additional download connection sharing a FileHandler.
+     *
+     * Used for the workers of a parallel download. The FileHandler is not
+     * owned by the client.
+     *
+     * @param options Reference to a ProgramOptions object containing
+     * configuration settings for the IMAP client.
+     * @param sharedFileHandler FileHandler shared by all connections.
+     */
+    ImapClient(ProgramOptions &options, FileHandler &sharedFileHandler);
+
     /**
      * @brief Destructor for the ImapClient class.
      *
@@ -56,6 +105,7 @@ public:
      * - NotAuthenticated -> Performs login
      * - Authenticated -> Selects mailbox
      * - SelectedMailbox -> Fetches messages
+     * - Idle -> Waits for new messages in daemon mode
      * - Logout -> Disconnects from server
      *
      * @param authData Authentication credentials containing username and password
@@ -63,6 +113,25 @@ public:
      */
     int run(AuthData authData);
 
+    /**
+     * @brief Returns the bytes transferred by this client and its download connections.
+     */
+    TransferStats transferStats() const;
+
+    /**
+     * @brief Synchronizes multiple mailboxes of one account over a single connection.
+     *
+     * Logs in once and downloads the mailboxes one after another by successive
+     * SELECT commands. The mailbox name * stands for all selectable mailboxes
+     * returned by LIST. A failed mailbox does not stop the others, the connection
+     * is opened again for the next one.
+     *
+     * @param authData Authentication credentials containing username and password
+     * @param mailboxes Names of the mailboxes to synchronize
+     * @return std::vector<MailboxResult> Result of every synchronized mailbox
+     */
+    std::vector<MailboxResult> syncMailboxes(AuthData authData, const std::vector<std::string> &mailboxes);
+
     /**
      * @brief Establishes a secure connection to the IMAP server.
      *
@@ -111,6 +180,8 @@ public:
      * @brief Opens the configured mailbox.
      *
      * Sends SELECT command for the mailbox specified in program options.
+     * In incremental mode asks for the mod-sequences of the mailbox by CONDSTORE,
+     * or by QRESYNC together with the changes since the last synchronization.
      * Updates state to SelectedMailbox on success.
      *
      * @throws ImapException If mailbox selection fails
@@ -120,7 +191,9 @@ public:
     /**
      * @brief Downloads messages from the selected mailbox.
      *
-     * 1. Searches for messages based on configured criteria
+     * 1. Searches for messages based on configured criteria, in incremental mode
+     *    only for messages changed since the last synchronization or above the
+     *    highest UID it stored, and removes messages reported as expunged
      * 2. Downloads new or all messages based on options
      * 3. Saves messages to output directory
      * 4. Updates state to Logout when complete
@@ -137,20 +210,46 @@ public:
 
 private:
     ProgramOptions options_;
+    std::string mailboxDirectory_; ///< Directory of the selected mailbox below the account directory
     FileHandler* fileHandler;
+    bool ownsFileHandler_ = true;
     std::string username;
-    int socket_;
+    AuthData auth_; ///< Credentials, needed to log in additional connections
+    int uidValidity_ = 0; ///< UIDVALIDITY of the selected mailbox
+    int downloadedCount_ = 0; ///< Number of messages downloaded by the last fetchMessages()
+    int reusedCount_ = 0; ///< Number of messages the last fetchMessages() reused instead of downloading
+    std::vector<std::string> capabilities_; ///< Capabilities of the server in upper case
+    bool capabilitiesKnown_ = false; ///< True once the capabilities were received
+    bool qresyncEnabled_ = false; ///< True once ENABLE QRESYNC succeeded
+    uint64_t storedModSeq_ = 0; ///< HIGHESTMODSEQ of the last complete synchronization, 0 for a full one
+    uint64_t highestModSeq_ = 0; ///< HIGHESTMODSEQ reported by the last SELECT
+    uint32_t lastSyncedUid_ = 0; ///< Highest UID of the last complete synchronization, 0 for a full one
+    std::string qresyncResponse_; ///< Response to SELECT with QRESYNC, holds changed and vanished UIDs
+    int socket_ = -1;
     int commandCounter = 1;
 
-    SSL_CTX* ssl_ctx_;
     SSL* ssl_; 
 
+    std::vector<char> recvBuffer_; ///< Connection-owned buffer reused by all reads
+    static const int RECV_TIMEOUT_SECONDS = 30; ///< Timeout of a single read
+    static constexpr const char *TLS_CACHE_DIR = ".tls"; ///< Directory of the TLS session cache in the output directory
+    static constexpr int IDLE_REFRESH_SECONDS = 28 * 60; ///< IDLE is re-issued before servers drop it after 29 minutes
+    static constexpr int RECONNECT_DELAY_SECONDS = 5; ///< Pause before a daemon reconnects after an error
+    int exists_ = 0; ///< Number of messages in the selected mailbox
+    uint32_t syncedUid_ = 0; ///< Highest UID covered by the last completed fetchMessages()
+    bool synced_ = false; ///< True after the first completed fetchMessages()
+    std::unique_ptr<ImapLineReader> untagged_ = std::make_unique<ImapLineReader>(); ///< Received lines not processed yet while waiting for changes
+    std::unique_ptr<DeflateStream> compression_; ///< Active COMPRESS DEFLATE layer, null without compression
+    std::vector<char> wireBuffer_; ///< Compressed data read from the connection
+    TransferStats stats_;
+    bool compressionUsed_ = false; ///< True once any connection of this client was compressed
+
     /**
      * @brief Creates TCP socket connection to IMAP server.
      *
-     * 1. Resolves server hostname using DNS
-     * 2. Creates TCP socket
-     * 3. Establishes connection to server
+     * 1. Resolves server hostname using the shared DnsCache
+     * 2. Races staggered connection attempts with HappyEyeballs
+     * 3. Sets the read timeout of the connected socket
      *
      * @return int 0 on success, non-zero on failure
      * @throws ImapException If DNS resolution or socket operations fail
@@ -160,8 +259,8 @@ private:
     /**
      * @brief Sets up SSL/TLS encryption for the connection.
      *
-     * 1. Initializes SSL context and certificate verification
-     * 2. Creates SSL connection
+     * 1. Takes the process-wide TlsContext with the loaded certificates
+     * 2. Creates SSL connection offering the cached session of the server
      * 3. Performs SSL handshake
      *
      * @return int 0 on success, non-zero on failure
@@ -169,6 +268,126 @@ private:
      */
     virtual int TLSHandshake();
 
+    /**
+     * @brief Closes the TLS session and the socket without sending LOGOUT.
+     */
+    void closeConnection();
+
+    /**
+     * @brief Connects and logs in unless the client is already authenticated.
+     *
+     * @param authData Authentication credentials
+     * @throws ImapException If the connection or login fails
+     */
+    void ensureAuthenticated(const AuthData &authData);
+
+    /**
+     * @brief Lists all selectable mailboxes of the account.
+     *
+     * @return std::vector<ListedMailbox> The mailboxes with their hierarchy delimiters
+     * @throws ImapException If the LIST command fails
+     */
+    std::vector<ListedMailbox> listMailboxes();
+
+    /**
+     * @brief Sends SELECT for the configured mailbox.
+     *
+     * @param parameters Select parameters including the leading space, e.g. " (CONDSTORE)".
+     * @return std::string The response of the server
+     * @throws ImapException If mailbox selection fails
+     */
+    std::string openMailbox(const std::string &parameters = "");
+
+    /**
+     * @brief Checks whether the server announced the capability.
+     *
+     * Sends CAPABILITY if the capabilities were not announced yet.
+     *
+     * @param capability The capability in upper case, e.g. QRESYNC.
+     * @return bool True if the server supports it.
+     * @throws ImapException If the CAPABILITY command fails
+     */
+    bool hasCapability(const std::string &capability);
+
+    /**
+     * @brief Enables the QRESYNC extension once per connection.
+     *
+     * @throws ImapException If the ENABLE command fails
+     */
+    void enableQresync();
+
+    /**
+     * @brief Waits until new messages arrive in the selected mailbox.
+     *
+     * Uses IDLE and re-issues it every IDLE_REFRESH_SECONDS. Without IDLE polls
+     * with NOOP every pollInterval seconds. Sets the state to SelectedMailbox
+     * once the mailbox has more messages.
+     *
+     * @throws ImapException If the connection fails or the server closes it
+     */
+    void waitForChanges();
+
+    /**
+     * @brief Runs one IDLE command until new messages arrive or the refresh time passes.
+     *
+     * @return bool True if new messages arrived.
+     * @throws ImapException If IDLE fails or the connection is closed
+     */
+    bool idle();
+
+    /**
+     * @brief Processes complete untagged lines received while waiting for changes.
+     *
+     * @param tag Tag of the running command, its completion is checked and ends the processing.
+     * @param newMessages Set to true if EXISTS reports more messages than known after EXPUNGE and VANISHED.
+     * @return bool True if the tagged completion or a continuation request was processed.
+     * @throws ImapException On BYE or a failed command
+     */
+    bool processUntagged(const std::string &tag, bool &newMessages);
+
+    /**
+     * @brief Waits until data can be read from the connection.
+     *
+     * @param timeoutMs Maximum time to wait in milliseconds.
+     * @return bool True if data is available, false on timeout.
+     */
+    bool waitReadable(int timeoutMs);
+
+    /**
+     * @brief Searches the selected mailbox.
+     *
+     * Asks for an ESEARCH result if the server supports it.
+     *
+     * @param criteria Search criteria, e.g. ALL or MODSEQ 1201.
+     * @return UidSet UIDs of the matching messages.
+     * @throws ImapException If the SEARCH command fails
+     */
+    UidSet searchMessages(const std::string &criteria);
+
+    /**
+     * @brief Links messages already stored under their object ID instead of downloading them.
+     *
+     * Asks for EMAILID if the server supports OBJECTID, or for X-GM-MSGID on
+     * Gmail, and lets the FileHandler link the messages it knows.
+     *
+     * @param ids UIDs of the messages to download.
+     * @return std::vector<int> UIDs of the messages still to download.
+     * @throws ImapException If the FETCH command fails
+     */
+    std::vector<int> skipKnownMessages(const std::vector<int> &ids);
+
+    /**
+     * @brief Reuses messages retired after a UIDVALIDITY change instead of downloading them again.
+     *
+     * Asks for the RFC822.SIZE and Message-ID of the messages and lets the
+     * FileHandler move back the retired messages matching both.
+     *
+     * @param ids UIDs of the messages to download.
+     * @return std::vector<int> UIDs of the messages still to download.
+     * @throws ImapException If the FETCH command fails
+     */
+    std::vector<int> reuseRetiredMessages(const std::vector<int> &ids);
+
     /**
      * @brief Sends an IMAP command to the server.
      *
@@ -185,7 +404,8 @@ private:
      * @brief Receives complete IMAP server response.
      *
      * Collects response data until a complete tagged response is received.
-     * Handles both SSL and non-SSL connections.
+     * Line starts and literals are tracked across reads, so the size of the
+     * response is not limited. Handles both SSL and non-SSL connections.
      *
      * @return std::string The complete server response
      * @throws ImapException If response cannot be fully received
@@ -195,14 +415,70 @@ private:
     /**
      * @brief Low-level data receive operation with timeout.
      *
-     * Implements timeout handling and supports both SSL and non-SSL connections.
-     * Uses select() for timeout management.
+     * Reads into the connection-owned receive buffer and copies the data out.
+     * Supports both SSL and non-SSL connections.
      *
-     * @return std::string The received data
+     * @return std::string The received data, may contain NUL bytes
      * @throws ImapException On timeout, disconnection, or read errors
      */
     virtual std::string recvData();
 
+    /**
+     * @brief Low-level receive of raw bytes into the given buffer.
+     *
+     * The read times out after RECV_TIMEOUT_SECONDS using SO_RCVTIMEO, so no select()
+     * call is needed. Inside of an EventLoop the socket is non-blocking and the task
+     * is suspended until epoll reports data. Uses SSL_read_ex for SSL connections.
+     *
+     * @param buffer Buffer to receive the data into.
+     * @param size Size of the buffer.
+     * @return size_t Number of bytes received, always greater than zero
+     * @throws ImapException On timeout, disconnection, or read errors
+     */
+    virtual size_t recvRaw(char *buffer, size_t size);
+
+    /**
+     * @brief Receives bytes exactly as they arrive on the connection.
+     *
+     * recvRaw() decompresses through it while compression is active.
+     *
+     * @param buffer Buffer to receive the data into.
+     * @param size Size of the buffer.
+     * @return size_t Number of bytes received, always greater than zero
+     * @throws ImapException On timeout, disconnection, or read errors
+     */
+    size_t recvWire(char *buffer, size_t size);
+
+    /**
+     * @brief Writes bytes to the connection, compressing them while compression is active.
+     *
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     * @throws ImapException If the data could not be sent
+     */
+    void sendRaw(const char *data, size_t length);
+
+    /**
+     * @brief Suspends the task until the socket is ready inside of an event loop.
+     *
+     * @param events EPOLLIN or EPOLLOUT.
+     * @throws ImapException If the socket is not ready within RECV_TIMEOUT_SECONDS
+     */
+    void awaitSocket(uint32_t events);
+
+    /**
+     * @brief Waits without blocking other tasks of the event loop.
+     * @param seconds Time to wait.
+     */
+    void pause(int seconds);
+
+    /**
+     * @brief Negotiates COMPRESS DEFLATE (RFC 4978) if the server supports it.
+     *
+     * A refusal by the server is not an error, the connection stays uncompressed.
+     */
+    void enableCompression();
+
     /**
      * @brief Generates a unique tag for IMAP commands.
      *
@@ -231,10 +507,91 @@ private:
      */
     virtual std::string downloadMessage(int id);
 
+    /**
+     * @brief Downloads messages in batches while keeping multiple FETCH commands in flight.
+     *
+     * Splits the UIDs into batches of at most batchSize messages and downloads
+     * them over this connection with streamFromQueue().
+     *
+     * @param ids UIDs of the messages to download.
+     * @throws ImapException If a FETCH command fails
+     * @throws FileException If message saving operations fail
+     */
+    void streamMessages(const std::vector<int> &ids);
+
+    /**
+     * @brief Downloads the batches of a work queue over this connection.
+     *
+     * Each batch is fetched by one UID FETCH command with a sequence set. Keeps up
+     * to pipelineDepth commands sent ahead. Responses are read by a FetchStream,
+     * which pairs them with their UIDs and writes the message contents directly
+     * to files. Messages the server did not send are downloaded again one by one.
+     *
+     * @param queue Queue of UID batches.
+     * @param worker Index of the lane of this connection in the queue.
+     * @param saved Receives the UIDs of all saved messages.
+     * @throws ImapException If a FETCH command fails
+     * @throws FileException If message saving operations fail
+     */
+    void streamFromQueue(WorkQueue &queue, size_t worker, std::vector<int> &saved);
+
+    /**
+     * @brief Downloads messages over multiple connections at once.
+     *
+     * Opens up to connections - 1 additional authenticated connections, each
+     * selecting the mailbox, and shares the batches between them and this
+     * connection through a work-stealing queue. Messages of failed connections
+     * are downloaded again over this connection.
+     *
+     * @param ids UIDs of the messages to download.
+     * @throws ImapException If a FETCH command on this connection fails
+     * @throws FileException If message saving operations fail
+     */
+    void fetchMessagesParallel(const std::vector<int> &ids);
+
+    /**
+     * @brief Runs an additional download connection of a parallel download.
+     *
+     * Connects, logs in, selects the mailbox and downloads batches from the queue
+     * until no work is left.
+     *
+     * @param authData Authentication credentials.
+     * @param queue Queue of UID batches.
+     * @param worker Index of the lane of this connection in the queue.
+     * @param uidValidity Expected UIDVALIDITY of the mailbox.
+     * @param saved Receives the UIDs of all saved messages.
+     * @throws ImapException If the connection or a command fails
+     */
+    void runWorker(AuthData authData, WorkQueue &queue, size_t worker, int uidValidity, std::vector<int> &saved);
+
+    /**
+     * @brief Returns the FETCH data item requested for each message.
+     *
+     * @return std::string BODY.PEEK[HEADER] with -h,
+     *         (UID RFC822.SIZE INTERNALDATE FLAGS BODY.PEEK[HEADER.FIELDS (...)]) with -H,
+     *         BODY[] otherwise.
+     */
+    std::string fetchItem() const;
+
+    /**
+     * @brief Checks whether whole messages are downloaded, neither -h nor -H is set.
+     *
+     * @return true if messages are fetched with BODY[].
+     */
+    bool fullBody() const;
+
+    /**
+     * @brief Returns the tag of the synchronization state, independent of how the FETCH command is spelled.
+     *
+     * @return std::string BODY[] for whole messages, HEADER for -h, HEADER.FIELDS (...) for -H.
+     */
+    std::string syncMode() const;
+
     /**
      * @brief Outputs information to the user about fetched messages.
      *
-     * Provides a user-friendly message about the number of messages fetched.
+     * Provides a user-friendly message about the number of messages fetched,
+     * followed by the number of reused messages if there were any.
      *
      * @param messageCount The number of messages that were fetched.
      */
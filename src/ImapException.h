@@ -4,7 +4,7 @@
 
 #pragma once
 #include <string>
-#include <exception>
+#include <stdexcept>
 
 class ImapException : public std::runtime_error {
 public:
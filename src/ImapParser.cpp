@@ -4,15 +4,83 @@
 
 #include "ImapParser.h"
 #include "ImapException.h"
+#include "ImapTokenizer.h"
 #include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <strings.h>
 
+namespace {
+
+// Checks whether the line is a tagged response of one of our commands (A<number>)
+bool isTagged(const ImapLine &line) {
+    if (line.tokens.size() < 2 || line.tokens[0].type != ImapTokenType::Atom) {
+        return false;
+    }
+    const std::string &tag = line.tokens[0].value;
+    return tag.size() > 1 && tag[0] == 'A' && tag.find_first_not_of("0123456789", 1) == std::string::npos;
+}
+
+// Returns on the first tagged OK, throws on tagged NO or BAD
+void checkTaggedStatus(const std::vector<ImapLine> &lines, const std::string &error) {
+    for (const ImapLine &line : lines) {
+        if (!isTagged(line)) {
+            continue;
+        }
+        if (line.tokens[1].is("OK")) {
+            return;
+        } else if (line.tokens[1].is("NO") || line.tokens[1].is("BAD")) {
+            throw ImapException(error + ": " + line.text(2));
+        }
+    }
+
+    throw ImapException(error + ".");
+}
+
+// Extracts the UID and the first literal of an untagged FETCH response,
+// returns false if the line is not a FETCH response
+bool parseFetchLine(const ImapLine &line, int &uid, bool &hasBody, std::string &body) {
+    const std::vector<ImapToken> &tokens = line.tokens;
+    if (tokens.size() < 4 || !tokens[0].is("*") || !tokens[1].isNumber() ||
+        !tokens[2].is("FETCH") || tokens[3].type != ImapTokenType::ListOpen) {
+        return false;
+    }
+
+    uid = -1;
+    hasBody = false;
+    int depth = 1;
+
+    for (size_t i = 4; i < tokens.size() && depth > 0; i++) {
+        const ImapToken &token = tokens[i];
+        if (token.type == ImapTokenType::ListOpen) {
+            depth++;
+        } else if (token.type == ImapTokenType::ListClose) {
+            depth--;
+        } else if (depth == 1 && token.is("UID") && i + 1 < tokens.size() && tokens[i + 1].isNumber()) {
+            uid = std::stoi(tokens[i + 1].value);
+        } else if (token.type == ImapTokenType::Literal && !hasBody) {
+            body = token.value;
+            hasBody = true;
+        }
+    }
+
+    return true;
+}
+
+}
 
 int ImapParser::parseGreetingResponse(const std::string &response) {
-    if (std::regex_search(response, GREETING_OK)) {
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize(response);
+    if (lines.empty() || lines[0].tokens.size() < 2 || !lines[0].tokens[0].is("*")) {
+        throw ImapException("Failed to receive response from server.");
+    }
+
+    const ImapToken &status = lines[0].tokens[1];
+    if (status.is("OK")) {
         return 1;
-    } else if (std::regex_search(response, GREETING_PREAUTH)) {
+    } else if (status.is("PREAUTH")) {
         return 0;
-    } else if (std::regex_search(response, GREETING_BYE)) {
+    } else if (status.is("BYE")) {
         throw ImapException("Server refused connection.");
     } else {
         throw ImapException("Failed to receive response from server.");
@@ -20,124 +88,422 @@ int ImapParser::parseGreetingResponse(const std::string &response) {
 }
 
 void ImapParser::parseLoginResponse(const std::string &response) {
-    std::istringstream responseStream(response);
-    std::string line;
-    std::smatch match;
+    checkTaggedStatus(ImapTokenizer::tokenize(response), "Login failed");
+}
 
-    while (std::getline(responseStream, line)) {
-        if (std::regex_search(line, match, LOGIN_OK)) {
-            return;
-        } else if (std::regex_search(line, match, LOGIN_NO)) {
-            throw ImapException("Login failed: " + match[1].str());
-        } else if (std::regex_search(line, match, LOGIN_BAD)) {
-            throw ImapException("Login failed: " + match[1].str());
+void ImapParser::parseSelectResponse(const std::string &response) {
+    checkTaggedStatus(ImapTokenizer::tokenize(response), "Failed to select mailbox");
+}
+
+int ImapParser::parseUIDValidity(const std::string &response) {
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        for (size_t i = 0; i + 2 < tokens.size(); i++) {
+            if (tokens[i].type == ImapTokenType::SectionOpen && tokens[i + 1].is("UIDVALIDITY") &&
+                tokens[i + 2].isNumber()) {
+                return std::stoi(tokens[i + 2].value);
+            }
         }
     }
 
-    throw ImapException("Login failed.");
+    throw ImapException("Failed to obtain UIDVALIDITY.");
 }
 
-void ImapParser::parseSelectResponse(const std::string &response) {
-    std::istringstream responseStream(response);
-    std::string line;
-    std::smatch match;
+int ImapParser::parseExists(const std::string &response) {
+    int exists = -1;
 
-    while (std::getline(responseStream, line)) {
-        if (std::regex_search(line, match, SELECT_OK)) {
-            return;
-        } else if (std::regex_search(line, match, SELECT_NO)) {
-            throw ImapException("Failed to select mailbox: " + match[1].str());
-        } else if (std::regex_search(line, match, SELECT_BAD)) {
-            throw ImapException("Failed to select mailbox: " + match[1].str());
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() >= 3 && tokens[0].is("*") && tokens[1].isNumber() && tokens[2].is("EXISTS")) {
+            exists = std::stoi(tokens[1].value);
         }
     }
 
-    throw ImapException("Failed to select mailbox.");
+    return exists;
 }
 
-int ImapParser::parseUIDValidity(const std::string &response) {
-    std::istringstream responseStream(response);
-    std::string line;
-    std::smatch match;
-    std::regex uidValidityRegex(R"(OK \[UIDVALIDITY (\d+)\])");
+std::vector<int> ImapParser::parseSearchResponse(const std::string &response) {
+    std::vector<int> messageIds;
 
-    while (std::getline(responseStream, line)) {
-        if (std::regex_search(line, match, uidValidityRegex)) {
-            return std::stoi(match[1].str());
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() < 2 || !tokens[0].is("*") || !tokens[1].is("SEARCH")) {
+            continue;
+        }
+        for (size_t i = 2; i < tokens.size(); i++) {
+            // A trailing list holds data such as (MODSEQ 917162500), not UIDs
+            if (tokens[i].type == ImapTokenType::ListOpen) {
+                break;
+            }
+            if (tokens[i].isNumber()) {
+                messageIds.push_back(std::stoi(tokens[i].value));
+            }
         }
     }
-    
-    throw ImapException("Failed to obtain UIDVALIDITY.");
-}
 
+    return messageIds;
+}
 
+UidSet ImapParser::parseEsearchResponse(const std::string &response) {
+    UidSet uids;
 
-std::vector<int> ImapParser::parseSearchResponse(const std::string &response) {
-    std::vector<int> messageIds;
-    std::istringstream responseStream(response);
-    std::string line;
-
-    while (std::getline(responseStream, line)) {
-        if (line.find("* SEARCH") != std::string::npos) {
-            std::istringstream lineStream(line);
-            std::string search;
-            int id;
-            lineStream >> search >> search; // Skip "* SEARCH"
-            while (lineStream >> id) {
-                messageIds.push_back(id);
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        // * ESEARCH (TAG "A5") UID MIN 2 MAX 47 COUNT 4 ALL 2,10:11,47
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() < 2 || !tokens[0].is("*") || !tokens[1].is("ESEARCH")) {
+            continue;
+        }
+        for (size_t i = 2; i + 1 < tokens.size(); i++) {
+            if (tokens[i].is("ALL") && tokens[i + 1].type == ImapTokenType::Atom) {
+                UidSet matched = parseSequenceSet(tokens[i + 1].value);
+                for (const auto &range : matched.ranges()) {
+                    uids.addRange(range.first, range.second);
+                }
             }
         }
     }
 
-    return messageIds;
+    return uids;
 }
 
 std::string ImapParser::parseFetchResponse(const std::string &response) {
-    std::istringstream responseStream(response);
-    std::string line;
-    std::smatch match;
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize(response);
 
-    while (std::getline(responseStream, line)) {
-        if (std::regex_search(line, match, FETCH_OK)) {
+    for (const ImapLine &line : lines) {
+        if (!isTagged(line)) {
+            continue;
+        }
 
-            std::smatch match;
+        if (line.tokens[1].is("OK")) {
+            int uid;
+            bool hasBody;
+            std::string body;
+            for (const ImapLine &fetchLine : lines) {
+                if (parseFetchLine(fetchLine, uid, hasBody, body) && hasBody) {
+                    return body;
+                }
+            }
+            throw ImapException("Failed to download email: unknown server response.");
+        } else if (line.tokens[1].is("NO") || line.tokens[1].is("BAD")) {
+            throw ImapException("Failed to download email: " + line.text(2));
+        }
+    }
 
-            if (std::regex_search(response, match, FETCH_MESSAGE)) {
-                // Extract the message size
-                size_t message_size = std::stoul(match[1].str());
+    throw ImapException("Failed to parse server response.");
+}
 
-                // Find where the message content starts
-                size_t message_start = match.position(0) + match.length(0);
+std::vector<std::pair<int, std::string>> ImapParser::parseFetchResponses(const std::string &response) {
+    std::vector<std::pair<int, std::string>> messages;
 
-                // Ensure we have enough data
-                if (response.size() < message_start + message_size) {
-                    throw ImapException("Failed to download email: data missing.");
-                }
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        int uid;
+        bool hasBody;
+        std::string body;
+        if (parseFetchLine(line, uid, hasBody, body) && hasBody && uid >= 0) {
+            messages.emplace_back(uid, std::move(body));
+        }
+    }
 
-                // Extract the message content
-                std::string message_content = response.substr(message_start, message_size);
-                return message_content;
-            }
-            else{
-                throw ImapException("Failed to download email: unknown server response.");
-            }
-        } 
-        else if (std::regex_search(line, match, FETCH_NO)) {
-            throw ImapException("Failed to download email: " + match[1].str());
-        } 
-        else if (std::regex_search(line, match, FETCH_BAD)) {
-            throw ImapException("Failed to download email: " + match[1].str());
+    return messages;
+}
+
+void ImapParser::parseTaggedStatus(const std::string &response, const std::string &tag) {
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        if (line.tokens.empty() || line.tokens[0].type != ImapTokenType::Atom || line.tokens[0].value != tag) {
+            continue;
         }
+        if (line.tokens.size() > 1 && line.tokens[1].is("OK")) {
+            return;
+        }
+        throw ImapException("Command " + tag + " failed: " + line.text(1));
     }
 
     throw ImapException("Failed to parse server response.");
 }
 
 bool ImapParser::checkResponseReceived(const std::string &response, const std::string &tag) {
-    std::smatch match;
-    if (std::regex_search(response, match, RESPONSE_TAG_REGEX)) {
-        std::string found_tag = match[1].str();
-        return tag.find(found_tag) != std::string::npos;
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        if (!isTagged(line)) {
+            continue;
+        }
+        const ImapToken &status = line.tokens[1];
+        if (status.is("OK") || status.is("BAD") || status.is("NO") || status.is("PREAUTH") || status.is("BYE")) {
+            return line.tokens[0].value == tag;
+        }
     }
     return false;
 }
+
+std::string ImapParser::formatSequenceSet(const std::vector<int> &ids) {
+    std::ostringstream set;
+    size_t i = 0;
+
+    while (i < ids.size()) {
+        // Extend the range while the UIDs are consecutive
+        size_t j = i;
+        while (j + 1 < ids.size() && ids[j + 1] == ids[j] + 1) {
+            j++;
+        }
+
+        if (i != 0) {
+            set << ",";
+        }
+        set << ids[i];
+        if (j != i) {
+            set << ":" << ids[j];
+        }
+        i = j + 1;
+    }
+
+    return set.str();
+}
+
+std::vector<ListedMailbox> ImapParser::parseListResponse(const std::string &response) {
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize(response);
+    checkTaggedStatus(lines, "Failed to list mailboxes");
+
+    std::vector<ListedMailbox> mailboxes;
+    for (const ImapLine &line : lines) {
+        // * LIST (<flags>) <delimiter> <name>
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() < 5 || !tokens[0].is("*") || !tokens[1].is("LIST") ||
+            tokens[2].type != ImapTokenType::ListOpen) {
+            continue;
+        }
+
+        bool selectable = true;
+        size_t i = 3;
+        for (; i < tokens.size() && tokens[i].type != ImapTokenType::ListClose; i++) {
+            if (tokens[i].is("\\Noselect") || tokens[i].is("\\NonExistent")) {
+                selectable = false;
+            }
+        }
+        // Skip the closing parenthesis, the hierarchy delimiter is a quoted character or NIL
+        i += 2;
+        if (!selectable || i >= tokens.size()) {
+            continue;
+        }
+        const ImapToken &delimiter = tokens[i - 1];
+        mailboxes.push_back({tokens[i].value, delimiter.type == ImapTokenType::Quoted ? delimiter.value : ""});
+    }
+
+    return mailboxes;
+}
+
+std::string ImapParser::formatMailboxName(const std::string &mailbox) {
+    bool atom = !mailbox.empty();
+    for (char c : mailbox) {
+        if (c <= ' ' || c == '(' || c == ')' || c == '{' || c == '"' || c == '\\' ||
+            c == '%' || c == '*' || c == ']' || c == 0x7f) {
+            atom = false;
+            break;
+        }
+    }
+    if (atom) {
+        return mailbox;
+    }
+
+    std::string quoted = "\"";
+    for (char c : mailbox) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::vector<std::string> ImapParser::parseCapabilities(const std::string &response) {
+    std::vector<std::string> capabilities;
+
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            bool untagged = i == 1 && tokens[0].is("*") && tokens[i].is("CAPABILITY");
+            bool code = i > 0 && tokens[i - 1].type == ImapTokenType::SectionOpen && tokens[i].is("CAPABILITY");
+            if (!untagged && !code) {
+                continue;
+            }
+            for (size_t j = i + 1; j < tokens.size() && tokens[j].type == ImapTokenType::Atom; j++) {
+                std::string capability = tokens[j].value;
+                for (char &c : capability) {
+                    c = std::toupper(static_cast<unsigned char>(c));
+                }
+                capabilities.push_back(capability);
+            }
+            break;
+        }
+    }
+
+    return capabilities;
+}
+
+uint64_t ImapParser::parseHighestModSeq(const std::string &response) {
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        const std::vector<ImapToken> &tokens = line.tokens;
+        for (size_t i = 0; i + 2 < tokens.size(); i++) {
+            if (tokens[i].type == ImapTokenType::SectionOpen && tokens[i + 1].is("HIGHESTMODSEQ") &&
+                tokens[i + 2].isNumber()) {
+                return std::stoull(tokens[i + 2].value);
+            }
+        }
+    }
+
+    return 0;
+}
+
+std::vector<int> ImapParser::parseFetchUids(const std::string &response) {
+    std::vector<int> uids;
+
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        int uid;
+        bool hasBody;
+        std::string body;
+        if (parseFetchLine(line, uid, hasBody, body) && uid >= 0) {
+            uids.push_back(uid);
+        }
+    }
+
+    return uids;
+}
+
+std::map<int, std::string> ImapParser::parseFetchValues(const std::string &response, const std::string &item) {
+    std::map<int, std::string> values;
+
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        // * 5 FETCH (UID 12 EMAILID (M6d99ac3275bb4e))
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() < 4 || !tokens[0].is("*") || !tokens[2].is("FETCH") || tokens[3].type != ImapTokenType::ListOpen) {
+            continue;
+        }
+        int uid = -1;
+        std::string found;
+        for (size_t i = 4; i + 1 < tokens.size(); i++) {
+            if (tokens[i].is("UID") && tokens[i + 1].isNumber()) {
+                uid = std::stoi(tokens[i + 1].value);
+            } else if (tokens[i].is(item.c_str())) {
+                bool list = tokens[i + 1].type == ImapTokenType::ListOpen && i + 2 < tokens.size();
+                const ImapToken &value = list ? tokens[i + 2] : tokens[i + 1];
+                if (value.type == ImapTokenType::Atom || value.type == ImapTokenType::Quoted) {
+                    found = value.value;
+                }
+            }
+        }
+        if (uid >= 0 && !found.empty()) {
+            values[uid] = found;
+        }
+    }
+
+    return values;
+}
+
+std::string ImapParser::mailboxDirectory(const std::string &name, const std::string &delimiter) {
+    std::vector<std::string> levels;
+    if (delimiter.empty()) {
+        levels.push_back(name);
+    } else {
+        size_t start = 0;
+        size_t end;
+        while ((end = name.find(delimiter, start)) != std::string::npos) {
+            levels.push_back(name.substr(start, end - start));
+            start = end + delimiter.size();
+        }
+        levels.push_back(name.substr(start));
+    }
+
+    std::string directory;
+    for (const std::string &level : levels) {
+        // A slash inside of a level would split it into two directories
+        if (level.empty() || level[0] == '.' || level.find('/') != std::string::npos) {
+            throw ImapException("Mailbox name cannot be stored: " + name);
+        }
+        directory += (directory.empty() ? "" : "/") + level;
+    }
+    return directory;
+}
+
+std::string ImapParser::parseHeaderField(const std::string &header, const std::string &name) {
+    std::string value;
+    bool inField = false;
+    size_t start = 0;
+    while (start < header.size()) {
+        size_t end = header.find('\n', start);
+        end = end == std::string::npos ? header.size() : end;
+        std::string line = header.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break; // End of the header
+        }
+
+        // Folded lines continue the previous field
+        if (line[0] == ' ' || line[0] == '\t') {
+            if (inField) {
+                value += line;
+            }
+            continue;
+        }
+        if (inField) {
+            break;
+        }
+        size_t colon = line.find(':');
+        inField = colon == name.size() && strncasecmp(line.c_str(), name.c_str(), colon) == 0;
+        if (inField) {
+            value = line.substr(colon + 1);
+        }
+    }
+
+    size_t first = value.find_first_not_of(" \t");
+    size_t last = value.find_last_not_of(" \t");
+    return first == std::string::npos ? "" : value.substr(first, last - first + 1);
+}
+
+UidSet ImapParser::parseVanished(const std::string &response) {
+    UidSet vanished;
+
+    for (const ImapLine &line : ImapTokenizer::tokenize(response)) {
+        // * VANISHED [(EARLIER)] <sequence set>
+        const std::vector<ImapToken> &tokens = line.tokens;
+        if (tokens.size() < 3 || !tokens[0].is("*") || !tokens[1].is("VANISHED")) {
+            continue;
+        }
+        const ImapToken &set = tokens.back();
+        if (set.type != ImapTokenType::Atom) {
+            continue;
+        }
+        UidSet uids = parseSequenceSet(set.value);
+        for (const auto &range : uids.ranges()) {
+            vanished.addRange(range.first, range.second);
+        }
+    }
+
+    return vanished;
+}
+
+UidSet ImapParser::parseSequenceSet(const std::string &sequenceSet) {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    std::istringstream stream(sequenceSet);
+    std::string part;
+
+    while (std::getline(stream, part, ',')) {
+        size_t colon = part.find(':');
+        std::string first = part.substr(0, colon);
+        std::string last = colon == std::string::npos ? first : part.substr(colon + 1);
+        if (first.empty() || last.empty() || first.find_first_not_of("0123456789") != std::string::npos ||
+            last.find_first_not_of("0123456789") != std::string::npos) {
+            throw ImapException("Invalid sequence set: " + sequenceSet);
+        }
+        uint32_t a = std::stoul(first);
+        uint32_t b = std::stoul(last);
+        ranges.emplace_back(std::min(a, b), std::max(a, b));
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+    UidSet uids;
+    for (const auto &range : ranges) {
+        uids.addRange(range.first, range.second);
+    }
+    return uids;
+}
@@ -5,14 +5,28 @@
 #ifndef IMAPPARSER_H
 #define IMAPPARSER_H
 
+#include <map>
 #include <string>
-#include <regex>
+#include <vector>
+#include <cstdint>
+
+#include "UidSet.h"
 #include <iostream>
-#include "ImapResponseRegex.h"
+
+/**
+ * @struct ListedMailbox
+ * @brief A selectable mailbox returned by LIST.
+ */
+struct ListedMailbox {
+    std::string name; ///< Name of the mailbox on the server
+    std::string delimiter; ///< Hierarchy delimiter, empty if the server has no hierarchy (NIL)
+};
 
 /**
  * @class ImapParser
  * @brief A class for parsing IMAP server responses.
+ *
+ * All responses are read by ImapTokenizer, no regular expressions are used.
  */
 class ImapParser {
 public:
@@ -42,6 +56,13 @@ public:
      */
     static int parseUIDValidity(const std::string &response);
 
+    /**
+     * @brief Parses the number of messages from the EXISTS response.
+     * @param response The response string from the server.
+     * @return int The last reported number of messages, -1 if there is none.
+     */
+    static int parseExists(const std::string &response);
+
     /**
      * @brief Parses the search response from the IMAP server to retrieve message IDs.
      * @param response The response string from the server.
@@ -49,6 +70,13 @@ public:
      */
     static std::vector<int> parseSearchResponse(const std::string &response);
 
+    /**
+     * @brief Parses the ESEARCH response to UID SEARCH RETURN (... ALL).
+     * @param response The response string from the server.
+     * @return UidSet The UIDs of the matching messages, received as compact ranges.
+     */
+    static UidSet parseEsearchResponse(const std::string &response);
+
     /**
      * @brief Parses the fetch response from the IMAP server to retrieve an email's contents.
      * @param response The response string from the server.
@@ -56,6 +84,20 @@ public:
      */
     static std::string parseFetchResponse(const std::string &response);
 
+    /**
+     * @brief Parses all untagged FETCH responses and pairs the message contents with their UIDs.
+     * @param response The response string from the server, may contain responses to multiple commands.
+     * @return std::vector<std::pair<int, std::string>> UID and content of every message found.
+     */
+    static std::vector<std::pair<int, std::string>> parseFetchResponses(const std::string &response);
+
+    /**
+     * @brief Checks the tagged completion of a command and throws if the command failed.
+     * @param response The response string from the server.
+     * @param tag The tag of the command.
+     */
+    static void parseTaggedStatus(const std::string &response, const std::string &tag);
+
     /**
      * @brief Checks if the response received contains the specified tag.
      * @param response The response string from the server.
@@ -63,6 +105,102 @@ public:
      * @return bool Returns true if the tag is found, otherwise false.
      */
     static bool checkResponseReceived(const std::string &response, const std::string &tag);
+
+    /**
+     * @brief Compresses message UIDs into an IMAP sequence set, e.g. 1:500,502,510:900.
+     * @param ids UIDs in ascending order.
+     * @return std::string The sequence set covering exactly the given UIDs.
+     */
+    static std::string formatSequenceSet(const std::vector<int> &ids);
+
+    /**
+     * @brief Parses the LIST response and returns the selectable mailboxes.
+     *
+     * Mailboxes flagged \Noselect or \NonExistent are skipped.
+     *
+     * @param response The response string from the server.
+     * @return std::vector<ListedMailbox> Mailboxes in the order sent by the server.
+     * @throws ImapException If the LIST command failed
+     */
+    static std::vector<ListedMailbox> parseListResponse(const std::string &response);
+
+    /**
+     * @brief Maps a mailbox name to its directory below the account directory.
+     *
+     * Every level of the hierarchy becomes a subdirectory. Levels that are
+     * empty or start with a dot are rejected, so a name never leaves the
+     * account directory or collides with directories like .retired.
+     *
+     * @param name The mailbox name.
+     * @param delimiter The hierarchy delimiter of the server, empty for none.
+     * @return std::string The relative directory, e.g. INBOX/Sent for INBOX.Sent with delimiter ".".
+     * @throws ImapException If the name cannot be stored safely
+     */
+    static std::string mailboxDirectory(const std::string &name, const std::string &delimiter);
+
+    /**
+     * @brief Formats a mailbox name as a command argument, quoting it when it is not a valid atom.
+     * @param mailbox The mailbox name.
+     * @return std::string The name ready to be sent, e.g. INBOX or "Sent Items".
+     */
+    static std::string formatMailboxName(const std::string &mailbox);
+
+    /**
+     * @brief Parses the capabilities announced by the server.
+     *
+     * Reads both the untagged CAPABILITY response and the CAPABILITY response code.
+     *
+     * @param response The response string from the server.
+     * @return std::vector<std::string> The capabilities in upper case, empty if none were announced.
+     */
+    static std::vector<std::string> parseCapabilities(const std::string &response);
+
+    /**
+     * @brief Parses the HIGHESTMODSEQ response code of the select response.
+     * @param response The response string from the server.
+     * @return uint64_t The highest mod-sequence, 0 if the mailbox does not support it.
+     */
+    static uint64_t parseHighestModSeq(const std::string &response);
+
+    /**
+     * @brief Parses the UIDs of all untagged FETCH responses.
+     * @param response The response string from the server.
+     * @return std::vector<int> The UIDs in the order they were received.
+     */
+    static std::vector<int> parseFetchUids(const std::string &response);
+
+    /**
+     * @brief Parses a single-valued item of untagged FETCH responses, e.g. an object ID or RFC822.SIZE.
+     *
+     * Accepts both plain values and values in parentheses like EMAILID (OBJECTID).
+     *
+     * @param response The response string from the server.
+     * @param item The FETCH item, e.g. EMAILID.
+     * @return std::map<int, std::string> The values by UID.
+     */
+    static std::map<int, std::string> parseFetchValues(const std::string &response, const std::string &item);
+
+    /**
+     * @brief Returns the unfolded value of a header field, empty if the header lacks it.
+     * @param header The message header.
+     * @param name The field name, compared ignoring case.
+     */
+    static std::string parseHeaderField(const std::string &header, const std::string &name);
+
+    /**
+     * @brief Parses the UIDs reported by VANISHED responses.
+     * @param response The response string from the server.
+     * @return UidSet The expunged UIDs.
+     */
+    static UidSet parseVanished(const std::string &response);
+
+    /**
+     * @brief Parses an IMAP sequence set of UIDs, e.g. 1:500,502.
+     * @param sequenceSet The sequence set, * is not allowed.
+     * @return UidSet The UIDs of the set.
+     * @throws ImapException If the sequence set is malformed
+     */
+    static UidSet parseSequenceSet(const std::string &sequenceSet);
 };
 
 #endif // IMAPPARSER_H
\ No newline at end of file
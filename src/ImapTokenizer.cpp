@@ -0,0 +1,312 @@
+// ImapTokenizer.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "ImapTokenizer.h"
+#include <algorithm>
+#include <strings.h>
+
+bool ImapToken::is(const char *keyword) const {
+    return type == ImapTokenType::Atom && strcasecmp(value.c_str(), keyword) == 0;
+}
+
+bool ImapToken::isNumber() const {
+    return type == ImapTokenType::Atom && !value.empty() &&
+           value.find_first_not_of("0123456789") == std::string::npos;
+}
+
+std::string ImapLine::text(size_t from) const {
+    std::string text;
+
+    for (size_t i = from; i < tokens.size(); i++) {
+        const ImapToken &token = tokens[i];
+        if (i != from && token.spaceBefore) {
+            text += ' ';
+        }
+        switch (token.type) {
+        case ImapTokenType::Atom:
+            text += token.value;
+            break;
+        case ImapTokenType::Quoted:
+            text += '"' + token.value + '"';
+            break;
+        case ImapTokenType::Literal:
+            text += '{' + std::to_string(token.literalSize) + '}';
+            break;
+        case ImapTokenType::ListOpen:
+            text += '(';
+            break;
+        case ImapTokenType::ListClose:
+            text += ')';
+            break;
+        case ImapTokenType::SectionOpen:
+            text += '[';
+            break;
+        case ImapTokenType::SectionClose:
+            text += ']';
+            break;
+        default:
+            break;
+        }
+    }
+
+    return text;
+}
+
+ImapTokenizer::ImapTokenizer(ImapTokenHandler &handler) : handler_(handler) {}
+
+size_t ImapTokenizer::consumed() const {
+    return consumed_;
+}
+
+void ImapTokenizer::feed(const char *data, size_t length) {
+    const char *end = data + length;
+
+    while (data < end) {
+        if (state_ == State::LiteralData) {
+            // Literal data is passed on in place, as large as it arrived
+            size_t chunk = std::min(static_cast<size_t>(end - data), literalRemaining_);
+            handler_.onLiteralData(data, chunk);
+            data += chunk;
+            consumed_ += chunk;
+            literalRemaining_ -= chunk;
+            if (literalRemaining_ == 0) {
+                state_ = State::Between;
+                handler_.onLiteralEnd();
+            }
+            continue;
+        }
+
+        char c = *data++;
+        consumed_++;
+
+        switch (state_) {
+        case State::Between:
+            startToken(c);
+            break;
+
+        case State::Atom:
+            if (c == ' ' || c == '(' || c == ')' || c == '[' || c == ']' ||
+                c == '"' || c == '{' || c == '\r' || c == '\n') {
+                emit();
+                startToken(c);
+            } else {
+                token_.value += c;
+            }
+            break;
+
+        case State::Quoted:
+            if (c == '\\') {
+                state_ = State::QuotedEscape;
+            } else if (c == '"') {
+                emit();
+            } else if (c == '\n') {
+                // Unterminated quoted string, the line ends anyway
+                emit();
+                emitSimple(ImapTokenType::LineEnd);
+            } else if (c != '\r') {
+                token_.value += c;
+            }
+            break;
+
+        case State::QuotedEscape:
+            token_.value += c;
+            state_ = State::Quoted;
+            break;
+
+        case State::LiteralSize:
+            if (c >= '0' && c <= '9' && token_.value.size() < 18) {
+                token_.value += c;
+            } else if (c == '}' && !token_.value.empty()) {
+                state_ = State::LiteralCrlf;
+            } else if (c != '+') {
+                // Not a literal, e.g. a brace in human readable text
+                token_.type = ImapTokenType::Atom;
+                token_.value = "{" + token_.value;
+                state_ = State::Atom;
+                data--;
+                consumed_--;
+            }
+            break;
+
+        case State::LiteralCrlf:
+            if (c == '\r') {
+                break;
+            }
+            if (c != '\n') {
+                token_.type = ImapTokenType::Atom;
+                token_.value = "{" + token_.value + "}";
+                state_ = State::Atom;
+                data--;
+                consumed_--;
+                break;
+            }
+            token_.literalSize = std::stoull(token_.value);
+            token_.value.clear();
+            literalRemaining_ = token_.literalSize;
+            emit();
+            if (literalRemaining_ > 0) {
+                state_ = State::LiteralData;
+            } else {
+                handler_.onLiteralEnd();
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+void ImapTokenizer::startToken(char c) {
+    switch (c) {
+    case ' ':
+        spaceBefore_ = true;
+        break;
+    case '\r':
+        break;
+    case '\n':
+        emitSimple(ImapTokenType::LineEnd);
+        break;
+    case '(':
+        emitSimple(ImapTokenType::ListOpen);
+        break;
+    case ')':
+        emitSimple(ImapTokenType::ListClose);
+        break;
+    case '[':
+        emitSimple(ImapTokenType::SectionOpen);
+        break;
+    case ']':
+        emitSimple(ImapTokenType::SectionClose);
+        break;
+    case '"':
+        token_.type = ImapTokenType::Quoted;
+        state_ = State::Quoted;
+        break;
+    case '{':
+        token_.type = ImapTokenType::Literal;
+        state_ = State::LiteralSize;
+        break;
+    default:
+        token_.type = ImapTokenType::Atom;
+        token_.value += c;
+        state_ = State::Atom;
+        break;
+    }
+}
+
+void ImapTokenizer::emit() {
+    token_.spaceBefore = spaceBefore_;
+    handler_.onToken(token_);
+
+    token_ = ImapToken{};
+    spaceBefore_ = false;
+    state_ = State::Between;
+}
+
+void ImapTokenizer::emitSimple(ImapTokenType type) {
+    ImapToken token{};
+    token.type = type;
+    token.spaceBefore = spaceBefore_;
+    handler_.onToken(token);
+    spaceBefore_ = false;
+}
+
+namespace {
+
+/**
+ * @brief Collects the tokens of complete lines for ImapTokenizer::tokenize().
+ */
+class LineCollector : public ImapTokenHandler {
+public:
+    std::vector<ImapLine> lines;
+    ImapLine current;
+    const ImapTokenizer *tokenizer = nullptr;
+
+    void onToken(const ImapToken &token) override {
+        if (token.type == ImapTokenType::LineEnd) {
+            current.end = tokenizer->consumed();
+            lines.push_back(std::move(current));
+            current = ImapLine{};
+        } else {
+            current.tokens.push_back(token);
+        }
+    }
+
+    void onLiteralData(const char *data, size_t length) override {
+        current.tokens.back().value.append(data, length);
+    }
+};
+
+}
+
+std::vector<ImapLine> ImapTokenizer::tokenize(const std::string &response) {
+    LineCollector collector;
+    ImapTokenizer tokenizer(collector);
+    collector.tokenizer = &tokenizer;
+
+    tokenizer.feed(response.data(), response.size());
+    return std::move(collector.lines);
+}
+
+TaggedCompletionScanner::TaggedCompletionScanner(const std::string &tag) : tag_(tag), tokenizer_(*this) {}
+
+void TaggedCompletionScanner::feed(const char *data, size_t length) {
+    if (!complete_) {
+        tokenizer_.feed(data, length);
+    }
+}
+
+bool TaggedCompletionScanner::isComplete() const {
+    return complete_;
+}
+
+void TaggedCompletionScanner::onToken(const ImapToken &token) {
+    if (complete_) {
+        return;
+    }
+    if (token.type == ImapTokenType::LineEnd) {
+        complete_ = statusMatched_;
+        lineTokens_ = 0;
+        tagMatched_ = false;
+        statusMatched_ = false;
+        return;
+    }
+
+    lineTokens_++;
+    if (lineTokens_ == 1) {
+        tagMatched_ = token.type == ImapTokenType::Atom && token.value == tag_;
+    } else if (lineTokens_ == 2 && tagMatched_) {
+        statusMatched_ = token.is("OK") || token.is("NO") || token.is("BAD");
+    }
+}
+
+ImapLineReader::ImapLineReader() : tokenizer_(*this) {}
+
+void ImapLineReader::feed(const char *data, size_t length) {
+    tokenizer_.feed(data, length);
+}
+
+bool ImapLineReader::next(ImapLine &line) {
+    if (lines_.empty()) {
+        return false;
+    }
+    line = std::move(lines_.front());
+    lines_.pop_front();
+    return true;
+}
+
+void ImapLineReader::onToken(const ImapToken &token) {
+    if (token.type == ImapTokenType::LineEnd) {
+        current_.end = tokenizer_.consumed();
+        lines_.push_back(std::move(current_));
+        current_ = ImapLine{};
+    } else {
+        current_.tokens.push_back(token);
+    }
+}
+
+void ImapLineReader::onLiteralData(const char *data, size_t length) {
+    current_.tokens.back().value.append(data, length);
+}
@@ -0,0 +1,249 @@
+// ImapTokenizer.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef IMAPTOKENIZER_H
+#define IMAPTOKENIZER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Types of tokens found in IMAP server responses.
+ */
+enum class ImapTokenType {
+    Atom,         ///< Atom, number or flag, e.g. FETCH, 42, \Seen
+    Quoted,       ///< Quoted string, value is unescaped
+    Literal,      ///< {N} literal, value contains the data only when collected by tokenize()
+    ListOpen,     ///< (
+    ListClose,    ///< )
+    SectionOpen,  ///< [
+    SectionClose, ///< ]
+    LineEnd       ///< End of a response line (CRLF outside of a literal)
+};
+
+/**
+ * @struct ImapToken
+ * @brief A single token of an IMAP response.
+ */
+struct ImapToken {
+    ImapTokenType type; ///< Type of the token
+    std::string value; ///< Text of atoms and quoted strings
+    size_t literalSize = 0; ///< Announced size of a literal
+    bool spaceBefore = false; ///< True if the token was preceded by a space
+
+    /**
+     * @brief Checks whether the token is an atom equal to the keyword, ignoring case.
+     * @param keyword The keyword to compare with.
+     * @return bool True if the token matches.
+     */
+    bool is(const char *keyword) const;
+
+    /**
+     * @brief Checks whether the token is an atom consisting of digits only.
+     * @return bool True if the token is a number.
+     */
+    bool isNumber() const;
+};
+
+/**
+ * @struct ImapLine
+ * @brief Tokens of one complete response line, literals included.
+ */
+struct ImapLine {
+    std::vector<ImapToken> tokens; ///< Tokens of the line without the LineEnd token
+    size_t end = 0; ///< Offset just past the line in the tokenized data
+
+    /**
+     * @brief Reconstructs the text of the line starting at the given token.
+     * @param from Index of the first token.
+     * @return std::string The text, e.g. "[READ-WRITE] Select completed".
+     */
+    std::string text(size_t from) const;
+};
+
+/**
+ * @class ImapTokenHandler
+ * @brief Receiver of the tokens produced by ImapTokenizer.
+ */
+class ImapTokenHandler {
+public:
+    virtual ~ImapTokenHandler() = default;
+
+    /**
+     * @brief Called for every complete token.
+     *
+     * A Literal token is reported once its {N} header is received, its data
+     * follows through onLiteralData() and onLiteralEnd().
+     *
+     * @param token The token.
+     */
+    virtual void onToken(const ImapToken &token) = 0;
+
+    /**
+     * @brief Called with the next part of the literal being received.
+     * @param data Pointer into the data passed to ImapTokenizer::feed().
+     * @param length Number of bytes.
+     */
+    virtual void onLiteralData(const char *data, size_t length) = 0;
+
+    /**
+     * @brief Called when all bytes of the literal were received.
+     */
+    virtual void onLiteralEnd() {}
+};
+
+/**
+ * @class ImapTokenizer
+ * @brief Resumable RFC 3501 tokenizer of IMAP server responses.
+ *
+ * Consumes the received data in arbitrary parts and never looks at a byte twice.
+ * Literal data is handed over to the handler in place, without being copied.
+ */
+class ImapTokenizer {
+public:
+    /**
+     * @brief Constructs a tokenizer reporting to the given handler.
+     * @param handler Receiver of the tokens.
+     */
+    ImapTokenizer(ImapTokenHandler &handler);
+
+    /**
+     * @brief Consumes the next part of the data received from the server.
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Returns the total number of bytes consumed so far.
+     */
+    size_t consumed() const;
+
+    /**
+     * @brief Tokenizes complete response lines of the given data.
+     *
+     * Literal data is stored in the value of Literal tokens. An incomplete
+     * last line is not returned.
+     *
+     * @param response The data received from the server.
+     * @return std::vector<ImapLine> The complete lines.
+     */
+    static std::vector<ImapLine> tokenize(const std::string &response);
+
+private:
+    enum class State {
+        Between,       ///< Between tokens
+        Atom,          ///< Inside of an atom
+        Quoted,        ///< Inside of a quoted string
+        QuotedEscape,  ///< After a backslash in a quoted string
+        LiteralSize,   ///< Inside of the {N} header
+        LiteralCrlf,   ///< After the {N} header, before the data
+        LiteralData    ///< Inside of the literal data
+    };
+
+    ImapTokenHandler &handler_;
+    State state_ = State::Between;
+    ImapToken token_; ///< Token being collected
+    bool spaceBefore_ = false; ///< True if a space was seen since the last token
+    size_t literalRemaining_ = 0; ///< Bytes of the current literal not received yet
+    size_t consumed_ = 0; ///< Total number of bytes consumed
+
+    /**
+     * @brief Emits the collected token and starts a new one.
+     */
+    void emit();
+
+    /**
+     * @brief Emits a token without a value.
+     * @param type Type of the token.
+     */
+    void emitSimple(ImapTokenType type);
+
+    /**
+     * @brief Processes a character outside of any token.
+     * @param c The character.
+     */
+    void startToken(char c);
+};
+
+/**
+ * @class TaggedCompletionScanner
+ * @brief Detects the tagged completion of a command in data received in arbitrary parts.
+ *
+ * Tracks line starts and literals in a single forward pass, so the tag split
+ * between two reads is still found and text inside of a message body is never
+ * mistaken for the completion.
+ */
+class TaggedCompletionScanner : private ImapTokenHandler {
+public:
+    /**
+     * @brief Constructs a scanner waiting for the given tag.
+     * @param tag The tag of the command, e.g. A12.
+     */
+    TaggedCompletionScanner(const std::string &tag);
+
+    /**
+     * @brief Consumes the next part of the data received from the server.
+     *
+     * Data following the completion line is ignored.
+     *
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Checks whether the completion line was received completely.
+     * @return bool True if the command completed.
+     */
+    bool isComplete() const;
+
+private:
+    std::string tag_;
+    ImapTokenizer tokenizer_;
+    size_t lineTokens_ = 0; ///< Number of tokens in the current line so far
+    bool tagMatched_ = false; ///< True if the current line starts with the tag
+    bool statusMatched_ = false; ///< True if the tag is followed by OK, NO or BAD
+    bool complete_ = false;
+
+    void onToken(const ImapToken &token) override;
+    void onLiteralData(const char *, size_t) override {}
+};
+
+/**
+ * @class ImapLineReader
+ * @brief Collects complete response lines from data received in arbitrary parts.
+ *
+ * Every byte is tokenized once, complete lines wait until they are taken, so
+ * a long burst of untagged responses is never scanned again from its start.
+ */
+class ImapLineReader : private ImapTokenHandler {
+public:
+    ImapLineReader();
+
+    /**
+     * @brief Consumes the next part of the data received from the server.
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Takes the oldest complete line.
+     * @param line Receives the line, literal data is stored in the value of Literal tokens.
+     * @return bool True if a line was taken, false if no complete line is waiting.
+     */
+    bool next(ImapLine &line);
+
+private:
+    ImapTokenizer tokenizer_;
+    std::deque<ImapLine> lines_; ///< Complete lines not taken yet
+    ImapLine current_; ///< Line being received
+
+    void onToken(const ImapToken &token) override;
+    void onLiteralData(const char *data, size_t length) override;
+};
+
+#endif // IMAPTOKENIZER_H
@@ -0,0 +1,237 @@
+// MailboxIndex.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "MailboxIndex.h"
+#include "FileException.h"
+#include "FileIo.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char MailboxIndex::MAGIC[8] = {'I', 'M', 'A', 'P', 'I', 'D', 'X', '1'};
+
+void BodyDetector::feed(const char *data, size_t length) {
+    for (size_t i = 0; i < length && !hasBody_; i++) {
+        char c = data[i];
+        if (c == '\n') {
+            seenBlank_ = seenBlank_ || lineEmpty_;
+            lineEmpty_ = true;
+        } else if (c != '\r') {
+            lineEmpty_ = false;
+            hasBody_ = seenBlank_;
+        }
+    }
+}
+
+int BodyDetector::kind() const {
+    return hasBody_ ? MailboxIndex::FULL : MailboxIndex::HEADERS_ONLY;
+}
+
+MailboxIndex::MailboxIndex(const std::string &dirPath)
+    : dirPath_(dirPath), indexPath_(dirPath + "/.index") {
+    static_assert(sizeof(Record) == sizeof(MAGIC) + 8, "journal header and records must have the same size");
+
+    if (!load()) {
+        rebuilt_ = true;
+        rebuild();
+        rewrite();
+    } else if (records_ >= COMPACT_MIN_RECORDS && records_ > 2 * entries_.size()) {
+        rewrite();
+    }
+
+    if (fd_ < 0) {
+        fd_ = ::open(indexPath_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd_ < 0) {
+            throw FileException("Failed to open mailbox index: " + indexPath_ + " - " + std::strerror(errno));
+        }
+    }
+}
+
+MailboxIndex::~MailboxIndex() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+int MailboxIndex::lookup(uint32_t uid) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(uid);
+    return it == entries_.end() ? MISSING : it->second.kind;
+}
+
+uint64_t MailboxIndex::size(uint32_t uid) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(uid);
+    return it == entries_.end() ? 0 : it->second.size;
+}
+
+void MailboxIndex::record(uint32_t uid, int kind, uint64_t size) {
+    Record record{uid, static_cast<uint32_t>(kind), size};
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // One record per write, so concurrent appends never interleave
+    if (!writeAll(fd_, reinterpret_cast<const char *>(&record), sizeof(record))) {
+        throw FileException("Failed to write mailbox index: " + indexPath_ + " - " + std::strerror(errno));
+    }
+    records_++;
+    apply(record);
+}
+
+void MailboxIndex::reset(uint32_t uidValidity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    highestUid_ = 0;
+    uidValidity_ = uidValidity;
+    rewrite();
+}
+
+uint32_t MailboxIndex::uidValidity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return uidValidity_;
+}
+
+uint32_t MailboxIndex::highestUid() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return highestUid_;
+}
+
+size_t MailboxIndex::count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+UidSet MailboxIndex::uids() const {
+    std::vector<int> uids;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uids.reserve(entries_.size());
+        for (const auto &entry : entries_) {
+            uids.push_back(entry.first);
+        }
+    }
+    return UidSet(uids);
+}
+
+bool MailboxIndex::rebuilt() const {
+    return rebuilt_;
+}
+
+int MailboxIndex::classify(const std::string &content) {
+    BodyDetector detector;
+    detector.feed(content.data(), content.size());
+    return detector.kind();
+}
+
+bool MailboxIndex::load() {
+    std::ifstream file(indexPath_, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+
+    if (data.size() < sizeof(Record) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    std::memcpy(&uidValidity_, data.data() + sizeof(MAGIC), sizeof(uidValidity_));
+
+    size_t count = data.size() / sizeof(Record) - 1;
+    for (size_t i = 0; i < count; i++) {
+        Record record;
+        std::memcpy(&record, data.data() + (i + 1) * sizeof(Record), sizeof(Record));
+        apply(record);
+    }
+    records_ = count;
+
+    // Drop a record torn by an interrupted write
+    if (data.size() % sizeof(Record) != 0) {
+        if (::truncate(indexPath_.c_str(), (count + 1) * sizeof(Record)) != 0) {
+            throw FileException("Failed to repair mailbox index: " + indexPath_ + " - " + std::strerror(errno));
+        }
+    }
+    return true;
+}
+
+void MailboxIndex::rebuild() {
+    entries_.clear();
+    highestUid_ = 0;
+    uidValidity_ = 0;
+
+    std::error_code ec;
+    if (!std::filesystem::is_directory(dirPath_, ec)) {
+        return;
+    }
+
+    std::ifstream uidValidityFile(dirPath_ + "/uidvalidity.txt");
+    if (uidValidityFile.is_open()) {
+        uidValidityFile >> uidValidity_;
+    }
+
+    for (const auto &entry : std::filesystem::directory_iterator(dirPath_)) {
+        const std::filesystem::path &path = entry.path();
+        std::string stem = path.stem().string();
+        if (path.extension() != ".eml" || stem.empty() || stem.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+
+        std::ifstream message(path, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(message)), std::istreambuf_iterator<char>());
+        if (content.empty()) {
+            continue;
+        }
+        apply(Record{static_cast<uint32_t>(std::stoul(stem)), static_cast<uint32_t>(classify(content)), content.size()});
+    }
+}
+
+void MailboxIndex::rewrite() {
+    std::error_code ec;
+    std::filesystem::create_directories(dirPath_, ec);
+
+    std::vector<Record> records(entries_.size() + 1);
+    std::memcpy(&records[0], MAGIC, sizeof(MAGIC));
+    std::memcpy(reinterpret_cast<char *>(&records[0]) + sizeof(MAGIC), &uidValidity_, sizeof(uidValidity_));
+    std::memset(reinterpret_cast<char *>(&records[0]) + sizeof(MAGIC) + sizeof(uidValidity_), 0, 4);
+    size_t i = 1;
+    for (const auto &entry : entries_) {
+        records[i++] = Record{entry.first, entry.second.kind, entry.second.size};
+    }
+
+    // The new journal replaces the old one atomically
+    std::string tempPath = indexPath_ + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw FileException("Failed to write mailbox index: " + tempPath + " - " + std::strerror(errno));
+    }
+    bool written = writeAll(fd, reinterpret_cast<const char *>(records.data()), records.size() * sizeof(Record));
+    if (::close(fd) != 0 || !written || std::rename(tempPath.c_str(), indexPath_.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        throw FileException("Failed to write mailbox index: " + indexPath_);
+    }
+    records_ = entries_.size();
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = ::open(indexPath_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd_ < 0) {
+        throw FileException("Failed to open mailbox index: " + indexPath_ + " - " + std::strerror(errno));
+    }
+}
+
+void MailboxIndex::apply(const Record &record) {
+    if (record.kind == MISSING) {
+        entries_.erase(record.uid);
+        return;
+    }
+    entries_[record.uid] = Entry{static_cast<uint8_t>(record.kind), record.size};
+    if (record.uid > highestUid_) {
+        highestUid_ = record.uid;
+    }
+}
@@ -0,0 +1,192 @@
+// MailboxIndex.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef MAILBOXINDEX_H
+#define MAILBOXINDEX_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "UidSet.h"
+
+/**
+ * @class BodyDetector
+ * @brief Finds out whether a message received in parts has a body after its headers.
+ *
+ * A message has a body if a non-empty line follows the first empty line.
+ */
+class BodyDetector {
+public:
+    /**
+     * @brief Consumes the next part of the message.
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Returns MailboxIndex::FULL if a body was found, otherwise MailboxIndex::HEADERS_ONLY.
+     */
+    int kind() const;
+
+private:
+    bool lineEmpty_ = true; ///< True if the current line has no content so far
+    bool seenBlank_ = false; ///< True once the empty line after the headers was seen
+    bool hasBody_ = false;
+};
+
+/**
+ * @class MailboxIndex
+ * @brief Persistent index of the messages stored in one mailbox directory.
+ *
+ * Remembers the UIDVALIDITY, the highest UID and the kind and size of every
+ * saved message, so the download decision does not touch the message files.
+ * The index is kept in the file .index of the mailbox directory as a journal
+ * of fixed-size records. Every saved message appends one record with a single
+ * write, a record torn by a crash is dropped on the next load. The journal is
+ * rewritten when it holds too many superseded records.
+ *
+ * A missing or damaged index is rebuilt once by scanning the .eml files.
+ * All methods are thread-safe.
+ */
+class MailboxIndex {
+public:
+    static constexpr int MISSING = 0; ///< The message is not stored
+    static constexpr int FULL = 1; ///< The whole message is stored
+    static constexpr int HEADERS_ONLY = 2; ///< Only the headers of the message are stored
+
+    /**
+     * @brief Loads the index of the mailbox directory, rebuilding it if needed.
+     *
+     * @param dirPath Path to the mailbox directory.
+     * @throws FileException if the index cannot be read or written.
+     */
+    MailboxIndex(const std::string &dirPath);
+
+    /**
+     * @brief Closes the journal.
+     */
+    ~MailboxIndex();
+
+    MailboxIndex(const MailboxIndex &) = delete;
+    MailboxIndex &operator=(const MailboxIndex &) = delete;
+
+    /**
+     * @brief Returns the kind of the stored message.
+     * @param uid UID of the message.
+     * @return int MISSING, FULL or HEADERS_ONLY.
+     */
+    int lookup(uint32_t uid) const;
+
+    /**
+     * @brief Returns the size of the stored message in bytes, 0 if it is not stored.
+     * @param uid UID of the message.
+     */
+    uint64_t size(uint32_t uid) const;
+
+    /**
+     * @brief Records a saved message and appends it to the journal.
+     *
+     * @param uid UID of the message.
+     * @param kind FULL or HEADERS_ONLY, MISSING removes the message.
+     * @param size Size of the message file in bytes.
+     * @throws FileException if the journal cannot be written.
+     */
+    void record(uint32_t uid, int kind, uint64_t size);
+
+    /**
+     * @brief Forgets all messages and starts a new journal for the UIDVALIDITY.
+     *
+     * @param uidValidity The new UIDVALIDITY of the mailbox.
+     * @throws FileException if the journal cannot be written.
+     */
+    void reset(uint32_t uidValidity);
+
+    /**
+     * @brief Returns the UIDVALIDITY the index belongs to, 0 if unknown.
+     */
+    uint32_t uidValidity() const;
+
+    /**
+     * @brief Returns the highest UID of a stored message, 0 if there is none.
+     */
+    uint32_t highestUid() const;
+
+    /**
+     * @brief Returns the number of stored messages.
+     */
+    size_t count() const;
+
+    /**
+     * @brief Returns the UIDs of all stored messages.
+     */
+    UidSet uids() const;
+
+    /**
+     * @brief Returns true if the index was rebuilt by scanning the .eml files when it was loaded.
+     */
+    bool rebuilt() const;
+
+    /**
+     * @brief Classifies message content, see BodyDetector.
+     * @param content The message content.
+     * @return int FULL or HEADERS_ONLY.
+     */
+    static int classify(const std::string &content);
+
+private:
+    /**
+     * @brief A message as stored in memory.
+     */
+    struct Entry {
+        uint8_t kind; ///< FULL or HEADERS_ONLY
+        uint64_t size; ///< Size of the message file in bytes
+    };
+
+    /**
+     * @brief A journal record, the file starts with a header of the same size.
+     */
+    struct Record {
+        uint32_t uid;
+        uint32_t kind;
+        uint64_t size;
+    };
+
+    static const char MAGIC[8]; ///< First bytes of the journal
+    static constexpr size_t COMPACT_MIN_RECORDS = 4096; ///< Journals shorter than this are never rewritten
+
+    std::string dirPath_;
+    std::string indexPath_;
+    mutable std::mutex mutex_;
+    int fd_ = -1; ///< Journal opened for appending
+    uint32_t uidValidity_ = 0;
+    uint32_t highestUid_ = 0;
+    size_t records_ = 0; ///< Number of records in the journal
+    bool rebuilt_ = false;
+    std::unordered_map<uint32_t, Entry> entries_;
+
+    /**
+     * @brief Reads the journal, returns false if it is missing or damaged.
+     */
+    bool load();
+
+    /**
+     * @brief Fills the index from the .eml files of the mailbox directory.
+     */
+    void rebuild();
+
+    /**
+     * @brief Writes the whole index to a new journal and replaces the old one.
+     */
+    void rewrite();
+
+    /**
+     * @brief Applies a record to the in-memory index.
+     */
+    void apply(const Record &record);
+};
+
+#endif // MAILBOXINDEX_H
@@ -0,0 +1,123 @@
+// Maildir.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "Maildir.h"
+#include "FileException.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+constexpr const char *SUFFIX = ".imapcl"; ///< Marks the files delivered by this program
+
+}
+
+Maildir::Maildir(const std::string &dirPath, unsigned buckets)
+    : dirPath_(dirPath), buckets_(std::min(std::max(buckets, 1u), MAX_BUCKETS)) {
+    std::error_code ec;
+    std::filesystem::create_directories(tempDirectory(), ec);
+    for (unsigned bucket = 0; bucket < buckets_ && !ec; bucket++) {
+        for (const char *subdirectory : {"/tmp", "/new", "/cur"}) {
+            std::filesystem::create_directories(bucketPath(bucket) + subdirectory, ec);
+        }
+    }
+    if (ec) {
+        throw FileException("Failed to create Maildir: " + dirPath_ + " - " + ec.message());
+    }
+}
+
+std::string Maildir::bucketPath(unsigned bucket) const {
+    if (buckets_ == 1) {
+        return dirPath_;
+    }
+    char name[8];
+    std::snprintf(name, sizeof(name), "/%02x", bucket);
+    return dirPath_ + name;
+}
+
+unsigned Maildir::bucket(uint32_t uid) const {
+    // Multiplicative hashing spreads consecutive UIDs over all buckets
+    return static_cast<unsigned>((static_cast<uint64_t>(uid) * 2654435761u >> 16) % buckets_);
+}
+
+std::string Maildir::fileName(uint32_t uid) {
+    return std::to_string(uid) + SUFFIX;
+}
+
+uint32_t Maildir::parseFileName(const std::string &name) {
+    size_t digits = name.find_first_not_of("0123456789");
+    if (digits == 0 || digits == std::string::npos || name.compare(digits, std::strlen(SUFFIX), SUFFIX) != 0) {
+        return 0;
+    }
+    size_t end = digits + std::strlen(SUFFIX);
+    if (end != name.size() && name[end] != ':') {
+        return 0;
+    }
+    return static_cast<uint32_t>(std::stoul(name.substr(0, digits)));
+}
+
+std::string Maildir::tempDirectory() const {
+    return dirPath_ + "/tmp";
+}
+
+std::string Maildir::deliveryPath(uint32_t uid) const {
+    return bucketPath(bucket(uid)) + "/new/" + fileName(uid);
+}
+
+std::string Maildir::find(uint32_t uid) const {
+    std::string path = deliveryPath(uid);
+    if (::access(path.c_str(), F_OK) == 0) {
+        return path;
+    }
+
+    // A reader moved the message to cur and may have appended flags to its name
+    std::string name = fileName(uid);
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(bucketPath(bucket(uid)) + "/cur", ec)) {
+        std::string candidate = entry.path().filename().string();
+        if (candidate.compare(0, name.size(), name) == 0 && (candidate.size() == name.size() || candidate[name.size()] == ':')) {
+            return entry.path().string();
+        }
+    }
+    return "";
+}
+
+void Maildir::remove(uint32_t uid) {
+    std::string path = find(uid);
+    if (!path.empty() && std::remove(path.c_str()) != 0 && errno != ENOENT) {
+        throw FileException("Failed to remove message file: " + path + " - " + std::strerror(errno));
+    }
+}
+
+void Maildir::clear() {
+    std::error_code ec;
+    for (unsigned bucket = 0; bucket < buckets_; bucket++) {
+        for (const char *subdirectory : {"/new", "/cur"}) {
+            for (const auto &entry : std::filesystem::directory_iterator(bucketPath(bucket) + subdirectory, ec)) {
+                if (parseFileName(entry.path().filename().string()) != 0) {
+                    std::filesystem::remove(entry.path(), ec);
+                }
+            }
+        }
+    }
+}
+
+void Maildir::forEach(const std::function<void(uint32_t uid, const std::string &path)> &function) const {
+    std::error_code ec;
+    for (unsigned bucket = 0; bucket < buckets_; bucket++) {
+        for (const char *subdirectory : {"/new", "/cur"}) {
+            for (const auto &entry : std::filesystem::directory_iterator(bucketPath(bucket) + subdirectory, ec)) {
+                uint32_t uid = parseFileName(entry.path().filename().string());
+                if (uid != 0) {
+                    function(uid, entry.path().string());
+                }
+            }
+        }
+    }
+}
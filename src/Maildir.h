@@ -0,0 +1,103 @@
+// Maildir.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef MAILDIR_H
+#define MAILDIR_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * @class Maildir
+ * @brief Maildir layout of one mailbox directory.
+ *
+ * Messages are written to tmp and delivered to new by an atomic rename, as
+ * required by the Maildir specification. The file name is derived from the
+ * UID, so a message is found without listing the directory unless a reader
+ * has moved it to cur meanwhile.
+ *
+ * With a fan-out of more than one bucket, the mailbox directory holds the
+ * Maildirs 00, 01, ... and every message is delivered to the bucket selected
+ * by a hash of its UID. Each bucket is a complete Maildir, so Maildir tools
+ * can read them directly while no directory grows beyond a fraction of the
+ * mailbox.
+ */
+class Maildir {
+public:
+    /**
+     * @brief Creates the tmp, new and cur directories of the mailbox and of all buckets.
+     *
+     * @param dirPath Path to the mailbox directory.
+     * @param buckets Number of buckets, 1 stores the messages directly in the mailbox directory.
+     * @throws FileException if the directories cannot be created.
+     */
+    Maildir(const std::string &dirPath, unsigned buckets = 1);
+
+    /**
+     * @brief Returns the directory for messages being received.
+     */
+    std::string tempDirectory() const;
+
+    /**
+     * @brief Returns the path a message is delivered to.
+     * @param uid UID of the message.
+     */
+    std::string deliveryPath(uint32_t uid) const;
+
+    /**
+     * @brief Finds a delivered message in new or cur.
+     *
+     * @param uid UID of the message.
+     * @return std::string Path to the message, empty if it is not stored.
+     */
+    std::string find(uint32_t uid) const;
+
+    /**
+     * @brief Removes a delivered message from new or cur.
+     *
+     * @param uid UID of the message.
+     * @throws FileException if the message cannot be removed.
+     */
+    void remove(uint32_t uid);
+
+    /**
+     * @brief Removes all messages, used after a UIDVALIDITY change.
+     */
+    void clear();
+
+    /**
+     * @brief Calls the function with the UID and path of every delivered message.
+     */
+    void forEach(const std::function<void(uint32_t uid, const std::string &path)> &function) const;
+
+    /**
+     * @brief Returns the bucket of the message.
+     * @param uid UID of the message.
+     */
+    unsigned bucket(uint32_t uid) const;
+
+    static constexpr unsigned MAX_BUCKETS = 256;
+
+private:
+    std::string dirPath_;
+    unsigned buckets_;
+
+    /**
+     * @brief Returns the Maildir of the bucket.
+     */
+    std::string bucketPath(unsigned bucket) const;
+
+    /**
+     * @brief Returns the base file name of the message, a reader may append :2,<flags> in cur.
+     */
+    static std::string fileName(uint32_t uid);
+
+    /**
+     * @brief Extracts the UID from a file name in new or cur, 0 if the file was not delivered by us.
+     */
+    static uint32_t parseFileName(const std::string &name);
+};
+
+#endif // MAILDIR_H
@@ -0,0 +1,192 @@
+// MessageCompression.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "MessageCompression.h"
+#include "FileException.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+
+CompressionDictionary::CompressionDictionary(const std::string &path, size_t samples)
+    : path_(path), wanted_(samples) {
+    std::ifstream file(path_, std::ios::binary);
+    if (file.is_open()) {
+        dictionary_ = std::make_unique<const std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+}
+
+const std::string *CompressionDictionary::data() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dictionary_.get();
+}
+
+bool CompressionDictionary::training() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !dictionary_ && wanted_ > 0;
+}
+
+void CompressionDictionary::addSample(const std::string &sample) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dictionary_ || wanted_ == 0) {
+        return;
+    }
+    samples_.push_back(sample.substr(0, SAMPLE_SIZE));
+    if (samples_.size() < wanted_) {
+        return;
+    }
+
+    std::string dictionary = train(samples_);
+    samples_.clear();
+    if (dictionary.empty()) {
+        wanted_ = 0;
+        return;
+    }
+
+    // Messages refer to the dictionary, it has to be on disk before the first of them
+    std::string tempPath = path_ + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && ::write(fd, dictionary.data(), dictionary.size()) == static_cast<ssize_t>(dictionary.size()) &&
+                   ::fsync(fd) == 0;
+    if (fd >= 0 && ::close(fd) != 0) {
+        written = false;
+    }
+    if (!written || std::rename(tempPath.c_str(), path_.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        wanted_ = 0;
+        throw FileException("Failed to write compression dictionary: " + path_);
+    }
+    dictionary_ = std::make_unique<const std::string>(std::move(dictionary));
+}
+
+std::string CompressionDictionary::train(const std::vector<std::string> &samples) {
+    // Count in how many samples every line occurs
+    std::map<std::string, size_t> occurrences;
+    for (const std::string &sample : samples) {
+        std::set<std::string> lines;
+        size_t start = 0;
+        while (start < sample.size()) {
+            size_t end = sample.find('\n', start);
+            end = end == std::string::npos ? sample.size() : end + 1;
+            if (end - start > 2) {
+                lines.insert(sample.substr(start, end - start));
+            }
+            start = end;
+        }
+        for (const std::string &line : lines) {
+            occurrences[line]++;
+        }
+    }
+
+    std::vector<std::pair<size_t, const std::string *>> scored;
+    for (const auto &entry : occurrences) {
+        if (entry.second > 1) {
+            scored.emplace_back(entry.second * entry.first.size(), &entry.first);
+        }
+    }
+    std::sort(scored.begin(), scored.end(), [](const auto &a, const auto &b) {
+        return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+    });
+
+    // The most valuable lines are kept and placed at the end
+    std::vector<const std::string *> chosen;
+    size_t size = 0;
+    for (const auto &entry : scored) {
+        if (size + entry.second->size() > MAX_SIZE) {
+            continue;
+        }
+        chosen.push_back(entry.second);
+        size += entry.second->size();
+    }
+    std::string dictionary;
+    dictionary.reserve(size);
+    for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+        dictionary += **it;
+    }
+    return dictionary;
+}
+
+MessageDeflater::MessageDeflater(const std::string *dictionary) {
+    stream_ = z_stream{};
+    if (deflateInit(&stream_, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        throw FileException("Failed to initialize compression");
+    }
+    if (dictionary && deflateSetDictionary(&stream_, reinterpret_cast<const Bytef *>(dictionary->data()),
+                                           static_cast<uInt>(dictionary->size())) != Z_OK) {
+        deflateEnd(&stream_);
+        throw FileException("Failed to set compression dictionary");
+    }
+}
+
+MessageDeflater::~MessageDeflater() {
+    deflateEnd(&stream_);
+}
+
+void MessageDeflater::run(int flush, std::string &output) {
+    char buffer[16384];
+    do {
+        stream_.next_out = reinterpret_cast<Bytef *>(buffer);
+        stream_.avail_out = sizeof(buffer);
+        int result = deflate(&stream_, flush);
+        if (result == Z_STREAM_ERROR) {
+            throw FileException("Failed to compress message");
+        }
+        output.append(buffer, sizeof(buffer) - stream_.avail_out);
+    } while (stream_.avail_out == 0);
+}
+
+void MessageDeflater::compress(const char *data, size_t length, std::string &output) {
+    stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_.avail_in = static_cast<uInt>(length);
+    run(Z_NO_FLUSH, output);
+}
+
+void MessageDeflater::finish(std::string &output) {
+    stream_.next_in = nullptr;
+    stream_.avail_in = 0;
+    run(Z_FINISH, output);
+}
+
+std::string inflateMessage(const char *data, size_t length, const std::string *dictionary) {
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK) {
+        throw FileException("Failed to initialize decompression");
+    }
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream.avail_in = static_cast<uInt>(length);
+
+    std::string message;
+    char buffer[65536];
+    int result;
+    do {
+        stream.next_out = reinterpret_cast<Bytef *>(buffer);
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_NEED_DICT) {
+            if (!dictionary || stream.adler != adler32(1L, reinterpret_cast<const Bytef *>(dictionary->data()),
+                                                       static_cast<uInt>(dictionary->size()))) {
+                inflateEnd(&stream);
+                throw FileException("Compressed message needs a missing dictionary");
+            }
+            inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dictionary->data()),
+                                 static_cast<uInt>(dictionary->size()));
+            continue;
+        }
+        if (result != Z_OK && result != Z_STREAM_END) {
+            inflateEnd(&stream);
+            throw FileException("Compressed message is damaged");
+        }
+        message.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (result != Z_STREAM_END && (stream.avail_in > 0 || stream.avail_out == 0));
+
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        throw FileException("Compressed message is truncated");
+    }
+    return message;
+}
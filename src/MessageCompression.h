@@ -0,0 +1,136 @@
+// MessageCompression.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef MESSAGECOMPRESSION_H
+#define MESSAGECOMPRESSION_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @class CompressionDictionary
+ * @brief Preset DEFLATE dictionary of one account trained on its first messages.
+ *
+ * Small messages compress poorly on their own, most of their size are header
+ * lines repeated in every message of the account. The dictionary collects the
+ * header lines that recur across the sample messages, so they compress to
+ * back-references from the first byte of every message.
+ *
+ * Once built, the dictionary is stored in the account directory and never
+ * changes, because every compressed message refers to it by its checksum.
+ * All methods are thread-safe.
+ */
+class CompressionDictionary {
+public:
+    /**
+     * @brief Loads the dictionary from the file, if it was built already.
+     *
+     * @param path Path to the dictionary file.
+     * @param samples Number of messages the dictionary is trained on, 0 never builds one.
+     */
+    CompressionDictionary(const std::string &path, size_t samples);
+
+    /**
+     * @brief Returns the dictionary, nullptr while it is still being trained.
+     *
+     * The returned dictionary stays valid for the lifetime of this object.
+     */
+    const std::string *data() const;
+
+    /**
+     * @brief Checks whether more samples are wanted.
+     */
+    bool training() const;
+
+    /**
+     * @brief Adds the beginning of a message, building the dictionary once enough samples were collected.
+     *
+     * @param sample The first bytes of the message.
+     * @throws FileException if the built dictionary cannot be stored.
+     */
+    void addSample(const std::string &sample);
+
+    /**
+     * @brief Builds a dictionary from the samples.
+     *
+     * Lines found in more than one sample are ordered by the bytes they would
+     * save, the most valuable last, where DEFLATE reaches them with the
+     * shortest distances.
+     *
+     * @param samples Beginnings of messages.
+     * @return std::string The dictionary, at most MAX_SIZE bytes.
+     */
+    static std::string train(const std::vector<std::string> &samples);
+
+    static constexpr size_t MAX_SIZE = 32 * 1024; ///< Size of the DEFLATE window
+    static constexpr size_t SAMPLE_SIZE = 8 * 1024; ///< Bytes of every message kept as a sample
+    static constexpr const char *FILE_NAME = ".dictionary"; ///< Dictionary file in the account directory
+
+private:
+    std::string path_;
+    size_t wanted_;
+    mutable std::mutex mutex_;
+    std::vector<std::string> samples_;
+    std::unique_ptr<const std::string> dictionary_;
+};
+
+/**
+ * @class MessageDeflater
+ * @brief Compresses a message in parts into the zlib format.
+ *
+ * A message compressed with a dictionary carries its checksum in the zlib
+ * header, inflateMessage() then asks for it.
+ */
+class MessageDeflater {
+public:
+    /**
+     * @brief Starts a compressed message.
+     *
+     * @param dictionary Preset dictionary, nullptr compresses without one.
+     * @throws FileException if zlib fails to initialize.
+     */
+    MessageDeflater(const std::string *dictionary);
+
+    ~MessageDeflater();
+
+    MessageDeflater(const MessageDeflater &) = delete;
+    MessageDeflater &operator=(const MessageDeflater &) = delete;
+
+    /**
+     * @brief Compresses the next part of the message.
+     *
+     * @param data Pointer to the data.
+     * @param length Number of bytes.
+     * @param output Receives the compressed bytes produced so far.
+     */
+    void compress(const char *data, size_t length, std::string &output);
+
+    /**
+     * @brief Ends the message.
+     * @param output Receives the remaining compressed bytes.
+     */
+    void finish(std::string &output);
+
+private:
+    z_stream stream_;
+
+    void run(int flush, std::string &output);
+};
+
+/**
+ * @brief Decompresses a message produced by MessageDeflater.
+ *
+ * @param data Pointer to the compressed message.
+ * @param length Number of bytes.
+ * @param dictionary The dictionary of the account, nullptr if it has none.
+ * @return std::string The message.
+ * @throws FileException if the data is damaged or needs another dictionary.
+ */
+std::string inflateMessage(const char *data, size_t length, const std::string *dictionary);
+
+#endif // MESSAGECOMPRESSION_H
@@ -0,0 +1,407 @@
+// SegmentStore.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "SegmentStore.h"
+#include "FileException.h"
+#include "FileIo.h"
+#include "MailboxIndex.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char SegmentStore::MAGIC[8] = {'I', 'M', 'A', 'P', 'S', 'E', 'G', '1'};
+
+std::unique_ptr<MappedMessage> MappedMessage::map(const std::string &path, uint64_t offset, uint64_t length) {
+    if (length == 0) {
+        return map(-1, path, offset, length);
+    }
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw FileException("Failed to open message file: " + path + " - " + std::strerror(errno));
+    }
+    return map(fd, path, offset, length);
+}
+
+std::unique_ptr<MappedMessage> MappedMessage::map(int fd, const std::string &path, uint64_t offset, uint64_t length) {
+    std::unique_ptr<MappedMessage> message(new MappedMessage());
+    if (length == 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        message->data_ = "";
+        return message;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < offset + length) {
+        ::close(fd);
+        throw FileException("Message lies beyond the end of file: " + path);
+    }
+
+    // mmap() needs an offset aligned to pages
+    uint64_t pageOffset = offset - offset % static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    message->mappedLength_ = length + (offset - pageOffset);
+    void *base = mmap(nullptr, message->mappedLength_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(pageOffset));
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        throw FileException("Failed to map message file: " + path + " - " + std::strerror(errno));
+    }
+    message->base_ = base;
+    message->data_ = static_cast<const char *>(base) + (offset - pageOffset);
+    message->size_ = length;
+    return message;
+}
+
+MappedMessage::~MappedMessage() {
+    if (base_) {
+        munmap(base_, mappedLength_);
+    }
+}
+
+const char *MappedMessage::data() const {
+    return data_;
+}
+
+size_t MappedMessage::size() const {
+    return size_;
+}
+
+SegmentStore::SegmentStore(const std::string &dirPath, uint64_t segmentSize)
+    : storePath_(dirPath + "/" + DIRECTORY), journalPath_(storePath_ + "/index"), segmentSize_(segmentSize) {
+    static_assert(sizeof(Record) == 32, "journal records must have a fixed size");
+
+    std::error_code ec;
+    std::filesystem::create_directories(storePath_, ec);
+    if (ec) {
+        throw FileException("Failed to create segment store: " + storePath_ + " - " + ec.message());
+    }
+    load();
+    openSegment(segments_.empty() ? 1 : segments_.rbegin()->first);
+}
+
+SegmentStore::~SegmentStore() {
+    if (journalFd_ >= 0) {
+        ::close(journalFd_);
+    }
+    if (segmentFd_ >= 0) {
+        ::close(segmentFd_);
+    }
+}
+
+std::string SegmentStore::segmentPath(uint32_t segment) const {
+    char name[16];
+    std::snprintf(name, sizeof(name), "%08u.seg", segment);
+    return storePath_ + "/" + name;
+}
+
+void SegmentStore::load() {
+    for (const auto &entry : std::filesystem::directory_iterator(storePath_)) {
+        const std::filesystem::path &path = entry.path();
+        std::string stem = path.stem().string();
+        if (path.extension() != ".seg" || stem.empty() || stem.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        segments_[static_cast<uint32_t>(std::stoul(stem))] = entry.file_size();
+    }
+
+    std::ifstream file(journalPath_, std::ios::binary);
+    std::vector<char> data;
+    if (file.is_open()) {
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    file.close();
+
+    // Without a journal the segments cannot be read, they are dead until compacted
+    if (data.size() < sizeof(Record) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        rewriteJournal();
+        return;
+    }
+
+    size_t count = data.size() / sizeof(Record) - 1;
+    for (size_t i = 0; i < count; i++) {
+        Record record;
+        std::memcpy(&record, data.data() + (i + 1) * sizeof(Record), sizeof(Record));
+        apply(record);
+    }
+
+    // Drop messages whose data did not reach the segment before a crash
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        auto segment = segments_.find(it->second.segment);
+        if (segment == segments_.end() || it->second.offset + it->second.length > segment->second) {
+            liveBytes_ -= it->second.length;
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Drop a record torn by an interrupted write
+    if (data.size() % sizeof(Record) != 0) {
+        if (::truncate(journalPath_.c_str(), (count + 1) * sizeof(Record)) != 0) {
+            throw FileException("Failed to repair segment journal: " + journalPath_ + " - " + std::strerror(errno));
+        }
+    }
+
+    journalFd_ = ::open(journalPath_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (journalFd_ < 0) {
+        throw FileException("Failed to open segment journal: " + journalPath_ + " - " + std::strerror(errno));
+    }
+}
+
+void SegmentStore::rewriteJournal() {
+    std::vector<Record> records(entries_.size() + 1);
+    std::memset(records.data(), 0, sizeof(Record));
+    std::memcpy(&records[0], MAGIC, sizeof(MAGIC));
+    size_t i = 1;
+    for (const auto &entry : entries_) {
+        const Location &location = entry.second;
+        records[i++] = Record{entry.first, location.kind, location.segment, location.flags, location.offset, location.length};
+    }
+
+    // The new journal replaces the old one atomically and must be on disk before old segments are deleted
+    std::string tempPath = journalPath_ + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw FileException("Failed to write segment journal: " + tempPath + " - " + std::strerror(errno));
+    }
+    bool written = writeAll(fd, reinterpret_cast<const char *>(records.data()), records.size() * sizeof(Record)) &&
+                   ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !written || std::rename(tempPath.c_str(), journalPath_.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        throw FileException("Failed to write segment journal: " + journalPath_);
+    }
+
+    if (journalFd_ >= 0) {
+        ::close(journalFd_);
+    }
+    journalFd_ = ::open(journalPath_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (journalFd_ < 0) {
+        throw FileException("Failed to open segment journal: " + journalPath_ + " - " + std::strerror(errno));
+    }
+}
+
+void SegmentStore::openSegment(uint32_t segment) {
+    std::string path = segmentPath(segment);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw FileException("Failed to open segment: " + path + " - " + std::strerror(errno));
+    }
+
+    if (segmentFd_ >= 0) {
+        ::close(segmentFd_);
+    }
+    segmentFd_ = fd;
+    segment_ = segment;
+    segmentLength_ = info.st_size;
+    segments_[segment] = segmentLength_;
+}
+
+void SegmentStore::apply(const Record &record) {
+    auto it = entries_.find(record.uid);
+    if (it != entries_.end()) {
+        liveBytes_ -= it->second.length;
+        entries_.erase(it);
+    }
+    if (record.kind == MailboxIndex::MISSING) {
+        return;
+    }
+    entries_[record.uid] = Location{record.segment, record.kind, record.offset, record.length, record.flags};
+    liveBytes_ += record.length;
+}
+
+void SegmentStore::writeRecord(const Record &record) {
+    // One record per write, a torn record is detected by its size
+    if (!writeAll(journalFd_, reinterpret_cast<const char *>(&record), sizeof(record))) {
+        throw FileException("Failed to write segment journal: " + journalPath_ + " - " + std::strerror(errno));
+    }
+    apply(record);
+}
+
+SegmentStore::Location SegmentStore::write(const char *data, uint64_t length) {
+    if (segmentLength_ > 0 && segmentLength_ + length > segmentSize_) {
+        openSegment(segment_ + 1);
+    }
+
+    Location location{segment_, 0, segmentLength_, length, 0};
+    if (!writeAll(segmentFd_, data, length)) {
+        int error = errno;
+        // A partial write leaves dead bytes, the next message goes after them
+        off_t end = ::lseek(segmentFd_, 0, SEEK_END);
+        if (end >= 0) {
+            segmentLength_ = end;
+            segments_[segment_] = segmentLength_;
+        }
+        throw FileException("Failed to write segment: " + segmentPath(segment_) + " - " + std::strerror(error));
+    }
+    segmentLength_ += length;
+    segments_[segment_] = segmentLength_;
+    unsynced_.insert(segment_);
+    return location;
+}
+
+void SegmentStore::append(uint32_t uid, const std::string &data, int kind, uint32_t flags) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Location location = write(data.data(), data.size());
+    writeRecord(Record{uid, static_cast<uint32_t>(kind), location.segment, flags, location.offset, location.length});
+}
+
+void SegmentStore::sync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint32_t segment : unsynced_) {
+        // Earlier segments are closed, a segment deleted by compaction was synced by it
+        int fd = segment == segment_ ? segmentFd_ : ::open(segmentPath(segment).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            continue;
+        }
+        bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+        int error = errno;
+        if (fd >= 0 && fd != segmentFd_) {
+            ::close(fd);
+        }
+        if (!synced) {
+            throw FileException("Failed to flush segment: " + segmentPath(segment) + " - " + std::strerror(error));
+        }
+    }
+    unsynced_.clear();
+    if (::fdatasync(journalFd_) != 0) {
+        throw FileException("Failed to flush segment journal: " + journalPath_ + " - " + std::strerror(errno));
+    }
+}
+
+void SegmentStore::remove(uint32_t uid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.count(uid) == 0) {
+        return;
+    }
+    writeRecord(Record{uid, static_cast<uint32_t>(MailboxIndex::MISSING), 0, 0, 0, 0});
+
+    uint64_t total = 0;
+    for (const auto &segment : segments_) {
+        total += segment.second;
+    }
+    uint64_t dead = total - liveBytes_;
+    if (dead >= COMPACT_MIN_BYTES && dead * 2 > total) {
+        compactLocked();
+    }
+}
+
+std::unique_ptr<MappedMessage> SegmentStore::read(uint32_t uid, uint32_t *flags) const {
+    Location location;
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(uid);
+        if (it == entries_.end()) {
+            return nullptr;
+        }
+        location = it->second;
+
+        // Opened under the lock, so compaction cannot delete the segment first, the descriptor keeps it readable
+        if (location.length > 0) {
+            fd = ::open(segmentPath(location.segment).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throw FileException("Failed to open message file: " + segmentPath(location.segment) + " - " +
+                                    std::strerror(errno));
+            }
+        }
+    }
+    if (flags) {
+        *flags = location.flags;
+    }
+    return MappedMessage::map(fd, segmentPath(location.segment), location.offset, location.length);
+}
+
+void SegmentStore::forEach(const std::function<void(uint32_t uid, int kind, uint64_t length)> &function) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &entry : entries_) {
+        function(entry.first, entry.second.kind, entry.second.length);
+    }
+}
+
+void SegmentStore::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segmentFd_ >= 0) {
+        ::close(segmentFd_);
+        segmentFd_ = -1;
+    }
+
+    // All messages belong to the old UIDVALIDITY, the segments are dropped whole
+    entries_.clear();
+    liveBytes_ = 0;
+    rewriteJournal();
+    for (const auto &segment : segments_) {
+        ::unlink(segmentPath(segment.first).c_str());
+    }
+    segments_.clear();
+    openSegment(1);
+}
+
+void SegmentStore::compact() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    compactLocked();
+}
+
+void SegmentStore::compactLocked() {
+    std::vector<std::pair<uint32_t, Location>> live(entries_.begin(), entries_.end());
+    std::sort(live.begin(), live.end(), [](const auto &a, const auto &b) {
+        return a.second.segment != b.second.segment ? a.second.segment < b.second.segment
+                                                    : a.second.offset < b.second.offset;
+    });
+
+    // Live messages are copied into segments numbered after the old ones
+    std::map<uint32_t, uint64_t> oldSegments;
+    oldSegments.swap(segments_);
+    uint32_t firstSegment = segment_ + 1;
+    openSegment(firstSegment);
+    for (auto &entry : live) {
+        std::unique_ptr<MappedMessage> message = MappedMessage::map(segmentPath(entry.second.segment),
+                                                                    entry.second.offset, entry.second.length);
+        Location location = write(message->data(), message->size());
+        location.kind = entry.second.kind;
+        location.flags = entry.second.flags;
+        entries_[entry.first] = location;
+    }
+    for (const auto &segment : segments_) {
+        int fd = ::open(segmentPath(segment.first).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw FileException("Failed to flush segment: " + segmentPath(segment.first));
+        }
+        ::close(fd);
+    }
+
+    rewriteJournal();
+    for (const auto &segment : oldSegments) {
+        ::unlink(segmentPath(segment.first).c_str());
+    }
+}
+
+uint64_t SegmentStore::totalBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t total = 0;
+    for (const auto &segment : segments_) {
+        total += segment.second;
+    }
+    return total;
+}
+
+uint64_t SegmentStore::liveBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return liveBytes_;
+}
@@ -0,0 +1,254 @@
+// SegmentStore.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef SEGMENTSTORE_H
+#define SEGMENTSTORE_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @class MappedMessage
+ * @brief Read-only view of a stored message mapped into memory.
+ *
+ * The mapping stays valid even if the file is removed or compacted meanwhile.
+ */
+class MappedMessage {
+public:
+    /**
+     * @brief Maps a part of a file.
+     *
+     * @param path Path to the file.
+     * @param offset Offset of the message in the file.
+     * @param length Length of the message in bytes.
+     * @return std::unique_ptr<MappedMessage> The mapping.
+     * @throws FileException if the file cannot be mapped or is too short.
+     */
+    static std::unique_ptr<MappedMessage> map(const std::string &path, uint64_t offset, uint64_t length);
+
+    /**
+     * @brief Maps a part of a file opened by the caller.
+     *
+     * @param fd Descriptor of the file opened for reading, always closed.
+     * @param path Path to the file, used in error messages.
+     * @param offset Offset of the message in the file.
+     * @param length Length of the message in bytes.
+     * @return std::unique_ptr<MappedMessage> The mapping.
+     * @throws FileException if the file cannot be mapped or is too short.
+     */
+    static std::unique_ptr<MappedMessage> map(int fd, const std::string &path, uint64_t offset, uint64_t length);
+
+    /**
+     * @brief Unmaps the message.
+     */
+    ~MappedMessage();
+
+    MappedMessage(const MappedMessage &) = delete;
+    MappedMessage &operator=(const MappedMessage &) = delete;
+
+    /**
+     * @brief Returns the content of the message.
+     */
+    const char *data() const;
+
+    /**
+     * @brief Returns the length of the message in bytes.
+     */
+    size_t size() const;
+
+private:
+    MappedMessage() = default;
+
+    void *base_ = nullptr; ///< Start of the page-aligned mapping
+    size_t mappedLength_ = 0;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * @class SegmentStore
+ * @brief Append-only store of the messages of one mailbox in large segment files.
+ *
+ * Messages are appended to the current segment in the segments subdirectory
+ * of the mailbox, a new segment is started once the current one would exceed
+ * the segment size. The location of every message is kept in a journal of
+ * fixed-size records like the MailboxIndex, the last record of a UID is valid.
+ * A record torn by a crash, or one pointing past the end of its segment, is
+ * dropped on load.
+ *
+ * Removed and replaced messages leave dead bytes in the segments. Once they
+ * make up more than half of the store, the live messages are copied into new
+ * segments and the old ones are deleted. All methods are thread-safe.
+ */
+class SegmentStore {
+public:
+    /**
+     * @brief Opens the store of the mailbox directory, creating it if needed.
+     *
+     * @param dirPath Path to the mailbox directory.
+     * @param segmentSize Size in bytes after which a new segment is started.
+     * @throws FileException if the store cannot be read or created.
+     */
+    SegmentStore(const std::string &dirPath, uint64_t segmentSize = DEFAULT_SEGMENT_SIZE);
+
+    /**
+     * @brief Closes the segment and the journal.
+     */
+    ~SegmentStore();
+
+    SegmentStore(const SegmentStore &) = delete;
+    SegmentStore &operator=(const SegmentStore &) = delete;
+
+    /**
+     * @brief Appends a message, replacing a stored message with the same UID.
+     *
+     * @param uid UID of the message.
+     * @param data Content of the message.
+     * @param kind MailboxIndex::FULL or MailboxIndex::HEADERS_ONLY.
+     * @param flags COMPRESSED if the data is compressed, otherwise 0.
+     * @throws FileException if the message cannot be written.
+     */
+    void append(uint32_t uid, const std::string &data, int kind, uint32_t flags = 0);
+
+    /**
+     * @brief Removes a message, compacting the store if too much of it is dead.
+     *
+     * @param uid UID of the message.
+     * @throws FileException if the journal cannot be written.
+     */
+    void remove(uint32_t uid);
+
+    /**
+     * @brief Maps a stored message into memory.
+     *
+     * @param uid UID of the message.
+     * @param flags Receives the flags given to append(), may be nullptr.
+     * @return std::unique_ptr<MappedMessage> The message as stored, nullptr if it is not stored.
+     * @throws FileException if the segment cannot be mapped.
+     */
+    std::unique_ptr<MappedMessage> read(uint32_t uid, uint32_t *flags = nullptr) const;
+
+    /**
+     * @brief Calls the function with the UID, kind and length of every stored message.
+     */
+    void forEach(const std::function<void(uint32_t uid, int kind, uint64_t length)> &function) const;
+
+    /**
+     * @brief Writes the segments appended to since the last call and the journal to disk.
+     *
+     * @throws FileException if the data cannot be flushed.
+     */
+    void sync();
+
+    /**
+     * @brief Deletes all segments and starts an empty store, used after a UIDVALIDITY change.
+     *
+     * @throws FileException if the store cannot be recreated.
+     */
+    void clear();
+
+    /**
+     * @brief Copies the live messages into new segments and deletes the old ones.
+     *
+     * @throws FileException if the store cannot be rewritten.
+     */
+    void compact();
+
+    /**
+     * @brief Returns the total size of all segments in bytes.
+     */
+    uint64_t totalBytes() const;
+
+    /**
+     * @brief Returns the size of the stored messages in bytes.
+     */
+    uint64_t liveBytes() const;
+
+    static constexpr uint32_t COMPRESSED = 1; ///< The message is stored compressed by MessageDeflater
+    static constexpr const char *DIRECTORY = "segments"; ///< Subdirectory of the mailbox holding the store
+    static constexpr uint64_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+    static constexpr uint64_t COMPACT_MIN_BYTES = 16 * 1024 * 1024; ///< Stores with less dead bytes are never compacted
+
+private:
+    /**
+     * @brief Location of a stored message.
+     */
+    struct Location {
+        uint32_t segment;
+        uint32_t kind;
+        uint64_t offset;
+        uint64_t length;
+        uint32_t flags;
+    };
+
+    /**
+     * @brief A journal record, the file starts with a header of the same size.
+     */
+    struct Record {
+        uint32_t uid;
+        uint32_t kind; ///< MailboxIndex::MISSING removes the message
+        uint32_t segment;
+        uint32_t flags;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    static const char MAGIC[8]; ///< First bytes of the journal
+
+    std::string storePath_;
+    std::string journalPath_;
+    uint64_t segmentSize_;
+    mutable std::mutex mutex_;
+    int journalFd_ = -1; ///< Journal opened for appending
+    int segmentFd_ = -1; ///< Current segment opened for appending
+    uint32_t segment_ = 0; ///< Number of the current segment
+    uint64_t segmentLength_ = 0; ///< Size of the current segment
+    std::map<uint32_t, uint64_t> segments_; ///< Size of every segment by number
+    std::set<uint32_t> unsynced_; ///< Segments appended to since the last sync()
+    std::unordered_map<uint32_t, Location> entries_;
+    uint64_t liveBytes_ = 0;
+
+    std::string segmentPath(uint32_t segment) const;
+
+    /**
+     * @brief Reads the journal and the sizes of the segments.
+     */
+    void load();
+
+    /**
+     * @brief Writes the journal anew from the in-memory locations and replaces the old one.
+     */
+    void rewriteJournal();
+
+    /**
+     * @brief Closes the current segment and opens the segment with the given number.
+     */
+    void openSegment(uint32_t segment);
+
+    /**
+     * @brief Appends a record to the journal and applies it.
+     */
+    void writeRecord(const Record &record);
+
+    /**
+     * @brief Applies a record to the in-memory locations.
+     */
+    void apply(const Record &record);
+
+    /**
+     * @brief Appends data to the current segment, starting a new one if it would not fit.
+     * @return Location The location of the data, kind is not set.
+     */
+    Location write(const char *data, uint64_t length);
+
+    void compactLocked();
+};
+
+#endif // SEGMENTSTORE_H
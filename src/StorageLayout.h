@@ -0,0 +1,17 @@
+// StorageLayout.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef STORAGELAYOUT_H
+#define STORAGELAYOUT_H
+
+/**
+ * @brief How the messages of a mailbox are laid out in its directory.
+ */
+enum class StorageLayout {
+    Files,  ///< One <uid>.eml file per message
+    Packed, ///< Messages appended to large segment files, see SegmentStore
+    Maildir ///< Maildir with tmp, new and cur directories, see Maildir
+};
+
+#endif // STORAGELAYOUT_H
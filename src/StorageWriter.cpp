@@ -0,0 +1,439 @@
+// StorageWriter.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "StorageWriter.h"
+#include "EventLoop.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int BACKPRESSURE_POLL_MS = 2; ///< Step of waiting inside of an EventLoop task without an eventfd
+
+}
+
+/**
+ * @brief Minimal io_uring wrapper using the raw system calls.
+ */
+class StorageWriter::Uring {
+public:
+    Uring(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return;
+        }
+        // Writes at the current file position need kernel 5.6, like IORING_OP_WRITE
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+            close();
+            return;
+        }
+
+        ringSize_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring_ = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+            if (sqes != MAP_FAILED) {
+                munmap(sqes, sqesSize_);
+            }
+            close();
+            return;
+        }
+
+        char *base = static_cast<char *>(ring_);
+        sqHead_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        cqHead_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+        entries_ = params.sq_entries;
+    }
+
+    ~Uring() {
+        close();
+    }
+
+    bool valid() const {
+        return fd_ >= 0;
+    }
+
+    unsigned entries() const {
+        return entries_;
+    }
+
+    /**
+     * @brief Checks whether waiting for completions failed, so submitted writes may still be running.
+     */
+    bool broken() const {
+        return broken_;
+    }
+
+    /**
+     * @brief Keeps the jobs of writes the kernel may still use alive as long as the ring.
+     */
+    void keepAlive(std::vector<Job> jobs) {
+        abandoned_.push_back(std::move(jobs));
+    }
+
+    /**
+     * @brief Queues a write of the buffer to the current position of the file.
+     */
+    void prepareWrite(int fd, const char *data, size_t length, uint64_t userData) {
+        unsigned tail = *sqTail_;
+        unsigned index = tail & sqMask_;
+        io_uring_sqe &sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(data);
+        sqe.len = static_cast<uint32_t>(std::min<size_t>(length, 1u << 30));
+        sqe.off = static_cast<uint64_t>(-1);
+        sqe.user_data = userData;
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+        prepared_++;
+    }
+
+    /**
+     * @brief Submits the queued writes and waits for all of their completions.
+     *
+     * If a submission fails, the writes not submitted yet are dropped, but the
+     * call still waits for every submitted write, the kernel uses their buffers
+     * until they complete. If waiting fails for another reason than an
+     * interruption, the ring is broken() and the writes still running are
+     * reported as failed.
+     *
+     * @return int 0 or the errno of the failed submission or wait.
+     */
+    int submitAndWait() {
+        unsigned toSubmit = prepared_;
+        int error = 0;
+        while (toSubmit > 0 || completed() < prepared_) {
+            long submitted = syscall(__NR_io_uring_enter, fd_, toSubmit, prepared_ - completed(),
+                                     IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    continue;
+                }
+                if (toSubmit == 0) {
+                    broken_ = true;
+                    return errno;
+                }
+                // The kernel has not consumed the rest of the queue, it would be submitted with the next batch
+                error = errno;
+                __atomic_store_n(sqTail_, __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+                prepared_ -= toSubmit;
+                toSubmit = 0;
+                continue;
+            }
+            toSubmit -= static_cast<unsigned>(submitted);
+        }
+        return error;
+    }
+
+    /**
+     * @brief Calls the handler for every completion and releases them.
+     */
+    template <typename Handler>
+    void reap(Handler handler) {
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe &cqe = cqes_[head & cqMask_];
+            handler(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        prepared_ = 0;
+    }
+
+private:
+    int fd_ = -1;
+    void *ring_ = MAP_FAILED;
+    size_t ringSize_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+    unsigned *sqHead_ = nullptr;
+    unsigned *sqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned *sqArray_ = nullptr;
+    unsigned *cqHead_ = nullptr;
+    unsigned *cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+    unsigned entries_ = 0;
+    unsigned prepared_ = 0; ///< Writes queued since the last reap()
+    bool broken_ = false; ///< Completions can no longer be awaited
+    std::vector<std::vector<Job>> abandoned_; ///< Jobs whose writes may still be running, destroyed after close()
+
+    unsigned completed() const {
+        return __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) - *cqHead_;
+    }
+
+    void close() {
+        if (sqes_) {
+            munmap(sqes_, sqesSize_);
+            sqes_ = nullptr;
+        }
+        if (ring_ != MAP_FAILED) {
+            munmap(ring_, ringSize_);
+            ring_ = MAP_FAILED;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+};
+
+StorageWriter::StorageWriter(size_t maxInFlight, Backend preferred, size_t threads)
+    : maxInFlight_(maxInFlight), backend_(Backend::ThreadPool) {
+
+    if (preferred == Backend::Uring) {
+        // The ring is created here, so a kernel without io_uring is detected before any job
+        auto ring = std::make_shared<Uring>(URING_ENTRIES);
+        if (ring->valid()) {
+            backend_ = Backend::Uring;
+            threads_.emplace_back([this, ring] { runUring(*ring); });
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        threads_.emplace_back([this] { runPool(); });
+    }
+}
+
+StorageWriter::~StorageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queued_.notify_all();
+    for (std::thread &thread : threads_) {
+        thread.join();
+    }
+}
+
+StorageWriter::Backend StorageWriter::backend() const {
+    return backend_;
+}
+
+void StorageWriter::waitUntil(std::unique_lock<std::mutex> &lock, const std::function<bool()> &condition) {
+    EventLoop *loop = EventLoop::current();
+    if (!loop) {
+        completed_.wait(lock, condition);
+        return;
+    }
+
+    // The task waits for its own eventfd signalled by finish(), the other tasks of the thread keep running
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+        waiters_.push_back(fd);
+    }
+    auto release = [&]() {
+        if (!lock.owns_lock()) {
+            lock.lock();
+        }
+        if (fd >= 0) {
+            waiters_.erase(std::find(waiters_.begin(), waiters_.end(), fd));
+            ::close(fd);
+        }
+    };
+    try {
+        while (!condition()) {
+            lock.unlock();
+            if (fd >= 0) {
+                loop->wait(fd, EPOLLIN, -1);
+                uint64_t count;
+                ssize_t drained = ::read(fd, &count, sizeof(count));
+                (void)drained;
+            } else {
+                loop->sleep(BACKPRESSURE_POLL_MS);
+            }
+            lock.lock();
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+    release();
+}
+
+void StorageWriter::submit(Job job) {
+    size_t size = job.data.size();
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waitUntil(lock, [&] { return inFlightJobs_ == 0 || inFlightBytes_ + size <= maxInFlight_; });
+        inFlightBytes_ += size;
+        inFlightJobs_++;
+        queue_.push_back(std::move(job));
+    }
+    queued_.notify_one();
+}
+
+void StorageWriter::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    waitUntil(lock, [&] { return inFlightJobs_ == 0; });
+}
+
+bool StorageWriter::take(std::vector<Job> &jobs, size_t max) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queued_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+    while (!queue_.empty() && jobs.size() < max) {
+        jobs.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+    return !jobs.empty();
+}
+
+void StorageWriter::finish(Job &job, int fd, int error) {
+    if (fd >= 0 && ::close(fd) != 0 && error == 0) {
+        error = errno;
+    }
+    if (error == 0 && std::rename(job.tempPath.c_str(), job.path.c_str()) != 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        ::unlink(job.tempPath.c_str());
+    }
+
+    size_t size = job.data.size();
+    if (job.done) {
+        job.done(error);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inFlightBytes_ -= size;
+        inFlightJobs_--;
+
+        // Waiters close their eventfd under the lock, so it is still open here
+        uint64_t one = 1;
+        for (int fd : waiters_) {
+            ssize_t signalled = ::write(fd, &one, sizeof(one));
+            (void)signalled;
+        }
+    }
+    completed_.notify_all();
+}
+
+void StorageWriter::writeBlocking(Job &job) {
+    int error = 0;
+    int fd = ::open(job.tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = errno;
+    }
+    for (size_t offset = 0; fd >= 0 && offset < job.data.size();) {
+        ssize_t written = ::write(fd, job.data.data() + offset, job.data.size() - offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        offset += written;
+    }
+    finish(job, fd, error);
+}
+
+void StorageWriter::runPool() {
+    std::vector<Job> jobs;
+    while (take(jobs, 1)) {
+        writeBlocking(jobs.front());
+        jobs.clear();
+    }
+}
+
+void StorageWriter::runUring(Uring &ring) {
+    struct Write {
+        int fd = -1;
+        size_t offset = 0;
+        int error = 0;
+    };
+
+    std::vector<Job> jobs;
+    std::vector<Write> writes;
+    while (take(jobs, ring.entries())) {
+        // A broken ring is not used anymore, the remaining jobs are written like by the ThreadPool
+        if (ring.broken()) {
+            for (Job &job : jobs) {
+                writeBlocking(job);
+            }
+            jobs.clear();
+            continue;
+        }
+
+        writes.assign(jobs.size(), Write{});
+        for (size_t i = 0; i < jobs.size(); i++) {
+            writes[i].fd = ::open(jobs[i].tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (writes[i].fd < 0) {
+                writes[i].error = errno;
+            }
+        }
+
+        // All messages of the batch are written by one io_uring_enter(), short writes are resubmitted
+        while (true) {
+            for (size_t i = 0; i < jobs.size(); i++) {
+                Write &write = writes[i];
+                if (write.error == 0 && write.offset < jobs[i].data.size()) {
+                    ring.prepareWrite(write.fd, jobs[i].data.data() + write.offset,
+                                      jobs[i].data.size() - write.offset, i);
+                }
+            }
+
+            bool pending = false;
+            int error = ring.submitAndWait();
+            ring.reap([&](uint64_t i, int result) {
+                if (result == -EINTR || result == -EAGAIN) {
+                    pending = true;
+                } else if (result < 0) {
+                    writes[i].error = -result;
+                } else if (result == 0) {
+                    writes[i].error = EIO;
+                } else {
+                    writes[i].offset += result;
+                    pending |= writes[i].offset < jobs[i].data.size();
+                }
+            });
+            // Every submitted write completed after a failed submission, only a broken ring may still use the data
+            if (error != 0) {
+                for (size_t i = 0; i < jobs.size(); i++) {
+                    if (writes[i].error == 0 && writes[i].offset < jobs[i].data.size()) {
+                        writes[i].error = error;
+                    }
+                }
+                break;
+            }
+            if (!pending) {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            finish(jobs[i], writes[i].fd, writes[i].error);
+        }
+        if (ring.broken()) {
+            ring.keepAlive(std::move(jobs));
+            jobs = std::vector<Job>();
+        }
+        jobs.clear();
+    }
+}
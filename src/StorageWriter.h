@@ -0,0 +1,147 @@
+// StorageWriter.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef STORAGEWRITER_H
+#define STORAGEWRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @class StorageWriter
+ * @brief Writes completed messages to disk on dedicated threads.
+ *
+ * The receiving thread only hands the message over and continues reading
+ * the socket, the file is written, closed and renamed in the background.
+ * A single writer thread submits the writes of all queued messages to an
+ * io_uring with one system call. Where io_uring is not available, a pool
+ * of threads writes the messages with plain write() calls.
+ *
+ * The bytes handed over and not written yet are limited. Once the limit is
+ * reached, submit() waits, so a disk slower than the network slows down
+ * the download instead of filling the memory.
+ */
+class StorageWriter {
+public:
+    /**
+     * @brief Implementation used to write the data.
+     */
+    enum class Backend {
+        Uring,     ///< One thread submitting the writes to an io_uring
+        ThreadPool ///< Several threads with blocking writes
+    };
+
+    /**
+     * @struct Job
+     * @brief A message to be written.
+     */
+    struct Job {
+        std::string tempPath; ///< File the data is written to
+        std::string path; ///< Final name the file is renamed to
+        std::string data; ///< Content of the file
+        std::function<void(int error)> done; ///< Called on a writer thread with 0 or the errno of the failure
+    };
+
+    /**
+     * @brief Starts the writer threads.
+     *
+     * @param maxInFlight Maximum number of bytes submitted and not written yet.
+     * @param preferred Backend to use, Uring falls back to ThreadPool if the kernel lacks io_uring.
+     * @param threads Number of threads of the ThreadPool backend.
+     */
+    StorageWriter(size_t maxInFlight, Backend preferred = Backend::Uring, size_t threads = DEFAULT_THREADS);
+
+    /**
+     * @brief Writes the remaining jobs and stops the threads.
+     */
+    ~StorageWriter();
+
+    StorageWriter(const StorageWriter &) = delete;
+    StorageWriter &operator=(const StorageWriter &) = delete;
+
+    /**
+     * @brief Queues a message for writing.
+     *
+     * Waits while the limit of bytes in flight would be exceeded. A job larger
+     * than the limit is accepted once nothing else is in flight. Inside of an
+     * EventLoop task, the task is suspended instead of the whole thread.
+     *
+     * @param job The message.
+     */
+    void submit(Job job);
+
+    /**
+     * @brief Waits until all submitted jobs are written and their callbacks returned.
+     */
+    void drain();
+
+    /**
+     * @brief Returns the backend in use.
+     */
+    Backend backend() const;
+
+    static constexpr size_t DEFAULT_THREADS = 4; ///< Threads of the ThreadPool backend
+    static constexpr unsigned URING_ENTRIES = 64; ///< Size of the submission queue, also the maximum batch
+
+private:
+    class Uring;
+
+    size_t maxInFlight_;
+    Backend backend_;
+    std::mutex mutex_;
+    std::condition_variable queued_; ///< Signalled when a job is queued or the writer stops
+    std::condition_variable completed_; ///< Signalled when a job is completed
+    std::deque<Job> queue_; ///< Jobs not taken by a writer thread yet
+    size_t inFlightBytes_ = 0; ///< Bytes of the jobs submitted and not completed
+    size_t inFlightJobs_ = 0; ///< Number of jobs submitted and not completed
+    bool stopping_ = false;
+    std::vector<int> waiters_; ///< eventfds of EventLoop tasks in waitUntil(), signalled by finish()
+    std::vector<std::thread> threads_;
+
+    /**
+     * @brief Waits until the condition holds, guarded by mutex_.
+     *
+     * Inside of an EventLoop task, the task waits for an eventfd signalled by
+     * finish(), so the other tasks of its thread keep running.
+     */
+    void waitUntil(std::unique_lock<std::mutex> &lock, const std::function<bool()> &condition);
+
+    /**
+     * @brief Body of the io_uring writer thread.
+     */
+    void runUring(Uring &ring);
+
+    /**
+     * @brief Body of a ThreadPool writer thread.
+     */
+    void runPool();
+
+    /**
+     * @brief Writes the job with plain write() calls and finishes it.
+     */
+    void writeBlocking(Job &job);
+
+    /**
+     * @brief Takes up to the given number of queued jobs, waiting for at least one.
+     * @return bool False once the writer stops and the queue is empty.
+     */
+    bool take(std::vector<Job> &jobs, size_t max);
+
+    /**
+     * @brief Closes and renames the written file and reports the result of the job.
+     *
+     * @param job The job.
+     * @param fd Descriptor of the temporary file, closed here.
+     * @param error 0 or the errno of a failed write.
+     */
+    void finish(Job &job, int fd, int error);
+};
+
+#endif // STORAGEWRITER_H
@@ -0,0 +1,175 @@
+// SyncOrchestrator.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "SyncOrchestrator.h"
+#include "AuthReader.h"
+#include "EventLoop.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+SyncOrchestrator::SyncOrchestrator(ProgramOptions &options) : options_(options) {}
+
+std::vector<SyncJob> SyncOrchestrator::readJobs(const std::string &jobFile, const std::string &defaultMailbox) {
+    std::ifstream file(jobFile);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open job file.");
+    }
+
+    std::vector<SyncJob> jobs;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        SyncJob job;
+        if (!(iss >> std::quoted(job.authFile)) || job.authFile[0] == '#') {
+            continue;
+        }
+
+        std::string mailbox;
+        while (iss >> std::quoted(mailbox)) {
+            job.mailboxes.push_back(mailbox);
+        }
+        if (job.mailboxes.empty()) {
+            job.mailboxes.push_back(defaultMailbox);
+        }
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+std::vector<JobResult> SyncOrchestrator::run(const std::vector<SyncJob> &jobs) {
+    std::vector<std::vector<JobResult>> jobResults(jobs.size());
+    std::atomic<size_t> next{0};
+
+    // Every thread takes the next account until the list is exhausted
+    auto worker = [this, &jobs, &jobResults, &next]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            jobResults[i] = runJob(jobs[i]);
+        }
+    };
+
+    size_t concurrent = std::min(static_cast<size_t>(options_.accounts), jobs.size());
+    size_t perThread = std::max<size_t>(std::min(static_cast<size_t>(options_.accountsPerThread), concurrent), 1);
+    std::function<void()> threadMain = worker;
+    if (perThread > 1) {
+        // The connections of the thread's accounts are multiplexed by one epoll loop
+        threadMain = [&worker, perThread]() {
+            EventLoop loop;
+            for (size_t i = 0; i < perThread; i++) {
+                loop.spawn(worker);
+            }
+            loop.run();
+        };
+    }
+
+    // An exception escaping a thread would terminate the process with the jobs of all other threads
+    std::mutex failureMutex;
+    std::string failure;
+    auto guardedMain = [&threadMain, &failureMutex, &failure]() {
+        try {
+            threadMain();
+        } catch (const std::exception &e) {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (failure.empty()) {
+                failure = e.what();
+            }
+        }
+    };
+
+    size_t threadCount = (concurrent + perThread - 1) / perThread;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(guardedMain);
+    }
+    guardedMain();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    // Jobs a failed thread did not finish have no results
+    if (!failure.empty()) {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (!jobResults[i].empty()) {
+                continue;
+            }
+            for (const std::string &mailbox : jobs[i].mailboxes) {
+                JobResult result;
+                result.account = jobs[i].authFile;
+                result.mailbox.mailbox = mailbox;
+                result.mailbox.error = "Synchronization thread failed: " + failure;
+                jobResults[i].push_back(result);
+            }
+        }
+    }
+
+    std::vector<JobResult> results;
+    for (const std::vector<JobResult> &jobResult : jobResults) {
+        results.insert(results.end(), jobResult.begin(), jobResult.end());
+    }
+    return results;
+}
+
+std::vector<JobResult> SyncOrchestrator::runJob(const SyncJob &job) {
+    std::vector<JobResult> results;
+
+    AuthData authData;
+    try {
+        authData = AuthReader(job.authFile).read();
+    } catch (const std::exception &e) {
+        for (const std::string &mailbox : job.mailboxes) {
+            JobResult result;
+            result.account = job.authFile;
+            result.mailbox.mailbox = mailbox;
+            result.mailbox.error = e.what();
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    ImapClient client(options_);
+    for (const MailboxResult &mailbox : client.syncMailboxes(authData, job.mailboxes)) {
+        JobResult result;
+        result.account = authData.username;
+        result.mailbox = mailbox;
+        results.push_back(result);
+    }
+    return results;
+}
+
+int SyncOrchestrator::printResults(const std::vector<JobResult> &results, std::ostream &out) {
+    size_t failed = 0;
+    int downloaded = 0;
+    int reused = 0;
+
+    for (const JobResult &result : results) {
+        out << result.account << " " << result.mailbox.mailbox << ": ";
+        if (result.mailbox.success) {
+            out << "OK, " << result.mailbox.downloaded << " downloaded";
+            if (result.mailbox.reused > 0) {
+                out << ", " << result.mailbox.reused << " reused";
+            }
+            out << std::endl;
+            downloaded += result.mailbox.downloaded;
+            reused += result.mailbox.reused;
+        } else {
+            out << "FAILED, " << result.mailbox.error << std::endl;
+            failed++;
+        }
+    }
+    out << "Synchronized " << results.size() - failed << " of " << results.size() << " mailboxes, "
+        << downloaded << " messages downloaded";
+    if (reused > 0) {
+        out << ", " << reused << " reused";
+    }
+    out << "." << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
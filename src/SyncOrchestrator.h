@@ -0,0 +1,90 @@
+// SyncOrchestrator.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef SYNCORCHESTRATOR_H
+#define SYNCORCHESTRATOR_H
+
+#include "ArgumentsParser.h"
+#include "ImapClient.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @struct SyncJob
+ * @brief One account and the mailboxes to synchronize from it.
+ */
+struct SyncJob {
+    std::string authFile; ///< Path to the authentication file of the account
+    std::vector<std::string> mailboxes; ///< Mailbox names, * stands for all listed mailboxes
+};
+
+/**
+ * @struct JobResult
+ * @brief Outcome of synchronizing one mailbox of one account.
+ */
+struct JobResult {
+    std::string account; ///< Username, or the authentication file if it could not be read
+    MailboxResult mailbox; ///< Result of the mailbox
+};
+
+/**
+ * @class SyncOrchestrator
+ * @brief Synchronizes many accounts and mailboxes in a single process.
+ *
+ * Accounts are taken from the job list by a bounded pool of threads. Each
+ * thread uses one connection per account and synchronizes all its mailboxes
+ * over it, see ImapClient::syncMailboxes(). With options.accountsPerThread
+ * above one, every thread runs an EventLoop serving that many accounts at once.
+ */
+class SyncOrchestrator {
+public:
+    /**
+     * @brief Constructs an orchestrator using the connection settings of the options.
+     * @param options Program options shared by all jobs.
+     */
+    SyncOrchestrator(ProgramOptions &options);
+
+    /**
+     * @brief Reads the job list.
+     *
+     * Every non-empty line not starting with # holds the path to an authentication
+     * file followed by mailbox names. Names containing spaces are written in double
+     * quotes. A line without mailboxes uses the mailbox from the options.
+     *
+     * @param jobFile Path to the job list.
+     * @param defaultMailbox Mailbox used by lines without mailboxes.
+     * @return std::vector<SyncJob> The jobs in the order of the file.
+     * @throws std::runtime_error If the file cannot be read
+     */
+    static std::vector<SyncJob> readJobs(const std::string &jobFile, const std::string &defaultMailbox);
+
+    /**
+     * @brief Runs at most options.accounts jobs at once, options.accountsPerThread of them per thread.
+     * @param jobs The jobs.
+     * @return std::vector<JobResult> Results of all mailboxes, in the order of the jobs.
+     */
+    std::vector<JobResult> run(const std::vector<SyncJob> &jobs);
+
+    /**
+     * @brief Prints one line per mailbox and a summary.
+     * @param results The results returned by run().
+     * @param out Stream to print to.
+     * @return int 0 if all jobs succeeded, 1 otherwise.
+     */
+    static int printResults(const std::vector<JobResult> &results, std::ostream &out);
+
+private:
+    ProgramOptions options_;
+
+    /**
+     * @brief Synchronizes all mailboxes of one account.
+     * @param job The job.
+     * @return std::vector<JobResult> Results of the mailboxes.
+     */
+    std::vector<JobResult> runJob(const SyncJob &job);
+};
+
+#endif // SYNCORCHESTRATOR_H
@@ -0,0 +1,193 @@
+// TlsContext.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "TlsContext.h"
+#include "ImapException.h"
+#include "openssl/err.h"
+#include "openssl/pem.h"
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <unistd.h>
+
+namespace {
+
+void freeKey(void *, void *key, CRYPTO_EX_DATA *, int, long, void *) {
+    delete static_cast<std::string *>(key);
+}
+
+/// Index of the server key stored with every connection for onNewSession()
+int keyIndex() {
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, freeKey);
+    return index;
+}
+
+std::mutex registryMutex;
+std::map<std::string, std::unique_ptr<TlsContext>> registry;
+
+/**
+ * @brief Checks whether the session can still be offered to the server.
+ */
+bool isUsable(SSL_SESSION *session) {
+    return SSL_SESSION_is_resumable(session) &&
+           SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) > std::time(nullptr);
+}
+
+}
+
+TlsContext &TlsContext::get(const std::string &certFile, const std::string &certDir, const std::string &cacheDir) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    std::unique_ptr<TlsContext> &context = registry[certFile + '\n' + certDir + '\n' + cacheDir];
+    if (!context) {
+        context.reset(new TlsContext(certFile, certDir, cacheDir));
+    }
+    return *context;
+}
+
+TlsContext::TlsContext(const std::string &certFile, const std::string &certDir, const std::string &cacheDir)
+    : cacheDir_(cacheDir) {
+    ctx_ = SSL_CTX_new(TLS_client_method());
+    if (!ctx_) {
+        throw ImapException("Failed to create SSL context");
+    }
+
+    // Load the certificate file or dir if specified
+    if (!certFile.empty() || !certDir.empty()) {
+        if (SSL_CTX_load_verify_locations(ctx_,
+                                          certFile.empty() ? nullptr : certFile.c_str(),
+                                          certDir.empty() ? nullptr : certDir.c_str()) != 1) {
+            SSL_CTX_free(ctx_);
+            throw ImapException("Failed to load SSL certificates");
+        }
+    }
+
+    // Sessions are cached per server by this class, OpenSSL only reports them
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx_, onNewSession);
+    SSL_CTX_set_app_data(ctx_, this);
+}
+
+TlsContext::~TlsContext() {
+    for (auto &entry : sessions_) {
+        SSL_SESSION_free(entry.second);
+    }
+    SSL_CTX_free(ctx_);
+}
+
+SSL *TlsContext::newConnection(int socket, const std::string &server, int port) {
+    SSL *ssl = SSL_new(ctx_);
+    if (!ssl) {
+        throw ImapException("Failed to create SSL connection");
+    }
+    SSL_set_fd(ssl, socket);
+
+    // SNI must not carry an IP address
+    unsigned char address[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, server.c_str(), address) != 1 && inet_pton(AF_INET6, server.c_str(), address) != 1) {
+        SSL_set_tlsext_host_name(ssl, server.c_str());
+    }
+
+    // The key lives as long as the connection, freeKey() deletes it
+    std::string key = server + ":" + std::to_string(port);
+    SSL_set_ex_data(ssl, keyIndex(), new std::string(key));
+
+    // SSL_set_session() takes its own reference
+    SSL_SESSION *cached = session(key);
+    if (cached) {
+        SSL_set_session(ssl, cached);
+        SSL_SESSION_free(cached);
+    }
+    return ssl;
+}
+
+int TlsContext::onNewSession(SSL *ssl, SSL_SESSION *session) {
+    TlsContext *context = static_cast<TlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    std::string *key = static_cast<std::string *>(SSL_get_ex_data(ssl, keyIndex()));
+    if (!context || !key) {
+        return 0;
+    }
+
+    context->storeSession(*key, session);
+    // The reference now belongs to the cache
+    return 1;
+}
+
+SSL_SESSION *TlsContext::session(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // A ticket offered by two connections would be rejected as a replay, the file holds the same one
+    SSL_SESSION *taken = nullptr;
+    auto found = sessions_.find(key);
+    if (found != sessions_.end()) {
+        taken = found->second;
+        sessions_.erase(found);
+    } else if (!cacheDir_.empty()) {
+        FILE *file = std::fopen(sessionPath(key).c_str(), "r");
+        if (!file) {
+            return nullptr;
+        }
+        taken = PEM_read_SSL_SESSION(file, nullptr, nullptr, nullptr);
+        std::fclose(file);
+        if (!taken) {
+            // A damaged cache only costs a full handshake
+            ERR_clear_error();
+        }
+    }
+    if (!cacheDir_.empty()) {
+        unlink(sessionPath(key).c_str());
+    }
+
+    if (taken && !isUsable(taken)) {
+        SSL_SESSION_free(taken);
+        return nullptr;
+    }
+    return taken;
+}
+
+void TlsContext::storeSession(const std::string &key, SSL_SESSION *session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto found = sessions_.find(key);
+    if (found != sessions_.end()) {
+        SSL_SESSION_free(found->second);
+    }
+    sessions_[key] = session;
+
+    if (cacheDir_.empty()) {
+        return;
+    }
+
+    // The session holds key material, so only the owner may read it
+    mkdir(cacheDir_.c_str(), 0700);
+    std::string path = sessionPath(key);
+    std::string tempPath = path + ".tmp" + std::to_string(getpid());
+    int descriptor = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (descriptor < 0) {
+        return;
+    }
+    FILE *file = fdopen(descriptor, "w");
+    if (!file) {
+        close(descriptor);
+        unlink(tempPath.c_str());
+        return;
+    }
+    bool written = PEM_write_SSL_SESSION(file, session) == 1;
+    if (std::fclose(file) != 0 || !written || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        unlink(tempPath.c_str());
+    }
+}
+
+std::string TlsContext::sessionPath(const std::string &key) const {
+    std::string name = key;
+    for (char &c : name) {
+        if (c == '/' || c == ':') {
+            c = '_';
+        }
+    }
+    return cacheDir_ + "/" + name + ".pem";
+}
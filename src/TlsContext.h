@@ -0,0 +1,91 @@
+// TlsContext.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef TLSCONTEXT_H
+#define TLSCONTEXT_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include "openssl/ssl.h"
+
+/**
+ * @class TlsContext
+ * @brief Process-wide TLS client context with a persistent session cache.
+ *
+ * The certificates are loaded once per process and shared by all connections.
+ * Session tickets received from a server are kept in memory and stored in the
+ * cache directory, so a later connection or a later run resumes the session
+ * (TLS 1.3 PSK) instead of doing a full handshake. Every ticket is offered only
+ * once, parallel connections use the tickets issued to earlier ones.
+ */
+class TlsContext {
+public:
+    /**
+     * @brief Returns the shared context for the given certificate locations.
+     *
+     * @param certFile Path to the certificate file, may be empty.
+     * @param certDir Path to the certificate directory, may be empty.
+     * @param cacheDir Directory of the session cache, empty disables the on-disk cache.
+     * @return TlsContext& The context, valid until the process exits.
+     * @throws ImapException If the context could not be created
+     */
+    static TlsContext &get(const std::string &certFile, const std::string &certDir, const std::string &cacheDir);
+
+    ~TlsContext();
+
+    TlsContext(const TlsContext &) = delete;
+    TlsContext &operator=(const TlsContext &) = delete;
+
+    /**
+     * @brief Creates a TLS connection on the socket, offering a cached session of the server.
+     *
+     * The handshake is not performed.
+     *
+     * @param socket Connected socket.
+     * @param server Host name of the server, also sent as SNI.
+     * @param port Port of the server.
+     * @return SSL* The connection, freed by the caller.
+     * @throws ImapException If the connection could not be created
+     */
+    SSL *newConnection(int socket, const std::string &server, int port);
+
+    /**
+     * @brief Takes the cached session of the server, loading it from disk first if needed.
+     *
+     * The session is removed from the memory and the disk cache, so it is
+     * never offered twice.
+     *
+     * @param key Server identification, host:port.
+     * @return SSL_SESSION* The session or nullptr if there is no usable one, freed by the caller.
+     */
+    SSL_SESSION *session(const std::string &key);
+
+    /**
+     * @brief Replaces the cached session of the server and stores it on disk.
+     * @param key Server identification, host:port.
+     * @param session The session, ownership is taken.
+     */
+    void storeSession(const std::string &key, SSL_SESSION *session);
+
+    /**
+     * @brief Returns the path of the session file of the server.
+     */
+    std::string sessionPath(const std::string &key) const;
+
+private:
+    SSL_CTX *ctx_ = nullptr;
+    std::string cacheDir_;
+    std::mutex mutex_; ///< Guards sessions_ and the session files.
+    std::map<std::string, SSL_SESSION *> sessions_; ///< Newest session of every server not offered yet
+
+    TlsContext(const std::string &certFile, const std::string &certDir, const std::string &cacheDir);
+
+    /**
+     * @brief Called by OpenSSL when the server issues a new session ticket.
+     */
+    static int onNewSession(SSL *ssl, SSL_SESSION *session);
+};
+
+#endif // TLSCONTEXT_H
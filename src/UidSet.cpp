@@ -0,0 +1,144 @@
+// UidSet.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "UidSet.h"
+#include <algorithm>
+
+UidSet::UidSet(const std::vector<int> &uids) {
+    if (std::is_sorted(uids.begin(), uids.end())) {
+        for (int uid : uids) {
+            add(uid);
+        }
+        return;
+    }
+
+    std::vector<int> sorted(uids);
+    std::sort(sorted.begin(), sorted.end());
+    for (int uid : sorted) {
+        add(uid);
+    }
+}
+
+void UidSet::add(uint32_t uid) {
+    if (!ranges_.empty() && uid <= ranges_.back().second + 1 && uid >= ranges_.back().first) {
+        // Inside of the last range or right after it
+        if (uid == ranges_.back().second + 1) {
+            ranges_.back().second = uid;
+            size_++;
+        }
+        return;
+    }
+    if (ranges_.empty() || uid > ranges_.back().second) {
+        ranges_.emplace_back(uid, uid);
+        size_++;
+        return;
+    }
+    if (contains(uid)) {
+        return;
+    }
+
+    // Out of order, insert and merge with the neighbouring ranges
+    auto it = std::lower_bound(ranges_.begin(), ranges_.end(), std::make_pair(uid, uid));
+    it = ranges_.insert(it, std::make_pair(uid, uid));
+    size_++;
+    if (it + 1 != ranges_.end() && (it + 1)->first == uid + 1) {
+        it->second = (it + 1)->second;
+        ranges_.erase(it + 1);
+    }
+    if (it != ranges_.begin() && (it - 1)->second + 1 == uid) {
+        (it - 1)->second = it->second;
+        ranges_.erase(it);
+    }
+}
+
+void UidSet::addRange(uint32_t first, uint32_t last) {
+    if (ranges_.empty() || static_cast<uint64_t>(first) > static_cast<uint64_t>(ranges_.back().second) + 1) {
+        ranges_.emplace_back(first, last);
+        size_ += static_cast<size_t>(last) - first + 1;
+        return;
+    }
+    if (first >= ranges_.back().first) {
+        // Overlaps or continues the last range
+        if (last > ranges_.back().second) {
+            size_ += last - ranges_.back().second;
+            ranges_.back().second = last;
+        }
+        return;
+    }
+
+    for (uint64_t uid = first; uid <= last; uid++) {
+        add(uid);
+    }
+}
+
+uint32_t UidSet::max() const {
+    return ranges_.empty() ? 0 : ranges_.back().second;
+}
+
+bool UidSet::contains(uint32_t uid) const {
+    auto it = std::upper_bound(ranges_.begin(), ranges_.end(), uid,
+                               [](uint32_t value, const std::pair<uint32_t, uint32_t> &range) {
+                                   return value < range.first;
+                               });
+    return it != ranges_.begin() && uid <= (it - 1)->second;
+}
+
+UidSet UidSet::difference(const UidSet &other) const {
+    UidSet result;
+    auto sub = other.ranges_.begin();
+
+    for (const auto &range : ranges_) {
+        uint64_t start = range.first;
+        uint64_t end = range.second;
+
+        // Skip the subtracted ranges lying before this one
+        while (sub != other.ranges_.end() && sub->second < start) {
+            ++sub;
+        }
+        // Cut out all subtracted ranges overlapping this one
+        for (auto it = sub; it != other.ranges_.end() && it->first <= end; ++it) {
+            if (it->first > start) {
+                result.ranges_.emplace_back(start, it->first - 1);
+                result.size_ += it->first - start;
+            }
+            start = static_cast<uint64_t>(it->second) + 1;
+            if (start > end) {
+                break;
+            }
+        }
+        if (start <= end) {
+            result.ranges_.emplace_back(start, end);
+            result.size_ += end - start + 1;
+        }
+    }
+
+    return result;
+}
+
+UidSet UidSet::intersection(const UidSet &other) const {
+    return difference(difference(other));
+}
+
+size_t UidSet::size() const {
+    return size_;
+}
+
+bool UidSet::empty() const {
+    return size_ == 0;
+}
+
+std::vector<int> UidSet::toVector() const {
+    std::vector<int> uids;
+    uids.reserve(size_);
+    for (const auto &range : ranges_) {
+        for (uint64_t uid = range.first; uid <= range.second; uid++) {
+            uids.push_back(static_cast<int>(uid));
+        }
+    }
+    return uids;
+}
+
+const std::vector<std::pair<uint32_t, uint32_t>> &UidSet::ranges() const {
+    return ranges_;
+}
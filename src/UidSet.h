@@ -0,0 +1,98 @@
+// UidSet.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef UIDSET_H
+#define UIDSET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @class UidSet
+ * @brief Set of message UIDs stored as sorted, disjoint ranges.
+ *
+ * Mailboxes mostly hold long runs of consecutive UIDs, so a set of a million
+ * UIDs usually takes a few ranges. Set operations merge the ranges of both
+ * sets in a single linear pass.
+ */
+class UidSet {
+public:
+    /**
+     * @brief Constructs an empty set.
+     */
+    UidSet() = default;
+
+    /**
+     * @brief Constructs a set of the given UIDs.
+     * @param uids UIDs in any order, ascending order avoids sorting.
+     */
+    explicit UidSet(const std::vector<int> &uids);
+
+    /**
+     * @brief Adds a UID, in constant time if it is not lower than the highest UID in the set.
+     * @param uid The UID.
+     */
+    void add(uint32_t uid);
+
+    /**
+     * @brief Adds an inclusive range of UIDs, in constant time if it does not start below the highest range.
+     * @param first The first UID of the range.
+     * @param last The last UID of the range.
+     */
+    void addRange(uint32_t first, uint32_t last);
+
+    /**
+     * @brief Returns the highest UID in the set, 0 if the set is empty.
+     */
+    uint32_t max() const;
+
+    /**
+     * @brief Checks whether the UID is in the set, in logarithmic time.
+     * @param uid The UID.
+     * @return bool True if the set contains the UID.
+     */
+    bool contains(uint32_t uid) const;
+
+    /**
+     * @brief Returns the UIDs of this set that are not in the other set.
+     * @param other The set to subtract.
+     * @return UidSet The difference.
+     */
+    UidSet difference(const UidSet &other) const;
+
+    /**
+     * @brief Returns the UIDs contained in both sets.
+     * @param other The other set.
+     * @return UidSet The intersection.
+     */
+    UidSet intersection(const UidSet &other) const;
+
+    /**
+     * @brief Returns the number of UIDs in the set.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Checks whether the set is empty.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Returns all UIDs in ascending order.
+     */
+    std::vector<int> toVector() const;
+
+    /**
+     * @brief Returns the inclusive ranges of the set in ascending order.
+     */
+    const std::vector<std::pair<uint32_t, uint32_t>> &ranges() const;
+
+private:
+    std::vector<std::pair<uint32_t, uint32_t>> ranges_; ///< Sorted, disjoint and non-adjacent ranges
+    size_t size_ = 0;
+};
+
+#endif // UIDSET_H
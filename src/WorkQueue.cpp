@@ -0,0 +1,54 @@
+// WorkQueue.cpp
+// author: Marek Tenora
+// login: xtenor02
+
+#include "WorkQueue.h"
+#include <algorithm>
+
+WorkQueue::WorkQueue(size_t workers) {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); i++) {
+        lanes_.push_back(std::make_unique<Lane>());
+    }
+}
+
+void WorkQueue::distribute(const std::vector<int> &ids, size_t batchSize) {
+    size_t batchCount = (ids.size() + batchSize - 1) / batchSize;
+
+    for (size_t i = 0; i < batchCount; i++) {
+        size_t start = i * batchSize;
+        size_t end = std::min(ids.size(), start + batchSize);
+        Lane &lane = *lanes_[i * lanes_.size() / batchCount];
+
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        lane.batches.emplace_back(ids.begin() + start, ids.begin() + end);
+    }
+}
+
+bool WorkQueue::pop(size_t worker, std::vector<int> &batch) {
+    Lane &own = *lanes_[worker];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.batches.empty()) {
+            batch = std::move(own.batches.front());
+            own.batches.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of the other lanes, furthest from their owners
+    for (size_t i = 1; i < lanes_.size(); i++) {
+        Lane &victim = *lanes_[(worker + i) % lanes_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.batches.empty()) {
+            batch = std::move(victim.batches.back());
+            victim.batches.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t WorkQueue::workers() const {
+    return lanes_.size();
+}
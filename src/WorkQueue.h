@@ -0,0 +1,61 @@
+// WorkQueue.h
+// author: Marek Tenora
+// login: xtenor02
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class WorkQueue
+ * @brief Work-stealing queue of UID batches shared by download connections.
+ *
+ * Every worker has its own lane of batches. A worker takes batches from the
+ * front of its lane and, once the lane is empty, steals from the back of the
+ * other lanes, so fast connections take over the work of slow ones.
+ */
+class WorkQueue {
+public:
+    /**
+     * @brief Constructs a queue with one lane per worker.
+     * @param workers Number of workers.
+     */
+    WorkQueue(size_t workers);
+
+    /**
+     * @brief Splits the UIDs into batches and partitions them across the lanes.
+     *
+     * Each lane receives a contiguous range of batches.
+     *
+     * @param ids UIDs in ascending order.
+     * @param batchSize Maximum number of UIDs in one batch.
+     */
+    void distribute(const std::vector<int> &ids, size_t batchSize);
+
+    /**
+     * @brief Takes the next batch for the worker.
+     * @param worker Index of the worker.
+     * @param batch Receives the UIDs of the batch.
+     * @return bool False if there is no work left in any lane.
+     */
+    bool pop(size_t worker, std::vector<int> &batch);
+
+    /**
+     * @brief Returns the number of lanes.
+     */
+    size_t workers() const;
+
+private:
+    struct Lane {
+        std::mutex mutex;
+        std::deque<std::vector<int>> batches;
+    };
+
+    std::vector<std::unique_ptr<Lane>> lanes_;
+};
+
+#endif // WORKQUEUE_H
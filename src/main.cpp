@@ -8,12 +8,19 @@
 #include "ArgumentsParser.h"
 #include "AuthReader.h"
 #include "ImapClient.h"
+#include "SyncOrchestrator.h"
 
 int main(int argc, char* argv[]) {
     try {
         ArgumentsParser argumentsParser;
         ProgramOptions options = argumentsParser.parse(argc, argv);
 
+        if (!options.jobFile.empty()) {
+            SyncOrchestrator orchestrator(options);
+            std::vector<SyncJob> jobs = SyncOrchestrator::readJobs(options.jobFile, options.mailbox);
+            return SyncOrchestrator::printResults(orchestrator.run(jobs), std::cout);
+        }
+
         AuthReader authReader(options.authFile);
         AuthData authData = authReader.read();
 
@@ -60,4 +60,112 @@ TEST_F(ArgumentsParserTest, SetsDefaultPortWithoutTLS) {
     ProgramOptions options = parser.parse(argc, argv);
 
     EXPECT_EQ(options.port, 143);
-}
\ No newline at end of file
+}
+
+TEST_F(ArgumentsParserTest, ParsesPipelineDepth) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-w", (char*)"32" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.pipelineDepth, 32);
+}
+
+TEST_F(ArgumentsParserTest, ThrowsOnInvalidPipelineDepth) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-w", (char*)"0" };
+    int argc = 8;
+    EXPECT_THROW(parser.parse(argc, argv), std::invalid_argument);
+}
+
+TEST_F(ArgumentsParserTest, ParsesBatchSize) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-B", (char*)"500" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.batchSize, 500);
+}
+
+TEST_F(ArgumentsParserTest, ParsesReadBufferSize) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-R", (char*)"64" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.readBufferSize, 64u * 1024);
+}
+
+TEST_F(ArgumentsParserTest, ParsesConnections) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-j", (char*)"4" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.connections, 4);
+}
+
+TEST_F(ArgumentsParserTest, ParsesIncremental) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-I" };
+    int argc = 7;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_TRUE(options.incremental);
+}
+
+TEST_F(ArgumentsParserTest, ParsesDaemon) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-d", (char*)"30" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_TRUE(options.daemon);
+    EXPECT_EQ(options.pollInterval, 30);
+}
+
+TEST_F(ArgumentsParserTest, ParsesHeaderFields) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-H", (char*)"From,Subject  Date" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_TRUE(options.headersOnly);
+    EXPECT_EQ(options.headerFields, "From Subject Date");
+}
+
+TEST_F(ArgumentsParserTest, ParsesStorageLayout) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-L", (char*)"packed" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.layout, StorageLayout::Packed);
+}
+
+TEST_F(ArgumentsParserTest, ParsesMaildirFanOut) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-L", (char*)"maildir", (char*)"-F", (char*)"16" };
+    int argc = 10;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_EQ(options.layout, StorageLayout::Maildir);
+    EXPECT_EQ(options.fanOut, 16u);
+}
+
+TEST_F(ArgumentsParserTest, ParsesStorageCompression) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-Z", (char*)"32" };
+    int argc = 8;
+    ProgramOptions options = parser.parse(argc, argv);
+
+    EXPECT_TRUE(options.compressStorage);
+    EXPECT_EQ(options.dictionarySamples, 32u);
+}
+
+TEST_F(ArgumentsParserTest, ThrowsOnCompressedMaildir) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-L", (char*)"maildir", (char*)"-Z", (char*)"0" };
+    int argc = 10;
+    EXPECT_THROW(parser.parse(argc, argv), std::invalid_argument);
+}
+
+TEST_F(ArgumentsParserTest, ParsesDeduplication) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-D" };
+    int argc = 7;
+    EXPECT_TRUE(parser.parse(argc, argv).deduplicate);
+}
+
+TEST_F(ArgumentsParserTest, ThrowsOnDeduplicatedPackedLayout) {
+    char* argv[] = { (char*)"imapcl", (char*)"server_address", (char*)"-a", (char*)"auth_file", (char*)"-o", (char*)"output_dir", (char*)"-D", (char*)"-L", (char*)"packed" };
+    int argc = 9;
+    EXPECT_THROW(parser.parse(argc, argv), std::invalid_argument);
+}
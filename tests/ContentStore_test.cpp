@@ -0,0 +1,147 @@
+#include "gtest/gtest.h"
+#include "../src/ContentStore.h"
+#include "../src/FileHandler.h"
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+
+class ContentStoreTest : public ::testing::Test {
+protected:
+    std::string dir = "test_content_store_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    void write(const std::string &path, const std::string &content) {
+        std::ofstream file(path, std::ios::binary);
+        file << content;
+    }
+
+    ino_t inode(const std::string &path) {
+        struct stat info;
+        return ::stat(path.c_str(), &info) == 0 ? info.st_ino : 0;
+    }
+};
+
+TEST_F(ContentStoreTest, HashesInParts) {
+    ContentHash hash;
+    hash.update("a", 1);
+    hash.update("bc", 2);
+    EXPECT_EQ(hash.hex(), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+TEST_F(ContentStoreTest, LinksStoredObjects) {
+    ContentStore store(dir);
+    std::string digest = std::string(64, 'a');
+    write(dir + "/first", "content");
+    EXPECT_FALSE(store.place(digest, dir + "/link", dir + "/second"));
+
+    store.adopt(dir + "/first", digest);
+    EXPECT_EQ(inode(store.objectPath(digest)), inode(dir + "/first"));
+    EXPECT_TRUE(store.place(digest, dir + "/link", dir + "/second"));
+    EXPECT_EQ(inode(dir + "/second"), inode(dir + "/first"));
+    // Placing a link over a link of the same object leaves no temporary link behind
+    EXPECT_TRUE(store.place(digest, dir + "/link", dir + "/second"));
+    EXPECT_FALSE(std::filesystem::exists(dir + "/link"));
+
+    store.remember("user/M42", digest);
+    EXPECT_EQ(store.recall("user/M42"), digest);
+    EXPECT_EQ(store.recall("user/M43"), "");
+
+    // The object stays while a mailbox links to it, only the given objects are checked
+    std::filesystem::remove(dir + "/first");
+    EXPECT_EQ(store.collect({digest}), 0u);
+    std::filesystem::remove(dir + "/second");
+    EXPECT_EQ(store.collect({std::string(64, 'b')}), 0u);
+    EXPECT_TRUE(std::filesystem::exists(store.objectPath(digest)));
+    EXPECT_EQ(store.collect({digest}), 1u);
+    EXPECT_FALSE(std::filesystem::exists(store.objectPath(digest)));
+
+    // The key is left alone, it may belong to an object being linked
+    EXPECT_EQ(store.recall("user/M42"), digest);
+}
+
+TEST_F(ContentStoreTest, FileHandlerStoresIdenticalMessagesOnce) {
+    std::string alice = "alice";
+    std::string bob = "bob";
+    std::string inbox = "INBOX";
+    std::string archive = "Archive";
+    std::string content = "Subject: shared\r\n\r\nBody\r\n";
+    {
+        FileHandler handler(dir, 0);
+        handler.deduplicateMessages();
+        handler.saveMessage(content, 1, alice, inbox);
+        handler.saveMessage(content, 7, alice, archive);
+        handler.saveMessage(content, 3, bob, inbox);
+        handler.saveMessage("Subject: other\r\n\r\nBody\r\n", 2, bob, inbox);
+
+        EXPECT_EQ(inode(dir + "/alice/Archive/7.eml"), inode(dir + "/alice/INBOX/1.eml"));
+        EXPECT_EQ(inode(dir + "/bob/INBOX/3.eml"), inode(dir + "/alice/INBOX/1.eml"));
+        EXPECT_NE(inode(dir + "/bob/INBOX/2.eml"), inode(dir + "/alice/INBOX/1.eml"));
+        EXPECT_EQ(handler.readMessage(3, bob, inbox), content);
+
+        handler.removeMessage(2, bob, inbox);
+    }
+
+    // The object of the removed message is deleted with the FileHandler
+    size_t objects = 0;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(dir + "/" + ContentStore::DIRECTORY)) {
+        objects += entry.is_regular_file() ? 1 : 0;
+    }
+    EXPECT_EQ(objects, 1u);
+}
+
+TEST_F(ContentStoreTest, FileHandlerCollectsObjectsOfRetiredMailboxes) {
+    std::string account = "user";
+    std::string inbox = "INBOX";
+    std::string archive = "Archive";
+    std::string shared = "Subject: shared\r\n\r\nBody\r\n";
+    {
+        FileHandler handler(dir, 0);
+        handler.deduplicateMessages();
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, inbox, 5), 2);
+        handler.saveMessage(shared, 1, account, inbox);
+        handler.saveMessage("Subject: own\r\n\r\nBody\r\n", 2, account, inbox);
+        handler.saveMessage(shared, 1, account, archive);
+
+        // Nothing is reused, the retired messages are deleted in the background
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, inbox, 6), 1);
+    }
+
+    // Only the object still linked from the archive is left
+    size_t objects = 0;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(dir + "/" + ContentStore::DIRECTORY)) {
+        objects += entry.is_regular_file() ? 1 : 0;
+    }
+    EXPECT_EQ(objects, 1u);
+    EXPECT_EQ(std::filesystem::hard_link_count(dir + "/user/Archive/1.eml"), 2u);
+}
+
+TEST_F(ContentStoreTest, FileHandlerPlacesMessagesKnownByObjectId) {
+    std::string account = "user";
+    std::string inbox = "INBOX";
+    std::string archive = "Archive";
+    std::string content = "Subject: labelled\r\n\r\nBody\r\n";
+
+    FileHandler handler(dir, 0);
+    handler.deduplicateMessages();
+    EXPECT_TRUE(handler.placeKnownMessages({{5, "M1a"}, {6, "../bad"}}, account, inbox).empty());
+    handler.saveMessage(content, 5, account, inbox);
+    handler.flush();
+
+    // The same message in another mailbox is linked without its content
+    EXPECT_EQ(handler.placeKnownMessages({{11, "M1a"}, {12, "M2b"}}, account, archive), std::vector<int>{11});
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(11, account, archive), 1);
+    EXPECT_EQ(handler.readMessage(11, account, archive), content);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(12, account, archive), 0);
+
+    // Object IDs are per account
+    std::string other = "other";
+    EXPECT_TRUE(handler.placeKnownMessages({{5, "M1a"}}, other, inbox).empty());
+}
@@ -0,0 +1,61 @@
+#include "gtest/gtest.h"
+#include "../src/DeflateStream.h"
+#include "../src/ImapException.h"
+
+namespace {
+
+std::string inflateAll(DeflateStream &stream, size_t bufferSize) {
+    std::string output;
+    std::vector<char> buffer(bufferSize);
+    size_t received;
+    while ((received = stream.inflate(buffer.data(), buffer.size())) > 0) {
+        output.append(buffer.data(), received);
+    }
+    return output;
+}
+
+}
+
+TEST(DeflateStreamTest, EachCompressedCommandIsDecodableAtOnce) {
+    DeflateStream client;
+    DeflateStream server;
+
+    std::string first = client.compress("A1 NOOP\r\n", 9);
+    server.feed(first.data(), first.size());
+    EXPECT_EQ(inflateAll(server, 64), "A1 NOOP\r\n");
+    EXPECT_FALSE(server.hasPending());
+
+    // The dictionary is shared across commands, so repeated text shrinks
+    std::string second = client.compress("A2 NOOP\r\n", 9);
+    server.feed(second.data(), second.size());
+    EXPECT_EQ(inflateAll(server, 64), "A2 NOOP\r\n");
+    EXPECT_LT(second.size(), first.size());
+}
+
+TEST(DeflateStreamTest, DecompressesArbitrarySplitsIntoSmallBuffers) {
+    DeflateStream sender;
+    DeflateStream receiver;
+    std::string message;
+    for (int i = 0; i < 2000; i++) {
+        message += "Received: from mx" + std::to_string(i % 7) + ".example.com\r\n";
+    }
+
+    std::string compressed = sender.compress(message.data(), message.size());
+    EXPECT_LT(compressed.size(), message.size() / 10);
+
+    std::string output;
+    for (size_t pos = 0; pos < compressed.size(); pos += 13) {
+        receiver.feed(compressed.data() + pos, std::min<size_t>(13, compressed.size() - pos));
+        output += inflateAll(receiver, 100);
+    }
+    EXPECT_EQ(output, message);
+}
+
+TEST(DeflateStreamTest, CorruptedDataThrows) {
+    DeflateStream receiver;
+    std::string garbage = "\xff\xff\xff\xff garbage";
+    receiver.feed(garbage.data(), garbage.size());
+    char buffer[64];
+
+    EXPECT_THROW(receiver.inflate(buffer, sizeof(buffer)), ImapException);
+}
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+#include "../src/EventLoop.h"
+#include <chrono>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+TEST(EventLoopTest, TaskWaitsForDescriptorWrittenByAnotherTask) {
+    EventLoop loop;
+    int pipeFds[2];
+    ASSERT_EQ(pipe(pipeFds), 0);
+    std::vector<std::string> log;
+
+    loop.spawn([&]() {
+        log.push_back("reader waits");
+        EXPECT_TRUE(EventLoop::current()->wait(pipeFds[0], EPOLLIN, 1000));
+        char c;
+        EXPECT_EQ(read(pipeFds[0], &c, 1), 1);
+        log.push_back(std::string("reader got ") + c);
+    });
+    loop.spawn([&]() {
+        log.push_back("writer writes");
+        EXPECT_EQ(write(pipeFds[1], "x", 1), 1);
+    });
+    loop.run();
+
+    EXPECT_EQ(log, (std::vector<std::string>{"reader waits", "writer writes", "reader got x"}));
+    EXPECT_EQ(EventLoop::current(), nullptr);
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+TEST(EventLoopTest, WaitTimesOut) {
+    EventLoop loop;
+    int pipeFds[2];
+    ASSERT_EQ(pipe(pipeFds), 0);
+    bool ready = true;
+
+    loop.spawn([&]() {
+        ready = EventLoop::current()->wait(pipeFds[0], EPOLLIN, 20);
+    });
+    loop.run();
+
+    EXPECT_FALSE(ready);
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+TEST(EventLoopTest, ManyTasksSleepConcurrently) {
+    EventLoop loop;
+    int finished = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 300; i++) {
+        loop.spawn([&]() {
+            EventLoop::current()->sleep(50);
+            finished++;
+        });
+    }
+    loop.run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(finished, 300);
+    EXPECT_LT(elapsed, std::chrono::seconds(2));
+}
+
+TEST(EventLoopTest, JoinWaitsForSpawnedTask) {
+    EventLoop loop;
+    std::vector<int> order;
+
+    loop.spawn([&]() {
+        EventLoop *current = EventLoop::current();
+        size_t child = current->spawn([&]() {
+            EventLoop::current()->sleep(10);
+            order.push_back(1);
+        });
+        current->join(child);
+        order.push_back(2);
+    });
+    loop.run();
+
+    EXPECT_EQ(order, (std::vector<int>{1, 2}));
+}
+
+TEST(EventLoopTest, ExceptionsStayWithTheirTask) {
+    EventLoop loop;
+    std::string rethrown;
+
+    // The first task is suspended inside a catch block while the second one throws
+    loop.spawn([&]() {
+        try {
+            try {
+                throw std::runtime_error("first");
+            } catch (...) {
+                EventLoop::current()->sleep(20);
+                throw;
+            }
+        } catch (const std::runtime_error &e) {
+            rethrown = e.what();
+        }
+    });
+    loop.spawn([&]() {
+        try {
+            throw std::logic_error("second");
+        } catch (const std::logic_error &) {
+            EventLoop::current()->sleep(40);
+        }
+    });
+    loop.run();
+
+    EXPECT_EQ(rethrown, "first");
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include "../src/FetchStream.h"
+#include "../src/FileHandler.h"
+#include "../src/ImapException.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+class FetchStreamTest : public ::testing::Test {
+protected:
+    std::string dir = "test_fetch_stream";
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    std::string readMessage(int id) {
+        std::ifstream file(dir + "/" + account + "/" + mailbox + "/" + std::to_string(id) + ".eml", std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+};
+
+TEST_F(FetchStreamTest, WritesMessagesSplitAcrossChunks) {
+    FileHandler fileHandler(dir);
+    FetchStream stream(fileHandler, account, mailbox);
+    std::string response = "* 1 FETCH (UID 10 BODY[] {5}\r\nHello)\r\n"
+                           "* 2 FETCH (UID 12 BODY[] {8}\r\nA4 OK\r\n\n)\r\n"
+                           "A4 OK Fetch completed\r\n";
+
+    // Feed the response byte by byte to cross every possible boundary
+    for (char c : response) {
+        stream.consume(&c, 1);
+    }
+
+    EXPECT_TRUE(stream.isCompleted("A4"));
+    EXPECT_EQ(stream.takeCompletion("A4"), "A4 OK Fetch completed");
+    EXPECT_EQ(stream.savedMessages().size(), 2u);
+    EXPECT_EQ(readMessage(10), "Hello");
+    EXPECT_EQ(readMessage(12), "A4 OK\r\n\n");
+}
+
+TEST_F(FetchStreamTest, KeepsBinaryDataAndLateUid) {
+    FileHandler fileHandler(dir);
+    FetchStream stream(fileHandler, account, mailbox);
+    std::string body("a\0b", 3);
+    std::string response = "* 3 FETCH (BODY[] {3}\r\n" + body + " UID 7)\r\nA5 OK Done\r\n";
+
+    stream.consume(response.data(), response.size());
+
+    EXPECT_TRUE(stream.isCompleted("A5"));
+    EXPECT_EQ(readMessage(7), body);
+}
+
+TEST_F(FetchStreamTest, IgnoresFetchWithoutBody) {
+    FileHandler fileHandler(dir);
+    FetchStream stream(fileHandler, account, mailbox);
+    std::string response = "* 3 FETCH (FLAGS (\\Seen) UID 7)\r\nA6 OK Done\r\n";
+
+    stream.consume(response.data(), response.size());
+
+    EXPECT_TRUE(stream.isCompleted("A6"));
+    EXPECT_FALSE(stream.isCompleted("A7"));
+    EXPECT_TRUE(stream.savedMessages().empty());
+}
+
+TEST_F(FetchStreamTest, LeavesNoFileForIncompleteMessage) {
+    FileHandler fileHandler(dir);
+    {
+        FetchStream stream(fileHandler, account, mailbox);
+        std::string response = "* 1 FETCH (UID 10 BODY[] {50}\r\nHello";
+        stream.consume(response.data(), response.size());
+    }
+
+    EXPECT_TRUE(std::filesystem::is_empty(dir + "/" + account + "/" + mailbox));
+}
+
+TEST_F(FetchStreamTest, RecordsEnvelopeAroundHeaderFields) {
+    FileHandler fileHandler(dir);
+    FetchStream stream(fileHandler, account, mailbox);
+    std::string response = "* 1 FETCH (UID 4 RFC822.SIZE 2048 BODY[HEADER.FIELDS (FROM SUBJECT)] {25}\r\n"
+                           "From: a@b\r\nSubject: x\r\n\r\n INTERNALDATE \"17-Jul-1996 02:44:25 -0700\" FLAGS (\\Seen $Work))\r\n"
+                           "* 2 FETCH (UID 5 FLAGS () INTERNALDATE \"01-Jan-2024 10:00:00 +0000\" RFC822.SIZE 10 "
+                           "BODY[HEADER.FIELDS (FROM SUBJECT)] \"\\r\\n\")\r\n"
+                           "A6 OK Done\r\n";
+
+    stream.consume(response.data(), response.size());
+
+    EXPECT_EQ(readMessage(4), "From: a@b\r\nSubject: x\r\n\r\n");
+    EXPECT_EQ(stream.savedMessages().size(), 2u);
+    std::ifstream envelopes(dir + "/" + account + "/" + mailbox + "/" + FileHandler::ENVELOPE_FILE);
+    std::stringstream content;
+    content << envelopes.rdbuf();
+    EXPECT_EQ(content.str(), "4 2048 \"17-Jul-1996 02:44:25 -0700\" (\\Seen $Work)\n"
+                             "5 10 \"01-Jan-2024 10:00:00 +0000\" ()\n");
+}
@@ -0,0 +1,112 @@
+#include "gtest/gtest.h"
+#include "../src/HappyEyeballs.h"
+#include "../src/ImapException.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <unistd.h>
+
+namespace {
+
+ResolvedAddress ipv4(const char *ip, int port) {
+    ResolvedAddress address;
+    memset(&address.address, 0, sizeof(address.address));
+    sockaddr_in *in = reinterpret_cast<sockaddr_in *>(&address.address);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    inet_pton(AF_INET, ip, &in->sin_addr);
+    address.length = sizeof(sockaddr_in);
+    address.family = AF_INET;
+    return address;
+}
+
+ResolvedAddress ipv6(int port) {
+    ResolvedAddress address;
+    memset(&address.address, 0, sizeof(address.address));
+    address.address.ss_family = AF_INET6;
+    reinterpret_cast<sockaddr_in6 *>(&address.address)->sin6_port = htons(port);
+    address.length = sizeof(sockaddr_in6);
+    address.family = AF_INET6;
+    return address;
+}
+
+/**
+ * @brief Opens a listening socket on a free local port.
+ */
+int listenLocal(int &port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ResolvedAddress address = ipv4("127.0.0.1", 0);
+    bind(fd, reinterpret_cast<sockaddr *>(&address.address), address.length);
+    listen(fd, 4);
+    sockaddr_in bound;
+    socklen_t length = sizeof(bound);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&bound), &length);
+    port = ntohs(bound.sin_port);
+    return fd;
+}
+
+}
+
+TEST(HappyEyeballsTest, InterleavesAddressFamilies) {
+    std::vector<ResolvedAddress> addresses = {ipv6(1), ipv6(2), ipv6(3), ipv4("127.0.0.1", 4), ipv4("127.0.0.1", 5)};
+    std::vector<ResolvedAddress> ordered = DnsCache::interleave(addresses);
+
+    std::vector<int> families;
+    for (const ResolvedAddress &address : ordered) {
+        families.push_back(address.family);
+    }
+    EXPECT_EQ(families, (std::vector<int>{AF_INET6, AF_INET, AF_INET6, AF_INET, AF_INET6}));
+}
+
+TEST(HappyEyeballsTest, FallsBackAfterRefusedAddress) {
+    int port;
+    int listener = listenLocal(port);
+    int closedPort;
+    close(listenLocal(closedPort));
+
+    int fd = HappyEyeballs::connect({ipv4("127.0.0.1", closedPort), ipv4("127.0.0.1", port)});
+    EXPECT_GE(fd, 0);
+
+    close(fd);
+    close(listener);
+}
+
+TEST(HappyEyeballsTest, UnresponsiveAddressOnlyDelaysByAttemptDelay) {
+    int port;
+    int listener = listenLocal(port);
+    // A listener with a full accept queue drops further SYNs, so connecting to it hangs
+    int fullPort;
+    int full = listenLocal(fullPort);
+    listen(full, 0);
+    int queued = HappyEyeballs::connect({ipv4("127.0.0.1", fullPort)});
+
+    auto start = std::chrono::steady_clock::now();
+    int fd = HappyEyeballs::connect({ipv4("127.0.0.1", fullPort), ipv4("127.0.0.1", port)}, 100, 5000);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_GE(fd, 0);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(100));
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+    close(fd);
+    close(queued);
+    close(full);
+    close(listener);
+}
+
+TEST(HappyEyeballsTest, ThrowsWhenNothingConnects) {
+    int closedPort;
+    close(listenLocal(closedPort));
+
+    EXPECT_THROW(HappyEyeballs::connect({ipv4("127.0.0.1", closedPort)}), ImapException);
+}
+
+TEST(HappyEyeballsTest, CachesResolvedAddresses) {
+    std::vector<ResolvedAddress> first = DnsCache::resolve("127.0.0.1", 143);
+    std::vector<ResolvedAddress> second = DnsCache::resolve("127.0.0.1", 143);
+
+    ASSERT_EQ(first.size(), 1u);
+    ASSERT_EQ(second.size(), 1u);
+    EXPECT_EQ(first[0].family, AF_INET);
+    EXPECT_EQ(memcmp(&first[0].address, &second[0].address, first[0].length), 0);
+}
@@ -106,4 +106,145 @@ TEST_F(ImapParserTest, ParseFetchResponsePartial) {
 TEST_F(ImapParserTest, ParseFetchResponseInvalidFormat) {
     std::string response = "* 1 FETCH BODY[] {12}\r\nHello World!\r\n A1 OK \r\n";
     EXPECT_THROW(parser.parseFetchResponse(response), ImapException);
-}
\ No newline at end of file
+}
+
+TEST_F(ImapParserTest, ParseFetchResponsesMultipleMessages) {
+    std::string response = "* 1 FETCH (UID 10 BODY[] {5}\r\nHello)\r\n"
+                           "* 2 FETCH (UID 12 BODY[] {6}\r\nWorld!)\r\n"
+                           "A4 OK Fetch completed\r\n";
+    std::vector<std::pair<int, std::string>> expected = {{10, "Hello"}, {12, "World!"}};
+    EXPECT_EQ(parser.parseFetchResponses(response), expected);
+}
+
+TEST_F(ImapParserTest, ParseFetchResponsesUidAfterLiteral) {
+    std::string response = "* 3 FETCH (BODY[] {7}\r\nA1 OK\r\n UID 7)\r\nA5 OK Fetch completed\r\n";
+    std::vector<std::pair<int, std::string>> expected = {{7, "A1 OK\r\n"}};
+    EXPECT_EQ(parser.parseFetchResponses(response), expected);
+}
+
+TEST_F(ImapParserTest, ParseFetchResponsesSkipsFlagUpdates) {
+    std::string response = "* 3 FETCH (FLAGS (\\Seen) UID 7)\r\nA5 OK Fetch completed\r\n";
+    EXPECT_TRUE(parser.parseFetchResponses(response).empty());
+}
+
+TEST_F(ImapParserTest, ParseTaggedStatusFailure) {
+    std::string response = "A3 OK Done\r\nA4 NO Message expunged\r\n";
+    EXPECT_NO_THROW(parser.parseTaggedStatus(response, "A3"));
+    EXPECT_THROW(parser.parseTaggedStatus(response, "A4"), ImapException);
+}
+
+TEST_F(ImapParserTest, FormatSequenceSet) {
+    EXPECT_EQ(parser.formatSequenceSet({1, 2, 3, 5, 7, 8}), "1:3,5,7:8");
+    EXPECT_EQ(parser.formatSequenceSet({42}), "42");
+    EXPECT_EQ(parser.formatSequenceSet({}), "");
+}
+
+TEST_F(ImapParserTest, CheckResponseReceivedExactTag) {
+    std::string response = "A12 OK Completed\r\n";
+    EXPECT_FALSE(parser.checkResponseReceived(response, "A1"));
+    EXPECT_TRUE(parser.checkResponseReceived(response, "A12"));
+}
+
+TEST_F(ImapParserTest, ParseListResponse) {
+    std::string response =
+        "* LIST (\\HasNoChildren) \"/\" INBOX\r\n"
+        "* LIST (\\Noselect \\HasChildren) \"/\" \"[Gmail]\"\r\n"
+        "* LIST (\\HasNoChildren \\Sent) \"/\" \"Sent Items\"\r\n"
+        "* LIST () NIL {7}\r\nArchiv\"\r\n"
+        "A4 OK List completed\r\n";
+    std::vector<ListedMailbox> mailboxes = parser.parseListResponse(response);
+    ASSERT_EQ(mailboxes.size(), 3u);
+    EXPECT_EQ(mailboxes[0].name, "INBOX");
+    EXPECT_EQ(mailboxes[0].delimiter, "/");
+    EXPECT_EQ(mailboxes[1].name, "Sent Items");
+    EXPECT_EQ(mailboxes[2].name, "Archiv\"");
+    EXPECT_EQ(mailboxes[2].delimiter, "");
+}
+
+TEST_F(ImapParserTest, MailboxDirectory) {
+    EXPECT_EQ(parser.mailboxDirectory("INBOX", "/"), "INBOX");
+    EXPECT_EQ(parser.mailboxDirectory("INBOX.Sent.2024", "."), "INBOX/Sent/2024");
+    EXPECT_EQ(parser.mailboxDirectory("Work/Projects", "/"), "Work/Projects");
+    EXPECT_EQ(parser.mailboxDirectory("a.b", ""), "a.b");
+    EXPECT_THROW(parser.mailboxDirectory("../../x", "/"), ImapException);
+    EXPECT_THROW(parser.mailboxDirectory("INBOX/../x", "/"), ImapException);
+    EXPECT_THROW(parser.mailboxDirectory(".retired", "/"), ImapException);
+    EXPECT_THROW(parser.mailboxDirectory("INBOX..x", "."), ImapException);
+    EXPECT_THROW(parser.mailboxDirectory("", "/"), ImapException);
+    EXPECT_THROW(parser.mailboxDirectory("a/b", "."), ImapException);
+}
+
+TEST_F(ImapParserTest, FormatMailboxName) {
+    EXPECT_EQ(parser.formatMailboxName("INBOX"), "INBOX");
+    EXPECT_EQ(parser.formatMailboxName("Sent Items"), "\"Sent Items\"");
+    EXPECT_EQ(parser.formatMailboxName("a\"b"), "\"a\\\"b\"");
+}
+
+TEST_F(ImapParserTest, ParseCapabilities) {
+    std::vector<std::string> expected = {"IMAP4REV1", "CONDSTORE", "QRESYNC"};
+    EXPECT_EQ(parser.parseCapabilities("* CAPABILITY IMAP4rev1 CONDSTORE QRESYNC\r\nA1 OK Done\r\n"), expected);
+    EXPECT_EQ(parser.parseCapabilities("A2 OK [CAPABILITY IMAP4rev1 CONDSTORE QRESYNC] Logged in\r\n"), expected);
+    EXPECT_TRUE(parser.parseCapabilities("A2 OK Logged in\r\n").empty());
+}
+
+TEST_F(ImapParserTest, ParseQresyncSelectResponse) {
+    std::string response =
+        "* 55 EXISTS\r\n"
+        "* OK [UIDVALIDITY 42] UIDs valid\r\n"
+        "* OK [HIGHESTMODSEQ 20000] Highest\r\n"
+        "* VANISHED (EARLIER) 3:4,9\r\n"
+        "* 5 FETCH (UID 7 FLAGS (\\Seen) MODSEQ (10007))\r\n"
+        "* 51 FETCH (UID 55 FLAGS () MODSEQ (155))\r\n"
+        "A5 OK [READ-WRITE] Select completed\r\n";
+    EXPECT_EQ(parser.parseHighestModSeq(response), 20000u);
+    EXPECT_EQ(parser.parseVanished(response).toVector(), (std::vector<int>{3, 4, 9}));
+    EXPECT_EQ(parser.parseFetchUids(response), (std::vector<int>{7, 55}));
+    EXPECT_EQ(parser.parseHighestModSeq("* OK [NOMODSEQ] No mod-sequences\r\n"), 0u);
+}
+
+TEST_F(ImapParserTest, ParseSequenceSet) {
+    EXPECT_EQ(parser.parseSequenceSet("7:5,1,2").toVector(), (std::vector<int>{1, 2, 5, 6, 7}));
+    EXPECT_THROW(parser.parseSequenceSet("1:*"), ImapException);
+}
+
+TEST_F(ImapParserTest, ParseSearchResponseWithModSeq) {
+    std::string response = "* SEARCH 2 5 6 (MODSEQ 917162500)\r\nA6 OK Search completed\r\n";
+    EXPECT_EQ(parser.parseSearchResponse(response), (std::vector<int>{2, 5, 6}));
+}
+
+TEST_F(ImapParserTest, ParseEsearchResponse) {
+    std::string response = "* ESEARCH (TAG \"A5\") UID MIN 2 MAX 47 COUNT 4 ALL 2,10:11,47\r\nA5 OK Search completed\r\n";
+    EXPECT_EQ(parser.parseEsearchResponse(response).toVector(), (std::vector<int>{2, 10, 11, 47}));
+    EXPECT_TRUE(parser.parseEsearchResponse("* ESEARCH (TAG \"A6\") UID COUNT 0\r\nA6 OK Done\r\n").empty());
+}
+
+TEST_F(ImapParserTest, ParseExists) {
+    std::string response = "* 17 EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY 42] UIDs valid\r\n* 18 EXISTS\r\nA3 OK Done\r\n";
+    EXPECT_EQ(parser.parseExists(response), 18);
+    EXPECT_EQ(parser.parseExists("A3 OK Done\r\n"), -1);
+}
+
+TEST_F(ImapParserTest, ParseFetchValues) {
+    std::string response = "* 1 FETCH (UID 4 EMAILID (M6d99ac3275bb4e))\r\n* 2 FETCH (EMAILID (Mb2a4) UID 9)\r\n"
+                           "* 3 FETCH (FLAGS (\\Seen))\r\nA7 OK Fetch completed\r\n";
+    std::map<int, std::string> ids = parser.parseFetchValues(response, "EMAILID");
+    EXPECT_EQ(ids.size(), 2u);
+    EXPECT_EQ(ids[4], "M6d99ac3275bb4e");
+    EXPECT_EQ(ids[9], "Mb2a4");
+
+    ids = parser.parseFetchValues("* 1 FETCH (X-GM-MSGID 1278455344230334865 UID 3)\r\nA8 OK Done\r\n", "X-GM-MSGID");
+    EXPECT_EQ(ids[3], "1278455344230334865");
+
+    // Items after a literal are found as well
+    std::map<int, std::string> sizes = parser.parseFetchValues(
+        "* 1 FETCH (UID 3 BODY[HEADER.FIELDS (MESSAGE-ID)] {6}\r\nab\r\n\r\n RFC822.SIZE 2048)\r\nA9 OK Done\r\n", "RFC822.SIZE");
+    EXPECT_EQ(sizes[3], "2048");
+}
+
+TEST_F(ImapParserTest, ParseHeaderField) {
+    std::string header = "Subject: first\r\nmessage-id:\r\n <42@example.com>\r\nTo: user\r\n\r\nMessage-ID: <body>\r\n";
+    EXPECT_EQ(parser.parseHeaderField(header, "Message-ID"), "<42@example.com>");
+    EXPECT_EQ(parser.parseHeaderField(header, "Subject"), "first");
+    EXPECT_EQ(parser.parseHeaderField(header, "Cc"), "");
+    EXPECT_EQ(parser.parseHeaderField("Message-ID: <1@x>\n", "Message-ID"), "<1@x>");
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include "../src/ImapTokenizer.h"
+#include <string>
+#include <vector>
+
+// Records every token and literal part reported by the tokenizer
+class RecordingHandler : public ImapTokenHandler {
+public:
+    std::vector<ImapToken> tokens;
+    std::string literal;
+    int literalEnds = 0;
+
+    void onToken(const ImapToken &token) override {
+        tokens.push_back(token);
+    }
+
+    void onLiteralData(const char *data, size_t length) override {
+        literal.append(data, length);
+    }
+
+    void onLiteralEnd() override {
+        literalEnds++;
+    }
+};
+
+TEST(ImapTokenizerTest, TokenizesStatusLine) {
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize("* OK [UIDVALIDITY 42] UIDs valid\r\n");
+
+    ASSERT_EQ(lines.size(), 1u);
+    const std::vector<ImapToken> &tokens = lines[0].tokens;
+    ASSERT_EQ(tokens.size(), 8u);
+    EXPECT_TRUE(tokens[0].is("*"));
+    EXPECT_TRUE(tokens[1].is("ok"));
+    EXPECT_EQ(tokens[2].type, ImapTokenType::SectionOpen);
+    EXPECT_TRUE(tokens[3].is("UIDVALIDITY"));
+    EXPECT_TRUE(tokens[4].isNumber());
+    EXPECT_EQ(tokens[5].type, ImapTokenType::SectionClose);
+    EXPECT_EQ(lines[0].text(2), "[UIDVALIDITY 42] UIDs valid");
+}
+
+TEST(ImapTokenizerTest, TokenizesQuotedStringsAndLists) {
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize("* LIST (\\HasNoChildren) \"/\" \"Sent \\\"Items\\\"\"\r\n");
+
+    ASSERT_EQ(lines.size(), 1u);
+    const std::vector<ImapToken> &tokens = lines[0].tokens;
+    ASSERT_EQ(tokens.size(), 7u);
+    EXPECT_EQ(tokens[2].type, ImapTokenType::ListOpen);
+    EXPECT_TRUE(tokens[3].is("\\HasNoChildren"));
+    EXPECT_EQ(tokens[4].type, ImapTokenType::ListClose);
+    EXPECT_EQ(tokens[5].type, ImapTokenType::Quoted);
+    EXPECT_EQ(tokens[5].value, "/");
+    EXPECT_EQ(tokens[6].value, "Sent \"Items\"");
+}
+
+TEST(ImapTokenizerTest, LiteralSpansLines) {
+    std::string response = "* 1 FETCH (BODY[] {9}\r\nA1 OK\r\n\r\n UID 3)\r\nA1 OK Done\r\n";
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize(response);
+
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_EQ(lines[0].tokens[7].type, ImapTokenType::Literal);
+    EXPECT_EQ(lines[0].tokens[7].literalSize, 9u);
+    EXPECT_EQ(lines[0].tokens[7].value, "A1 OK\r\n\r\n");
+    EXPECT_TRUE(lines[0].tokens[8].is("UID"));
+    EXPECT_EQ(lines[1].end, response.size());
+}
+
+TEST(ImapTokenizerTest, ResumesAtEveryByte) {
+    std::string response = "* 2 FETCH (UID 5 BODY[] {4}\r\nab\r\n)\r\nA7 NO \"quoted\" text\r\n";
+    RecordingHandler whole;
+    ImapTokenizer wholeTokenizer(whole);
+    wholeTokenizer.feed(response.data(), response.size());
+
+    RecordingHandler split;
+    ImapTokenizer splitTokenizer(split);
+    for (char c : response) {
+        splitTokenizer.feed(&c, 1);
+    }
+
+    ASSERT_EQ(whole.tokens.size(), split.tokens.size());
+    for (size_t i = 0; i < whole.tokens.size(); i++) {
+        EXPECT_EQ(whole.tokens[i].type, split.tokens[i].type);
+        EXPECT_EQ(whole.tokens[i].value, split.tokens[i].value);
+    }
+    EXPECT_EQ(split.literal, "ab\r\n");
+    EXPECT_EQ(split.literalEnds, 1);
+    EXPECT_EQ(splitTokenizer.consumed(), response.size());
+}
+
+TEST(ImapTokenizerTest, BraceInTextIsNotLiteral) {
+    std::vector<ImapLine> lines = ImapTokenizer::tokenize("* OK {not a literal} ready\r\nA1 OK\r\n");
+
+    ASSERT_EQ(lines.size(), 2u);
+    EXPECT_TRUE(lines[0].tokens[2].is("{not"));
+    EXPECT_TRUE(lines[1].tokens[0].is("A1"));
+}
+
+TEST(ImapTokenizerTest, IncompleteLineIsNotReturned) {
+    EXPECT_TRUE(ImapTokenizer::tokenize("* 1 FETCH (BODY[] {12}\r\nHello").empty());
+}
+
+TEST(TaggedCompletionScannerTest, TagSplitAcrossReads) {
+    TaggedCompletionScanner scanner("A12");
+    std::string first = "* 2 EXISTS\r\nA1";
+    std::string second = "2 OK Done\r\n";
+
+    scanner.feed(first.data(), first.size());
+    EXPECT_FALSE(scanner.isComplete());
+    scanner.feed(second.data(), second.size());
+    EXPECT_TRUE(scanner.isComplete());
+}
+
+TEST(TaggedCompletionScannerTest, IgnoresTagInsideLiteral) {
+    TaggedCompletionScanner scanner("A3");
+    std::string response = "* 1 FETCH (BODY[] {12}\r\nA3 OK fake\r\n)\r\n";
+
+    scanner.feed(response.data(), response.size());
+    EXPECT_FALSE(scanner.isComplete());
+
+    std::string completion = "A3 OK Fetch completed\r\n";
+    scanner.feed(completion.data(), completion.size());
+    EXPECT_TRUE(scanner.isComplete());
+}
+
+TEST(TaggedCompletionScannerTest, IgnoresLongerTagAndIncompleteLine) {
+    TaggedCompletionScanner scanner("A1");
+    std::string response = "A12 OK Done\r\nA1 NO Failed";
+
+    scanner.feed(response.data(), response.size());
+    EXPECT_FALSE(scanner.isComplete());
+    scanner.feed("\r\n", 2);
+    EXPECT_TRUE(scanner.isComplete());
+}
+
+TEST(ImapLineReaderTest, KeepsLinesUntilTaken) {
+    ImapLineReader reader;
+    ImapLine line;
+    std::string first = "+ idling\r\n* 3 EXI";
+    std::string second = "STS\r\n* 1 FETCH (BODY[] {4}\r\nab\r\n)\r\n* 4";
+
+    reader.feed(first.data(), first.size());
+    ASSERT_TRUE(reader.next(line));
+    EXPECT_TRUE(line.tokens[0].is("+"));
+    EXPECT_FALSE(reader.next(line));
+
+    reader.feed(second.data(), second.size());
+    ASSERT_TRUE(reader.next(line));
+    EXPECT_EQ(line.text(0), "* 3 EXISTS");
+    ASSERT_TRUE(reader.next(line));
+    EXPECT_EQ(line.tokens.back().type, ImapTokenType::ListClose);
+    EXPECT_EQ(line.tokens[line.tokens.size() - 2].value, "ab\r\n");
+    EXPECT_FALSE(reader.next(line));
+}
@@ -0,0 +1,210 @@
+#include "gtest/gtest.h"
+#include "../src/MailboxIndex.h"
+#include "../src/FileHandler.h"
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+class MailboxIndexTest : public ::testing::Test {
+protected:
+    const std::string dir = "test_index_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+};
+
+TEST_F(MailboxIndexTest, ClassifiesMessages) {
+    EXPECT_EQ(MailboxIndex::classify("Subject: a\r\n\r\nBody\r\n"), MailboxIndex::FULL);
+    EXPECT_EQ(MailboxIndex::classify("Subject: a\r\n\r\n"), MailboxIndex::HEADERS_ONLY);
+    EXPECT_EQ(MailboxIndex::classify("Subject: a\r\n\r\n\r\n"), MailboxIndex::HEADERS_ONLY);
+    EXPECT_EQ(MailboxIndex::classify("Subject: a\n\nBody"), MailboxIndex::FULL);
+}
+
+TEST_F(MailboxIndexTest, RecordsSurviveReload) {
+    {
+        MailboxIndex index(dir);
+        index.reset(42);
+        index.record(7, MailboxIndex::FULL, 100);
+        index.record(3, MailboxIndex::HEADERS_ONLY, 20);
+        index.record(9, MailboxIndex::FULL, 50);
+        index.record(9, MailboxIndex::MISSING, 0);
+    }
+
+    MailboxIndex index(dir);
+    EXPECT_EQ(index.uidValidity(), 42u);
+    EXPECT_EQ(index.lookup(7), MailboxIndex::FULL);
+    EXPECT_EQ(index.lookup(3), MailboxIndex::HEADERS_ONLY);
+    EXPECT_EQ(index.lookup(9), MailboxIndex::MISSING);
+    EXPECT_EQ(index.size(7), 100u);
+    EXPECT_EQ(index.highestUid(), 9u);
+    EXPECT_EQ(index.count(), 2u);
+}
+
+TEST_F(MailboxIndexTest, IgnoresTornRecord) {
+    {
+        MailboxIndex index(dir);
+        index.reset(1);
+        index.record(5, MailboxIndex::FULL, 10);
+    }
+    std::ofstream(dir + "/.index", std::ios::binary | std::ios::app) << "torn";
+
+    MailboxIndex index(dir);
+    EXPECT_EQ(index.lookup(5), MailboxIndex::FULL);
+    EXPECT_EQ(index.count(), 1u);
+    EXPECT_EQ(std::filesystem::file_size(dir + "/.index") % 16, 0u);
+}
+
+TEST_F(MailboxIndexTest, RebuildsFromMessageFiles) {
+    std::ofstream(dir + "/uidvalidity.txt") << 77;
+    std::ofstream(dir + "/1.eml") << "Subject: a\r\n\r\nBody\r\n";
+    std::ofstream(dir + "/2.eml") << "Subject: b\r\n\r\n";
+
+    MailboxIndex index(dir);
+    EXPECT_EQ(index.uidValidity(), 77u);
+    EXPECT_EQ(index.lookup(1), MailboxIndex::FULL);
+    EXPECT_EQ(index.lookup(2), MailboxIndex::HEADERS_ONLY);
+    EXPECT_EQ(index.lookup(3), MailboxIndex::MISSING);
+    EXPECT_TRUE(std::filesystem::exists(dir + "/.index"));
+}
+
+TEST_F(MailboxIndexTest, FileHandlerUsesIndex) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    {
+        FileHandler handler(dir);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+        handler.saveMessage("Subject: b\r\n\r\n", 2, account, mailbox);
+    }
+
+    FileHandler handler(dir);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 0);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(2, account, mailbox), 2);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(3, account, mailbox), 0);
+
+    // A new UIDVALIDITY invalidates the stored messages
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 0);
+}
+
+TEST_F(MailboxIndexTest, FileHandlerRetiresMailboxOnNewUIDValidity) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    std::string child = "INBOX/Sub";
+    std::string message = "Subject: a\r\nMessage-ID: <a@example.com>\r\n\r\nBody\r\n";
+    {
+        FileHandler handler(dir, 0);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, child, 5), 2);
+        handler.saveMessage(message, 1, account, mailbox);
+        handler.saveMessage("Subject: b\r\nMessage-ID: <b@example.com>\r\n\r\nBody\r\n", 2, account, mailbox);
+        handler.saveMessage(message, 3, account, child);
+
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+        EXPECT_FALSE(std::filesystem::exists(dir + "/user/INBOX/1.eml"));
+        EXPECT_TRUE(handler.hasRetiredMessages(account, mailbox));
+
+        // The child mailbox keeps its messages
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, child, 5), 0);
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(3, account, child), 1);
+
+        // A message with the same Message-ID and size is moved back under its new UID
+        std::map<int, std::pair<std::string, uint64_t>> messages = {
+            {10, {"<a@example.com>", message.size()}}, {11, {"<b@example.com>", 1}}, {12, {"<c@example.com>", 30}}};
+        EXPECT_EQ(handler.reuseRetiredMessages(messages, account, mailbox), std::vector<int>{10});
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(10, account, mailbox), 1);
+        EXPECT_EQ(handler.readMessage(10, account, mailbox), message);
+        EXPECT_FALSE(handler.hasRetiredMessages(account, mailbox));
+    }
+
+    // The retired directory is deleted in the background by the time the FileHandler is gone
+    EXPECT_TRUE(std::filesystem::is_empty(dir + "/user/" + FileHandler::RETIRED_DIRECTORY));
+    EXPECT_TRUE(std::filesystem::exists(dir + "/user/INBOX/Sub/3.eml"));
+    FileHandler handler(dir, 0);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 0);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(10, account, mailbox), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 0);
+}
+
+TEST_F(MailboxIndexTest, FileHandlerDeletesOnlyUnlockedRetiredDirectories) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    std::string retiredRoot = dir + "/user/" + FileHandler::RETIRED_DIRECTORY;
+    std::filesystem::create_directories(retiredRoot + "/1-1-0");
+    std::filesystem::create_directories(retiredRoot + "/1-2-0");
+
+    // Another process still uses the second directory
+    int fd = ::open((retiredRoot + "/1-2-0").c_str(), O_RDONLY | O_DIRECTORY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::flock(fd, LOCK_EX), 0);
+    {
+        FileHandler handler(dir, 0);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+    }
+    ::close(fd);
+
+    EXPECT_FALSE(std::filesystem::exists(retiredRoot + "/1-1-0"));
+    EXPECT_TRUE(std::filesystem::exists(retiredRoot + "/1-2-0"));
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator(retiredRoot), std::filesystem::directory_iterator()), 1);
+}
+
+TEST_F(MailboxIndexTest, FileHandlerRecordsMessagesPerGroup) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    FileHandler handler(dir, 3);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+
+    // Messages count as downloaded only once their group is on disk
+    handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+    handler.saveMessage("Subject: b\r\n\r\nBody\r\n", 2, account, mailbox);
+    EXPECT_TRUE(std::filesystem::exists(dir + "/user/INBOX/1.eml"));
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 0);
+
+    handler.saveMessage("Subject: c\r\n\r\nBody\r\n", 3, account, mailbox);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(3, account, mailbox), 1);
+
+    handler.saveMessage("Subject: d\r\n\r\n", 4, account, mailbox);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(4, account, mailbox), 0);
+    handler.flush();
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(4, account, mailbox), 2);
+}
+
+TEST_F(MailboxIndexTest, FileHandlerStoresHighestModSeq) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    FileHandler handler(dir);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+    EXPECT_EQ(handler.readUIDValidity(account, mailbox), 5u);
+    EXPECT_EQ(handler.readHighestModSeq(account, mailbox, "BODY[]"), 0u);
+
+    handler.writeHighestModSeq(account, mailbox, 12345678901ULL, "BODY[]");
+    EXPECT_EQ(handler.readHighestModSeq(account, mailbox, "BODY[]"), 12345678901ULL);
+    EXPECT_EQ(handler.readHighestModSeq(account, mailbox, "HEADER"), 0u);
+
+    // Removing an expunged message updates the index
+    handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+    handler.removeMessage(1, account, mailbox);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 0);
+    EXPECT_TRUE(handler.storedMessages(account, mailbox).empty());
+
+    handler.writeLastSyncedUid(account, mailbox, 4000, "BODY[]");
+    EXPECT_EQ(handler.readLastSyncedUid(account, mailbox, "BODY[]"), 4000u);
+    EXPECT_EQ(handler.readLastSyncedUid(account, mailbox, "HEADER.FIELDS (FROM)"), 0u);
+
+    // A new UIDVALIDITY discards the mod-sequence and the high-water mark
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+    EXPECT_EQ(handler.readHighestModSeq(account, mailbox, "BODY[]"), 0u);
+    EXPECT_EQ(handler.readLastSyncedUid(account, mailbox, "BODY[]"), 0u);
+}
@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+#include "../src/Maildir.h"
+#include "../src/FileHandler.h"
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+class MaildirTest : public ::testing::Test {
+protected:
+    std::string dir = "test_maildir_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    void write(const std::string &path, const std::string &content) {
+        std::ofstream file(path, std::ios::binary);
+        file << content;
+    }
+};
+
+TEST_F(MaildirTest, CreatesMaildirStructure) {
+    Maildir maildir(dir);
+    EXPECT_TRUE(std::filesystem::is_directory(dir + "/tmp"));
+    EXPECT_TRUE(std::filesystem::is_directory(dir + "/new"));
+    EXPECT_TRUE(std::filesystem::is_directory(dir + "/cur"));
+    EXPECT_EQ(maildir.deliveryPath(42), dir + "/new/42.imapcl");
+}
+
+TEST_F(MaildirTest, SpreadsMessagesOverBuckets) {
+    Maildir maildir(dir, 16);
+    EXPECT_TRUE(std::filesystem::is_directory(dir + "/0f/new"));
+
+    std::set<unsigned> buckets;
+    for (uint32_t uid = 1; uid <= 64; uid++) {
+        buckets.insert(maildir.bucket(uid));
+        EXPECT_LT(maildir.bucket(uid), 16u);
+    }
+    EXPECT_EQ(buckets.size(), 16u);
+}
+
+TEST_F(MaildirTest, FindsMessagesMovedToCur) {
+    Maildir maildir(dir);
+    write(dir + "/new/1.imapcl", "one");
+    write(dir + "/cur/2.imapcl:2,S", "two");
+    write(dir + "/cur/23.imapcl:2,", "twenty-three");
+
+    EXPECT_EQ(maildir.find(1), dir + "/new/1.imapcl");
+    EXPECT_EQ(maildir.find(2), dir + "/cur/2.imapcl:2,S");
+    EXPECT_EQ(maildir.find(3), "");
+
+    maildir.remove(2);
+    EXPECT_EQ(maildir.find(2), "");
+    EXPECT_NE(maildir.find(23), "");
+
+    size_t count = 0;
+    maildir.forEach([&](uint32_t, const std::string &) { count++; });
+    EXPECT_EQ(count, 2u);
+    maildir.clear();
+    EXPECT_EQ(maildir.find(1), "");
+    EXPECT_EQ(maildir.find(23), "");
+}
+
+TEST_F(MaildirTest, FileHandlerDeliversToMaildir) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    std::string box = dir + "/user/INBOX";
+    {
+        FileHandler handler(dir, 1, 0, StorageLayout::Maildir, 4);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        handler.saveMessage("Subject: a\r\n\r\n", 1, account, mailbox);
+        handler.saveMessage("Subject: b\r\n\r\nBody\r\n", 2, account, mailbox);
+
+        Maildir maildir(box, 4);
+        EXPECT_TRUE(std::filesystem::exists(maildir.deliveryPath(1)));
+        EXPECT_TRUE(std::filesystem::is_empty(box + "/tmp"));
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 2);
+
+        // A reader takes the message, the full download replaces it
+        std::filesystem::path delivered = maildir.deliveryPath(1);
+        std::filesystem::rename(delivered, delivered.parent_path().parent_path() / "cur" / "1.imapcl:2,S");
+        EXPECT_NE(maildir.find(1), maildir.deliveryPath(1));
+        handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+        EXPECT_EQ(maildir.find(1), maildir.deliveryPath(1));
+
+        std::unique_ptr<MappedMessage> message = handler.mapMessage(2, account, mailbox);
+        ASSERT_NE(message, nullptr);
+        EXPECT_EQ(std::string(message->data(), message->size()), "Subject: b\r\n\r\nBody\r\n");
+    }
+
+    // A lost index is restored from the delivered messages
+    std::filesystem::remove(box + "/.index");
+    FileHandler handler(dir, 1, 0, StorageLayout::Maildir, 4);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(2, account, mailbox), 1);
+    handler.removeMessage(2, account, mailbox);
+    EXPECT_EQ(handler.mapMessage(2, account, mailbox), nullptr);
+}
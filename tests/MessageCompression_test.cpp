@@ -0,0 +1,160 @@
+#include "gtest/gtest.h"
+#include "../src/MessageCompression.h"
+#include "../src/FileHandler.h"
+#include "../src/FileException.h"
+#include <filesystem>
+
+class MessageCompressionTest : public ::testing::Test {
+protected:
+    std::string dir = "test_compression_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    std::string message(int n) {
+        return "Return-Path: <list@example.com>\r\n"
+               "Received: from mx.example.com by imap.example.com\r\n"
+               "From: Mailing List <list@example.com>\r\n"
+               "To: user@example.com\r\n"
+               "Subject: Digest " + std::to_string(n) + "\r\n"
+               "MIME-Version: 1.0\r\n"
+               "Content-Type: text/plain; charset=utf-8\r\n\r\n"
+               "Body of message " + std::to_string(n) + "\r\n";
+    }
+
+    std::string deflate(const std::string &data, const std::string *dictionary) {
+        MessageDeflater deflater(dictionary);
+        std::string output;
+        // Written in parts like a message arriving from the server
+        deflater.compress(data.data(), data.size() / 2, output);
+        deflater.compress(data.data() + data.size() / 2, data.size() - data.size() / 2, output);
+        deflater.finish(output);
+        return output;
+    }
+};
+
+TEST_F(MessageCompressionTest, TrainsDictionaryOnRecurringLines) {
+    std::vector<std::string> samples = {message(1), message(2), message(3)};
+    std::string dictionary = CompressionDictionary::train(samples);
+
+    EXPECT_NE(dictionary.find("From: Mailing List <list@example.com>\r\n"), std::string::npos);
+    EXPECT_EQ(dictionary.find("Subject: Digest"), std::string::npos);
+    EXPECT_LE(dictionary.size(), CompressionDictionary::MAX_SIZE);
+}
+
+TEST_F(MessageCompressionTest, RoundTripsWithAndWithoutDictionary) {
+    std::string dictionary = CompressionDictionary::train({message(1), message(2)});
+    std::string content = message(7);
+
+    std::string plain = deflate(content, nullptr);
+    std::string preset = deflate(content, &dictionary);
+    EXPECT_EQ(inflateMessage(plain.data(), plain.size(), nullptr), content);
+    EXPECT_EQ(inflateMessage(preset.data(), preset.size(), &dictionary), content);
+    EXPECT_LT(preset.size(), plain.size());
+
+    std::string other = "Other dictionary";
+    EXPECT_THROW(inflateMessage(preset.data(), preset.size(), nullptr), FileException);
+    EXPECT_THROW(inflateMessage(preset.data(), preset.size(), &other), FileException);
+    EXPECT_THROW(inflateMessage(preset.data(), preset.size() / 2, &dictionary), FileException);
+}
+
+TEST_F(MessageCompressionTest, StoresDictionaryAfterSamples) {
+    std::string path = dir + "/" + CompressionDictionary::FILE_NAME;
+    {
+        CompressionDictionary dictionary(path, 2);
+        EXPECT_TRUE(dictionary.training());
+        dictionary.addSample(message(1));
+        EXPECT_EQ(dictionary.data(), nullptr);
+        dictionary.addSample(message(2));
+        ASSERT_NE(dictionary.data(), nullptr);
+        EXPECT_FALSE(dictionary.training());
+    }
+
+    CompressionDictionary loaded(path, 2);
+    ASSERT_NE(loaded.data(), nullptr);
+    EXPECT_EQ(*loaded.data(), CompressionDictionary::train({message(1), message(2)}));
+    EXPECT_FALSE(CompressionDictionary(dir + "/none", 0).training());
+}
+
+TEST_F(MessageCompressionTest, FileHandlerStoresCompressedFiles) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    std::string box = dir + "/user/INBOX";
+    {
+        FileHandler handler(dir, 0);
+        handler.compressMessages(2);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        for (int uid = 1; uid <= 4; uid++) {
+            handler.saveMessage(message(uid), uid, account, mailbox);
+        }
+        handler.saveMessage("Subject: headers\r\n\r\n", 5, account, mailbox);
+
+        EXPECT_TRUE(std::filesystem::exists(dir + "/user/" + CompressionDictionary::FILE_NAME));
+        EXPECT_TRUE(std::filesystem::exists(box + "/4.eml.z"));
+        EXPECT_FALSE(std::filesystem::exists(box + "/4.eml"));
+        for (int uid = 1; uid <= 4; uid++) {
+            EXPECT_EQ(handler.readMessage(uid, account, mailbox), message(uid));
+        }
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(5, account, mailbox), 2);
+        EXPECT_THROW(handler.readMessage(6, account, mailbox), FileException);
+    }
+
+    // A lost index is restored by inflating the messages
+    std::filesystem::remove(box + "/.index");
+    FileHandler handler(dir, 0);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(3, account, mailbox), 1);
+    EXPECT_EQ(handler.isMessageAlreadyDownloaded(5, account, mailbox), 2);
+
+    // Without compression the message is stored plainly and replaces the compressed copy
+    handler.saveMessage(message(3), 3, account, mailbox);
+    EXPECT_FALSE(std::filesystem::exists(box + "/3.eml.z"));
+    EXPECT_EQ(handler.readMessage(3, account, mailbox), message(3));
+    handler.removeMessage(4, account, mailbox);
+    EXPECT_FALSE(std::filesystem::exists(box + "/4.eml.z"));
+}
+
+TEST_F(MessageCompressionTest, FileHandlerStoresCompressedSegments) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    {
+        FileHandler handler(dir, 0, 0, StorageLayout::Packed);
+        handler.compressMessages(0);
+        handler.saveMessage(message(1), 1, account, mailbox);
+
+        bool compressed = false;
+        std::unique_ptr<MappedMessage> stored = handler.mapMessage(1, account, mailbox, &compressed);
+        ASSERT_NE(stored, nullptr);
+        EXPECT_TRUE(compressed);
+        EXPECT_LT(stored->size(), message(1).size());
+    }
+
+    // The flag survives reloading the segment journal
+    FileHandler handler(dir, 0, 0, StorageLayout::Packed);
+    EXPECT_EQ(handler.readMessage(1, account, mailbox), message(1));
+}
+
+TEST_F(MessageCompressionTest, FileHandlerReusesRetiredCompressedFiles) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    std::string content = "Message-ID: <7@example.com>\r\n" + message(7);
+
+    FileHandler handler(dir, 0);
+    handler.compressMessages(0);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+    handler.saveMessage(content, 7, account, mailbox);
+    handler.saveMessage("Message-ID: <8@example.com>\r\n" + message(8), 8, account, mailbox);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+
+    // The sizes come from the retired index, the compressed files are not inflated to find them
+    std::map<int, std::pair<std::string, uint64_t>> messages = {
+        {1, {"<7@example.com>", content.size()}}, {2, {"<8@example.com>", 3}}};
+    EXPECT_EQ(handler.reuseRetiredMessages(messages, account, mailbox), std::vector<int>{1});
+    EXPECT_TRUE(std::filesystem::exists(dir + "/user/INBOX/1.eml.z"));
+    EXPECT_EQ(handler.readMessage(1, account, mailbox), content);
+}
@@ -0,0 +1,178 @@
+#include "gtest/gtest.h"
+#include "../src/SegmentStore.h"
+#include "../src/FileHandler.h"
+#include "../src/MailboxIndex.h"
+#include "../src/FileException.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+class SegmentStoreTest : public ::testing::Test {
+protected:
+    std::string dir = "test_segment_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    std::string read(const SegmentStore &store, uint32_t uid) {
+        std::unique_ptr<MappedMessage> message = store.read(uid);
+        return message ? std::string(message->data(), message->size()) : "<missing>";
+    }
+
+    size_t segmentFiles() {
+        size_t count = 0;
+        for (const auto &entry : std::filesystem::directory_iterator(dir + "/segments")) {
+            count += entry.path().extension() == ".seg";
+        }
+        return count;
+    }
+};
+
+TEST_F(SegmentStoreTest, AppendsAndReadsMessages) {
+    {
+        SegmentStore store(dir, 100);
+        store.append(1, "Subject: a\r\n\r\nBody\r\n", MailboxIndex::FULL);
+        store.append(2, std::string(150, 'x'), MailboxIndex::FULL);
+        store.append(3, "Subject: c\r\n\r\n", MailboxIndex::HEADERS_ONLY);
+        EXPECT_EQ(read(store, 1), "Subject: a\r\n\r\nBody\r\n");
+        EXPECT_EQ(read(store, 4), "<missing>");
+    }
+
+    // Messages outgrowing the segment size start new segments, the store survives reopening
+    EXPECT_EQ(segmentFiles(), 3u);
+    SegmentStore store(dir, 100);
+    EXPECT_EQ(read(store, 2), std::string(150, 'x'));
+    EXPECT_EQ(read(store, 3), "Subject: c\r\n\r\n");
+    int headersOnly = 0;
+    store.forEach([&](uint32_t, int kind, uint64_t) { headersOnly += kind == MailboxIndex::HEADERS_ONLY; });
+    EXPECT_EQ(headersOnly, 1);
+}
+
+TEST_F(SegmentStoreTest, ReplacesAndRemovesMessages) {
+    SegmentStore store(dir);
+    store.append(1, "old", MailboxIndex::FULL);
+    store.append(1, "new", MailboxIndex::FULL);
+    store.append(2, "two", MailboxIndex::FULL);
+    store.remove(2);
+
+    EXPECT_EQ(read(store, 1), "new");
+    EXPECT_EQ(read(store, 2), "<missing>");
+    EXPECT_EQ(store.liveBytes(), 3u);
+    EXPECT_EQ(store.totalBytes(), 9u);
+
+    store.compact();
+    EXPECT_EQ(store.totalBytes(), 3u);
+    EXPECT_EQ(read(store, 1), "new");
+    EXPECT_EQ(segmentFiles(), 1u);
+}
+
+TEST_F(SegmentStoreTest, ReadsWhileCompacting) {
+    SegmentStore store(dir, 100);
+    store.append(1, "kept", MailboxIndex::FULL);
+
+    // Every compaction moves the message to a new segment and deletes the old one
+    std::atomic<bool> stop{false};
+    std::atomic<int> failures{0};
+    std::thread reader([&]() {
+        while (!stop) {
+            try {
+                failures += read(store, 1) != "kept";
+            } catch (const FileException &) {
+                failures++;
+            }
+        }
+    });
+    for (int i = 0; i < 50; i++) {
+        store.append(2, std::string(150, 'x'), MailboxIndex::FULL);
+        store.remove(2);
+        store.compact();
+    }
+    stop = true;
+    reader.join();
+    EXPECT_EQ(failures, 0);
+}
+
+TEST_F(SegmentStoreTest, DropsMessagesTornByCrash) {
+    {
+        SegmentStore store(dir);
+        store.append(1, "first", MailboxIndex::FULL);
+        store.append(2, "second", MailboxIndex::FULL);
+    }
+    // The data of the second message and half of a record never reached the disk
+    std::filesystem::resize_file(dir + "/segments/00000001.seg", 8);
+    {
+        std::ofstream journal(dir + "/segments/index", std::ios::binary | std::ios::app);
+        journal.write("torn", 4);
+    }
+
+    SegmentStore store(dir);
+    EXPECT_EQ(read(store, 1), "first");
+    EXPECT_EQ(read(store, 2), "<missing>");
+    EXPECT_EQ(std::filesystem::file_size(dir + "/segments/index") % 32, 0u);
+
+    store.append(3, "third", MailboxIndex::FULL);
+    EXPECT_EQ(read(store, 3), "third");
+}
+
+TEST_F(SegmentStoreTest, ClearDropsAllSegments) {
+    SegmentStore store(dir, 10);
+    store.append(1, "0123456789", MailboxIndex::FULL);
+    store.append(2, "0123456789", MailboxIndex::FULL);
+    store.clear();
+
+    EXPECT_EQ(read(store, 1), "<missing>");
+    EXPECT_EQ(store.totalBytes(), 0u);
+    EXPECT_EQ(segmentFiles(), 1u);
+}
+
+TEST_F(SegmentStoreTest, SyncsClosedAndDeletedSegments) {
+    SegmentStore store(dir, 10);
+    store.append(1, "0123456789", MailboxIndex::FULL);
+    store.append(2, "0123456789", MailboxIndex::FULL);
+    // The first segment is closed already, the dropped ones no longer exist
+    EXPECT_NO_THROW(store.sync());
+    store.append(3, "0123456789", MailboxIndex::FULL);
+    store.clear();
+    EXPECT_NO_THROW(store.sync());
+    EXPECT_EQ(read(store, 2), "<missing>");
+}
+
+TEST_F(SegmentStoreTest, FileHandlerStoresPackedMessages) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    {
+        FileHandler handler(dir, 2, 0, StorageLayout::Packed);
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+        handler.saveMessage("Subject: a\r\n\r\nBody\r\n", 1, account, mailbox);
+        handler.saveMessage("Subject: b\r\n\r\n", 2, account, mailbox);
+        handler.saveMessage("Subject: c\r\n\r\nBody\r\n", 3, account, mailbox);
+        handler.flush();
+
+        EXPECT_FALSE(std::filesystem::exists(dir + "/user/INBOX/1.eml"));
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(2, account, mailbox), 2);
+        std::unique_ptr<MappedMessage> message = handler.mapMessage(1, account, mailbox);
+        ASSERT_NE(message, nullptr);
+        EXPECT_EQ(std::string(message->data(), message->size()), "Subject: a\r\n\r\nBody\r\n");
+
+        handler.removeMessage(3, account, mailbox);
+        EXPECT_EQ(handler.mapMessage(3, account, mailbox), nullptr);
+    }
+
+    // A lost index is restored from the segment journal
+    std::filesystem::remove(dir + "/user/INBOX/.index");
+    {
+        FileHandler handler(dir, 2, 0, StorageLayout::Packed);
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(1, account, mailbox), 1);
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(3, account, mailbox), 0);
+
+        EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 6), 1);
+        EXPECT_EQ(handler.mapMessage(1, account, mailbox), nullptr);
+    }
+}
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+#include "../src/StorageWriter.h"
+#include "../src/FileHandler.h"
+#include "../src/EventLoop.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+class StorageWriterTest : public ::testing::TestWithParam<StorageWriter::Backend> {
+protected:
+    std::string dir = "test_storage_writer_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    std::string read(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        return content.str();
+    }
+};
+
+TEST_P(StorageWriterTest, WritesAndRenamesFiles) {
+    std::atomic<int> done{0};
+    std::atomic<int> errors{0};
+    {
+        StorageWriter writer(1024 * 1024, GetParam());
+        for (int i = 0; i < 200; i++) {
+            std::string path = dir + "/" + std::to_string(i) + ".eml";
+            writer.submit(StorageWriter::Job{path + ".part", path, std::string(i * 37, 'a' + i % 26), [&](int error) {
+                errors += error != 0;
+                done++;
+            }});
+        }
+        writer.drain();
+        EXPECT_EQ(done, 200);
+    }
+
+    EXPECT_EQ(errors, 0);
+    for (int i = 0; i < 200; i++) {
+        EXPECT_EQ(read(dir + "/" + std::to_string(i) + ".eml"), std::string(i * 37, 'a' + i % 26));
+        EXPECT_FALSE(std::filesystem::exists(dir + "/" + std::to_string(i) + ".eml.part"));
+    }
+}
+
+TEST_P(StorageWriterTest, LimitsBytesInFlight) {
+    // Every job exceeds the limit, so they are accepted one at a time
+    StorageWriter writer(1000, GetParam());
+    std::atomic<int> done{0};
+    for (int i = 0; i < 20; i++) {
+        std::string path = dir + "/" + std::to_string(i) + ".eml";
+        writer.submit(StorageWriter::Job{path + ".part", path, std::string(5000, 'x'), [&](int) { done++; }});
+        EXPECT_GE(done, i);
+    }
+    writer.drain();
+    EXPECT_EQ(done, 20);
+}
+
+TEST_P(StorageWriterTest, WaitsInsideEventLoopTasks) {
+    // Both tasks of the loop wait for the limit at the same time, each on its own eventfd
+    StorageWriter writer(1000, GetParam());
+    std::atomic<int> done{0};
+    EventLoop loop;
+    for (int task = 0; task < 2; task++) {
+        loop.spawn([&, task]() {
+            for (int i = 0; i < 20; i++) {
+                std::string path = dir + "/" + std::to_string(task) + "-" + std::to_string(i) + ".eml";
+                writer.submit(StorageWriter::Job{path + ".part", path, std::string(5000, 'x'), [&](int) { done++; }});
+            }
+            writer.drain();
+        });
+    }
+    loop.run();
+    EXPECT_EQ(done, 40);
+}
+
+TEST_P(StorageWriterTest, ReportsFailedWrite) {
+    StorageWriter writer(1024, GetParam());
+    int result = 0;
+    std::string path = dir + "/missing/1.eml";
+    writer.submit(StorageWriter::Job{path + ".part", path, "data", [&](int error) { result = error; }});
+    writer.drain();
+    EXPECT_EQ(result, ENOENT);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, StorageWriterTest,
+                         ::testing::Values(StorageWriter::Backend::Uring, StorageWriter::Backend::ThreadPool));
+
+TEST_F(StorageWriterTest, FileHandlerWritesInBackground) {
+    std::string account = "user";
+    std::string mailbox = "INBOX";
+    FileHandler handler(dir, 2, 4096);
+    EXPECT_EQ(handler.checkMailboxUIDValidity(account, mailbox, 5), 2);
+
+    for (int id = 1; id <= 5; id++) {
+        handler.saveMessage("Subject: " + std::to_string(id) + "\r\n\r\nBody\r\n", id, account, mailbox);
+    }
+    handler.flush();
+
+    for (int id = 1; id <= 5; id++) {
+        EXPECT_EQ(handler.isMessageAlreadyDownloaded(id, account, mailbox), 1);
+        EXPECT_EQ(read(dir + "/user/INBOX/" + std::to_string(id) + ".eml"),
+                  "Subject: " + std::to_string(id) + "\r\n\r\nBody\r\n");
+    }
+}
@@ -0,0 +1,77 @@
+#include "gtest/gtest.h"
+#include "../src/SyncOrchestrator.h"
+#include <fstream>
+#include <sstream>
+
+class SyncOrchestratorTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::ofstream outFile("test_jobs.txt");
+        outFile << "# account mailboxes\n";
+        outFile << "alice.txt INBOX \"Sent Items\"\n";
+        outFile << "\n";
+        outFile << "bob.txt\n";
+        outFile << "carol.txt *\n";
+        outFile.close();
+    }
+
+    void TearDown() override {
+        std::remove("test_jobs.txt");
+    }
+};
+
+TEST_F(SyncOrchestratorTest, ReadJobs) {
+    std::vector<SyncJob> jobs = SyncOrchestrator::readJobs("test_jobs.txt", "INBOX");
+
+    ASSERT_EQ(jobs.size(), 3u);
+    EXPECT_EQ(jobs[0].authFile, "alice.txt");
+    EXPECT_EQ(jobs[0].mailboxes, (std::vector<std::string>{"INBOX", "Sent Items"}));
+    EXPECT_EQ(jobs[1].mailboxes, (std::vector<std::string>{"INBOX"}));
+    EXPECT_EQ(jobs[2].mailboxes, (std::vector<std::string>{"*"}));
+}
+
+TEST_F(SyncOrchestratorTest, JobFileNotFound) {
+    EXPECT_THROW(SyncOrchestrator::readJobs("nonexistent_jobs.txt", "INBOX"), std::runtime_error);
+}
+
+TEST_F(SyncOrchestratorTest, UnreadableAccountFailsItsMailboxes) {
+    ProgramOptions options;
+    options.server = "localhost";
+    options.outputDir = "test_output";
+    options.accounts = 2;
+    SyncOrchestrator orchestrator(options);
+
+    std::vector<SyncJob> jobs = {{"nonexistent1.txt", {"INBOX", "Sent"}}, {"nonexistent2.txt", {"INBOX"}}};
+    std::vector<JobResult> results = orchestrator.run(jobs);
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0].account, "nonexistent1.txt");
+    EXPECT_EQ(results[1].mailbox.mailbox, "Sent");
+    EXPECT_EQ(results[2].account, "nonexistent2.txt");
+    for (const JobResult &result : results) {
+        EXPECT_FALSE(result.mailbox.success);
+    }
+
+    std::ostringstream out;
+    EXPECT_EQ(SyncOrchestrator::printResults(results, out), 1);
+    EXPECT_NE(out.str().find("Synchronized 0 of 3 mailboxes"), std::string::npos);
+}
+
+TEST_F(SyncOrchestratorTest, PrintResultsCountsReusedMessagesSeparately) {
+    std::vector<JobResult> results(2);
+    results[0].account = "user";
+    results[0].mailbox.mailbox = "INBOX";
+    results[0].mailbox.success = true;
+    results[0].mailbox.downloaded = 2;
+    results[0].mailbox.reused = 3;
+    results[1].account = "user";
+    results[1].mailbox.mailbox = "Sent";
+    results[1].mailbox.success = true;
+    results[1].mailbox.downloaded = 1;
+
+    std::ostringstream out;
+    EXPECT_EQ(SyncOrchestrator::printResults(results, out), 0);
+    EXPECT_NE(out.str().find("user INBOX: OK, 2 downloaded, 3 reused\n"), std::string::npos);
+    EXPECT_NE(out.str().find("user Sent: OK, 1 downloaded\n"), std::string::npos);
+    EXPECT_NE(out.str().find("Synchronized 2 of 2 mailboxes, 3 messages downloaded, 3 reused."), std::string::npos);
+}
@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+#include "../src/TlsContext.h"
+#include "openssl/pem.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+
+class TlsContextTest : public ::testing::Test {
+protected:
+    std::string dir = "test_tls_cache_dir";
+
+    void SetUp() override {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir + "/cache");
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    // Builds a TLS 1.2 session whose ID is filled with the given byte, PEM needs a cipher
+    SSL_SESSION *makeSession(unsigned char id, long age = 0, long timeout = 3600) {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        SSL *ssl = SSL_new(ctx);
+        const unsigned char cipher[2] = {0xc0, 0x2f};
+        SSL_SESSION *session = SSL_SESSION_new();
+        SSL_SESSION_set_cipher(session, SSL_CIPHER_find(ssl, cipher));
+        SSL_free(ssl);
+        SSL_CTX_free(ctx);
+
+        unsigned char sessionId[32];
+        unsigned char masterKey[48];
+        std::memset(sessionId, id, sizeof(sessionId));
+        std::memset(masterKey, 0x5a, sizeof(masterKey));
+        SSL_SESSION_set_protocol_version(session, TLS1_2_VERSION);
+        SSL_SESSION_set1_id(session, sessionId, sizeof(sessionId));
+        SSL_SESSION_set1_master_key(session, masterKey, sizeof(masterKey));
+        SSL_SESSION_set_time(session, std::time(nullptr) - age);
+        SSL_SESSION_set_timeout(session, timeout);
+        return session;
+    }
+
+    unsigned char idOf(SSL_SESSION *session) {
+        unsigned int length = 0;
+        const unsigned char *id = SSL_SESSION_get_id(session, &length);
+        return length > 0 ? id[0] : 0;
+    }
+
+    void writePem(const std::string &path, SSL_SESSION *session) {
+        FILE *file = std::fopen(path.c_str(), "w");
+        ASSERT_NE(file, nullptr);
+        EXPECT_EQ(PEM_write_SSL_SESSION(file, session), 1);
+        std::fclose(file);
+        SSL_SESSION_free(session);
+    }
+};
+
+TEST_F(TlsContextTest, GetSharesContextPerLocations) {
+    TlsContext &context = TlsContext::get("", "", dir + "/a");
+    EXPECT_EQ(&TlsContext::get("", "", dir + "/a"), &context);
+    EXPECT_NE(&TlsContext::get("", "", dir + "/b"), &context);
+}
+
+TEST_F(TlsContextTest, StoresSessionReadableOnlyByOwner) {
+    TlsContext &context = TlsContext::get("", "", dir + "/cache");
+    context.storeSession("mail.example.com:993", makeSession(1));
+
+    std::string path = context.sessionPath("mail.example.com:993");
+    EXPECT_EQ(path, dir + "/cache/mail.example.com_993.pem");
+    struct stat info;
+    ASSERT_EQ(::stat(path.c_str(), &info), 0);
+    EXPECT_EQ(info.st_mode & 0777, 0600u);
+
+    FILE *file = std::fopen(path.c_str(), "r");
+    ASSERT_NE(file, nullptr);
+    SSL_SESSION *stored = PEM_read_SSL_SESSION(file, nullptr, nullptr, nullptr);
+    std::fclose(file);
+    ASSERT_NE(stored, nullptr);
+    EXPECT_EQ(idOf(stored), 1);
+    SSL_SESSION_free(stored);
+}
+
+TEST_F(TlsContextTest, OffersSessionOnlyOnce) {
+    TlsContext &context = TlsContext::get("", "", dir + "/cache");
+    context.storeSession("once.example.com:993", makeSession(2));
+
+    SSL_SESSION *session = context.session("once.example.com:993");
+    ASSERT_NE(session, nullptr);
+    EXPECT_EQ(idOf(session), 2);
+    SSL_SESSION_free(session);
+
+    // Neither the memory nor the disk cache offers it again
+    EXPECT_EQ(context.session("once.example.com:993"), nullptr);
+    EXPECT_FALSE(std::filesystem::exists(context.sessionPath("once.example.com:993")));
+}
+
+TEST_F(TlsContextTest, LoadsSessionStoredByEarlierRun) {
+    TlsContext &context = TlsContext::get("", "", dir + "/cache");
+    writePem(context.sessionPath("disk.example.com:993"), makeSession(3));
+
+    SSL_SESSION *session = context.session("disk.example.com:993");
+    ASSERT_NE(session, nullptr);
+    EXPECT_EQ(idOf(session), 3);
+    SSL_SESSION_free(session);
+}
+
+TEST_F(TlsContextTest, RejectsExpiredAndDamagedSessions) {
+    TlsContext &context = TlsContext::get("", "", dir + "/cache");
+    writePem(context.sessionPath("expired.example.com:993"), makeSession(4, 7200, 3600));
+    EXPECT_EQ(context.session("expired.example.com:993"), nullptr);
+
+    std::ofstream(context.sessionPath("damaged.example.com:993"))
+        << "-----BEGIN SSL SESSION PARAMETERS-----\nnot base64\n-----END SSL SESSION PARAMETERS-----\n";
+    EXPECT_EQ(context.session("damaged.example.com:993"), nullptr);
+
+    // An expired session in memory is not offered either
+    context.storeSession("memory.example.com:993", makeSession(5, 7200, 3600));
+    EXPECT_EQ(context.session("memory.example.com:993"), nullptr);
+}
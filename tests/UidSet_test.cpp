@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+#include "../src/UidSet.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+TEST(UidSetTest, BuildsRanges) {
+    UidSet set({1, 2, 3, 5, 7, 8});
+    std::vector<std::pair<uint32_t, uint32_t>> expected = {{1, 3}, {5, 5}, {7, 8}};
+    EXPECT_EQ(set.ranges(), expected);
+    EXPECT_EQ(set.size(), 6u);
+    EXPECT_TRUE(set.contains(5));
+    EXPECT_FALSE(set.contains(6));
+    EXPECT_FALSE(set.contains(9));
+}
+
+TEST(UidSetTest, AddsOutOfOrder) {
+    UidSet set;
+    set.add(5);
+    set.add(1);
+    set.add(3);
+    set.add(2);
+    set.add(4);
+    set.add(4);
+    std::vector<std::pair<uint32_t, uint32_t>> expected = {{1, 5}};
+    EXPECT_EQ(set.ranges(), expected);
+    EXPECT_EQ(set.size(), 5u);
+    EXPECT_EQ(UidSet({9, 2, 3, 1}).toVector(), (std::vector<int>{1, 2, 3, 9}));
+}
+
+TEST(UidSetTest, Difference) {
+    UidSet all({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 20, 21});
+    UidSet stored({2, 3, 6, 10, 11, 20, 21});
+    EXPECT_EQ(all.difference(stored).toVector(), (std::vector<int>{1, 4, 5, 7, 8, 9}));
+    EXPECT_EQ(all.difference(UidSet()).size(), all.size());
+    EXPECT_TRUE(stored.difference(stored).empty());
+}
+
+TEST(UidSetTest, DifferenceOfMillionUids) {
+    // Every third message of a mailbox with a million messages is missing
+    const int count = 1000000;
+    std::vector<int> searched;
+    searched.reserve(count);
+    UidSet stored;
+    for (int uid = 1; uid <= count; uid++) {
+        searched.push_back(uid);
+        if (uid % 3 != 0) {
+            stored.add(uid);
+        }
+    }
+    EXPECT_EQ(stored.ranges().size(), static_cast<size_t>(count / 3 + 1));
+
+    UidSet missing = UidSet(searched).difference(stored);
+    std::vector<int> uids = missing.toVector();
+    ASSERT_EQ(uids.size(), static_cast<size_t>(count / 3));
+    EXPECT_EQ(missing.ranges().size(), uids.size());
+    for (size_t i = 0; i < uids.size(); i++) {
+        ASSERT_EQ(uids[i], static_cast<int>(3 * (i + 1)));
+    }
+    EXPECT_EQ(missing.max(), 999999u);
+    EXPECT_TRUE(missing.intersection(stored).empty());
+}
+
+namespace {
+
+// Builds the search result and the stored UIDs of a mailbox with every third message missing
+// and returns the time of the download decision in microseconds
+long long measureDifference(int count) {
+    std::vector<int> searched;
+    searched.reserve(count);
+    UidSet stored;
+    for (int uid = 1; uid <= count; uid++) {
+        searched.push_back(uid);
+        if (uid % 3 != 0) {
+            stored.add(uid);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    UidSet missing = UidSet(searched).difference(stored);
+    auto end = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(missing.size(), static_cast<size_t>(count / 3));
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+}
+
+// Timing depends on the machine, so the benchmark only reports it and runs with IMAPCL_BENCHMARK=1
+TEST(UidSetTest, BenchmarkDifferenceScalesLinearlyToMillionUids) {
+    if (!std::getenv("IMAPCL_BENCHMARK")) {
+        GTEST_SKIP() << "Set IMAPCL_BENCHMARK=1 to run the benchmark";
+    }
+
+    // Warm up allocations before measuring
+    measureDifference(100000);
+    long long small = std::max(measureDifference(100000), 1LL);
+    long long large = measureDifference(1000000);
+    RecordProperty("microseconds_100k", std::to_string(small));
+    RecordProperty("microseconds_1M", std::to_string(large));
+
+    // Ten times the UIDs take about ten times longer, a quadratic algorithm would take a hundred times longer
+    std::cout << "[ BENCHMARK ] 100k UIDs: " << small << " us, 1M UIDs: " << large << " us, ratio "
+              << static_cast<double>(large) / small << std::endl;
+}
+
+TEST(UidSetTest, AddRangeAndIntersection) {
+    UidSet set;
+    set.addRange(1, 5);
+    set.addRange(4, 8);
+    set.addRange(20, 30);
+    EXPECT_EQ(set.size(), 19u);
+    EXPECT_EQ(set.max(), 30u);
+
+    UidSet other({2, 3, 9, 25});
+    EXPECT_EQ(set.intersection(other).toVector(), (std::vector<int>{2, 3, 25}));
+}
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include "../src/WorkQueue.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+TEST(WorkQueueTest, PartitionsContiguousBatches) {
+    WorkQueue queue(2);
+    queue.distribute({1, 2, 3, 4, 5, 6, 7}, 2);
+
+    std::vector<int> batch;
+    ASSERT_TRUE(queue.pop(0, batch));
+    EXPECT_EQ(batch, (std::vector<int>{1, 2}));
+    ASSERT_TRUE(queue.pop(1, batch));
+    EXPECT_EQ(batch, (std::vector<int>{5, 6}));
+}
+
+TEST(WorkQueueTest, StealsFromOtherLanes) {
+    WorkQueue queue(2);
+    queue.distribute({1, 2, 3, 4}, 1);
+
+    // Worker 1 drains its own lane first, then steals from the back of lane 0
+    std::vector<int> batch;
+    std::vector<int> taken;
+    while (queue.pop(1, batch)) {
+        taken.push_back(batch[0]);
+    }
+    EXPECT_EQ(taken, (std::vector<int>{3, 4, 2, 1}));
+    EXPECT_FALSE(queue.pop(0, batch));
+}
+
+TEST(WorkQueueTest, EveryBatchIsTakenOnceByConcurrentWorkers) {
+    std::vector<int> ids;
+    for (int i = 1; i <= 10000; i++) {
+        ids.push_back(i);
+    }
+    WorkQueue queue(4);
+    queue.distribute(ids, 7);
+
+    std::vector<std::vector<int>> taken(4);
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < 4; worker++) {
+        threads.emplace_back([&queue, &taken, worker]() {
+            std::vector<int> batch;
+            while (queue.pop(worker, batch)) {
+                taken[worker].insert(taken[worker].end(), batch.begin(), batch.end());
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    std::vector<int> all;
+    for (const std::vector<int> &workerTaken : taken) {
+        all.insert(all.end(), workerTaken.begin(), workerTaken.end());
+    }
+    std::sort(all.begin(), all.end());
+    EXPECT_EQ(all, ids);
+}